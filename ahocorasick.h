@@ -0,0 +1,268 @@
+/*
+ * Aho-Corasick multi-pattern matching for PDP-8 console output
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * The patterns are built into a DFA with a full 256 entry transition
+ * table per state, so every byte is one table lookup no matter how many
+ * patterns there are. Each state has the pattern that ends in it, if any,
+ * and a link to the next state on its failure chain that ends a pattern,
+ * so all patterns ending at a byte are found without walking the whole
+ * chain.
+ */
+
+#ifndef AHOCORASICK_H
+#define AHOCORASICK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define AC_ROOT     0
+#define AC_NONE     -1
+
+
+struct ac {
+    int (*next)[256];
+    int *fail;
+    int *out;               /* Pattern ending in the state, or AC_NONE */
+    int *dict;              /* Next state on the failure chain with an out */
+    int states;
+    int alloc;
+    char **pattern;
+    int *len;
+    int patterns;
+    int state;              /* Current state when matching */
+};
+
+
+static void *ac_realloc(void *p, size_t size)
+{
+    if ((p = realloc(p, size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    return p;
+}
+
+
+static int ac_new_state(struct ac *ac)
+{
+    int s = ac->states++;
+
+    if (ac->states > ac->alloc) {
+        ac->alloc = ac->alloc ? 2 * ac->alloc : 64;
+        ac->next = ac_realloc(ac->next, ac->alloc * sizeof(*ac->next));
+        ac->fail = ac_realloc(ac->fail, ac->alloc * sizeof(int));
+        ac->out = ac_realloc(ac->out, ac->alloc * sizeof(int));
+        ac->dict = ac_realloc(ac->dict, ac->alloc * sizeof(int));
+    }
+    memset(ac->next[s], 0xff, sizeof(ac->next[s]));
+    ac->fail[s] = AC_ROOT;
+    ac->out[s] = AC_NONE;
+    ac->dict[s] = AC_NONE;
+    return s;
+}
+
+
+static inline void ac_init(struct ac *ac)
+{
+    memset(ac, 0, sizeof(*ac));
+    ac_new_state(ac);
+}
+
+
+static inline void ac_free(struct ac *ac)
+{
+    int i;
+
+    for (i = 0; i < ac->patterns; i++)
+        free(ac->pattern[i]);
+    free(ac->pattern);
+    free(ac->len);
+    free(ac->next);
+    free(ac->fail);
+    free(ac->out);
+    free(ac->dict);
+}
+
+
+/* Add a pattern before ac_build(), returns its number */
+static inline int ac_add(struct ac *ac, const char *pattern, int len)
+{
+    int s = AC_ROOT;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        unsigned char c = pattern[i];
+
+        if (ac->next[s][c] == AC_NONE) {
+            int n = ac_new_state(ac);
+
+            ac->next[s][c] = n;
+        }
+        s = ac->next[s][c];
+    }
+
+    ac->pattern = ac_realloc(ac->pattern, (ac->patterns + 1) * sizeof(char *));
+    ac->len = ac_realloc(ac->len, (ac->patterns + 1) * sizeof(int));
+    ac->pattern[ac->patterns] = ac_realloc(NULL, len + 1);
+    memcpy(ac->pattern[ac->patterns], pattern, len);
+    ac->pattern[ac->patterns][len] = '\0';
+    ac->len[ac->patterns] = len;
+
+    /* A duplicate is reported as the first one */
+    if (ac->out[s] == AC_NONE && len > 0)
+        ac->out[s] = ac->patterns;
+    return ac->patterns++;
+}
+
+
+/* Breadth first over the trie, filling in failure links and the missing transitions */
+static inline void ac_build(struct ac *ac)
+{
+    int *queue = ac_realloc(NULL, ac->states * sizeof(int));
+    int head = 0, tail = 0;
+    int c;
+
+    for (c = 0; c < 256; c++) {
+        int n = ac->next[AC_ROOT][c];
+
+        if (n == AC_NONE) {
+            ac->next[AC_ROOT][c] = AC_ROOT;
+        } else {
+            ac->fail[n] = AC_ROOT;
+            queue[tail++] = n;
+        }
+    }
+
+    while (head < tail) {
+        int s = queue[head++];
+        int f = ac->fail[s];
+
+        ac->dict[s] = ac->out[f] != AC_NONE ? f : ac->dict[f];
+
+        for (c = 0; c < 256; c++) {
+            int n = ac->next[s][c];
+
+            if (n == AC_NONE) {
+                ac->next[s][c] = ac->next[f][c];
+            } else {
+                ac->fail[n] = ac->next[f][c];
+                queue[tail++] = n;
+            }
+        }
+    }
+    free(queue);
+    ac->state = AC_ROOT;
+}
+
+
+/* Step on one byte, returns the state to give ac_match() */
+static inline int ac_step(struct ac *ac, unsigned char c)
+{
+    return ac->state = ac->next[ac->state][c];
+}
+
+
+/*
+ * Patterns ending in STATE, first call with *S = STATE. Returns the next
+ * pattern number, or AC_NONE when there are no more.
+ */
+static inline int ac_match(struct ac *ac, int *s)
+{
+    int p;
+
+    if (*s == AC_NONE)
+        return AC_NONE;
+    if (ac->out[*s] == AC_NONE)
+        *s = ac->dict[*s];
+    if (*s == AC_NONE)
+        return AC_NONE;
+    p = ac->out[*s];
+    *s = ac->dict[*s];
+    return p;
+}
+
+
+/*
+ * Undo C style escapes in place, \r \n \t \\ and \xHH, so patterns can
+ * hold control chars. Returns the length.
+ */
+static inline int ac_unescape(char *s)
+{
+    char *in = s, *out = s;
+
+    while (*in) {
+        if (in[0] == '\\' && in[1] != '\0') {
+            in++;
+            switch (*in) {
+            case 'r':
+                *out++ = '\r';
+                break;
+            case 'n':
+                *out++ = '\n';
+                break;
+            case 't':
+                *out++ = '\t';
+                break;
+            case 'x': {
+                unsigned int v = 0;
+                int i;
+
+                for (i = 0; i < 2 && in[1] != '\0' && strchr("0123456789abcdefABCDEF", in[1]); i++) {
+                    in++;
+                    v = v * 16 + (*in <= '9' ? *in - '0' : (*in | 0x20) - 'a' + 10);
+                }
+                *out++ = v;
+                break;
+            }
+            default:
+                *out++ = *in;
+            }
+            in++;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+    return out - s;
+}
+
+
+/*
+ * Add the patterns of FILE, one per line with escapes. Empty lines and
+ * lines starting with # are skipped. Returns the number of patterns or -1.
+ */
+static inline int ac_load(struct ac *ac, const char *file)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int num = 0;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\"\n", file);
+        return -1;
+    }
+    while ((len = getline(&line, &size, f)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        len = ac_unescape(line);
+        if (len > 0) {
+            ac_add(ac, line, len);
+            num++;
+        }
+    }
+    free(line);
+    fclose(f);
+    return num;
+}
+
+#endif
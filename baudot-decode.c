@@ -0,0 +1,163 @@
+/*
+ * Program for converting 5-level Baudot/ITA2 papertapes to text
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "baudot.h"
+
+
+const char *argp_program_version =
+    "baudot-decode 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for converting captured 5-level Baudot/ITA2 papertapes to text, takes input from stdin or " \
+    "file and writes the text to stdout or file.\v" \
+    "One code per byte, only the low five bits are used. LTRS/FIGS shifts are followed, blank tape " \
+    "and CR are dropped.";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"filename",        'f', "FILE",        0, "Input papertape capture, default stdin"},
+    {"output",          'o', "FILE",        0, "Output text file, default stdout"},
+    {"table",           't', "ita2/us",     0, "Figures table, ITA2 or US teletype, default ita2"},
+    {"unshift-on-space",'u', 0,             0, "Go back to letters after a space, as many machines did"},
+    { 0 }
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *file;
+    char *output;
+    enum baudot_variant variant;
+    bool unshift_on_space;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'f':
+        arguments->file = arg;
+        break;
+    case 'o':
+        arguments->output = arg;
+        break;
+    case 't':
+        if (0 == strcmp(arg, "ita2")) {
+            arguments->variant = BAUDOT_ITA2;
+        } else if (0 == strcmp(arg, "us")) {
+            arguments->variant = BAUDOT_US;
+        } else {
+            fprintf(stderr, "Invalid table (ita2/us): %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'u':
+        arguments->unshift_on_space = true;
+        break;
+
+    case ARGP_KEY_ARG:
+        argp_usage (state);
+        return ARGP_ERR_UNKNOWN;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, NULL, doc };
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct baudot baudot;
+    unsigned char in[65536];
+    char out[65536];
+    FILE *f, *o;
+    size_t len;
+    int ret = 0;
+
+    args.file = NULL;
+    args.output = NULL;
+    args.variant = BAUDOT_ITA2;
+    args.unshift_on_space = false;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    /*
+     * Use stdin and stdout if no filenames are given.
+     */
+    if (args.file != NULL) {
+        if ((f = fopen(args.file, "r")) == NULL) {
+            fprintf(stderr, "Could not open file \"%s\": %s\n", args.file, strerror(errno));
+            return -1;
+        }
+    } else {
+        f = stdin;
+    }
+
+    if (args.output != NULL) {
+        if ((o = fopen(args.output, "w")) == NULL) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", args.output, strerror(errno));
+            fclose(f);
+            return -1;
+        }
+    } else {
+        o = stdout;
+    }
+
+    baudot_init(&baudot, args.variant, args.unshift_on_space);
+
+    while ((len = fread(in, 1, sizeof(in), f)) > 0) {
+        size_t n = baudot_decode_buf(&baudot, in, len, out);
+
+        if (fwrite(out, 1, n, o) != n) {
+            fprintf(stderr, "Error writing text: %s\n", strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ferror(f)) {
+        fprintf(stderr, "Error reading papertape: %s\n", strerror(errno));
+        ret = -1;
+    }
+
+    fclose(f);
+    if (fclose(o) != 0) {
+        fprintf(stderr, "Error writing text: %s\n", strerror(errno));
+        ret = -1;
+    }
+    return ret;
+}
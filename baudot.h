@@ -0,0 +1,116 @@
+/*
+ * Baudot/ITA2 decoding of 5-level papertapes
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * Codes are read with hole 1 in bit 0, as a UART receives them with five
+ * data bits. Only the low five bits are used, so 5-level tapes read on an
+ * adapter that can't do CS5 work with 8 bits as well.
+ *
+ * LTRS and FIGS switch between the two tables and give no output. Blank
+ * tape and CR are dropped and LF gives a newline, so a tape becomes a
+ * plain text file.
+ */
+
+#ifndef BAUDOT_H
+#define BAUDOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#define BAUDOT_FIGS     0x1b
+#define BAUDOT_LTRS     0x1f
+#define BAUDOT_SPACE    0x04
+#define BAUDOT_NONE     -1
+
+
+enum baudot_variant {
+    BAUDOT_ITA2,
+    BAUDOT_US,
+};
+
+
+struct baudot {
+    const signed char *ltrs;
+    const signed char *figs;
+    bool shifted;
+    bool unshift_on_space;
+};
+
+
+/* Letters are the same in both variants */
+static const signed char baudot_ltrs[32] = {
+    BAUDOT_NONE, 'E', '\n', 'A', ' ', 'S', 'I', 'U',
+    BAUDOT_NONE, 'D', 'R', 'J', 'N', 'F', 'C', 'K',
+    'T', 'Z', 'L', 'W', 'H', 'Y', 'P', 'Q',
+    'O', 'B', 'G', BAUDOT_NONE, 'M', 'X', 'V', BAUDOT_NONE,
+};
+
+/* ITA2, WRU is ENQ and the national use positions F, G and H are left out */
+static const signed char baudot_ita2_figs[32] = {
+    BAUDOT_NONE, '3', '\n', '-', ' ', '\'', '8', '7',
+    BAUDOT_NONE, 005, '4', 007, ',', BAUDOT_NONE, ':', '(',
+    '5', '+', ')', '2', BAUDOT_NONE, '6', '0', '1',
+    '9', '?', BAUDOT_NONE, BAUDOT_NONE, '.', '/', '=', BAUDOT_NONE,
+};
+
+/* US teletype (TTY) figures */
+static const signed char baudot_us_figs[32] = {
+    BAUDOT_NONE, '3', '\n', '-', ' ', 007, '8', '7',
+    BAUDOT_NONE, '$', '4', '\'', ',', '!', ':', '(',
+    '5', '"', ')', '2', '#', '6', '0', '1',
+    '9', '?', '&', BAUDOT_NONE, '.', '/', ';', BAUDOT_NONE,
+};
+
+
+static void baudot_init(struct baudot *b, enum baudot_variant variant, bool unshift_on_space)
+{
+    b->ltrs = baudot_ltrs;
+    b->figs = variant == BAUDOT_US ? baudot_us_figs : baudot_ita2_figs;
+    b->shifted = false;
+    b->unshift_on_space = unshift_on_space;
+}
+
+
+/* Decode one code, returns the char or BAUDOT_NONE */
+static inline int baudot_decode(struct baudot *b, unsigned char c)
+{
+    int ch;
+
+    c &= 0x1f;
+
+    if (c == BAUDOT_FIGS) {
+        b->shifted = true;
+        return BAUDOT_NONE;
+    }
+    if (c == BAUDOT_LTRS) {
+        b->shifted = false;
+        return BAUDOT_NONE;
+    }
+
+    ch = b->shifted ? b->figs[c] : b->ltrs[c];
+
+    if (c == BAUDOT_SPACE && b->unshift_on_space)
+        b->shifted = false;
+    return ch;
+}
+
+
+/* Decode LEN codes into OUT, which must hold LEN chars, returns the number of chars */
+static inline size_t baudot_decode_buf(struct baudot *b, const unsigned char *in, size_t len, char *out)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++) {
+        int ch = baudot_decode(b, in[i]);
+
+        if (ch != BAUDOT_NONE)
+            out[n++] = ch;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * Writing PDP-8 BIN and RIM papertapes
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * Words are given one at a time with their field and address. An origin
+ * is only punched when the address doesn't follow on the previous word,
+ * and a field setting only when the field changes, so the tape is as
+ * short as the loader allows. RIM tapes have an origin for every word
+ * and can't change field.
+ *
+ * bintape_load() goes the other way and reads a tape into memory the way
+ * the loaders do.
+ */
+
+#ifndef BINTAPE_H
+#define BINTAPE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define BINTAPE_LEADER      0x80
+#define BINTAPE_ORIGIN      0x40
+#define BINTAPE_FIELD       0xC0
+#define BINTAPE_DATA_MASK   0x3F
+#define BINTAPE_RUBOUT      0xFF
+
+
+struct bintape {
+    FILE *f;
+    bool rim;
+    int leader;
+    int field;
+    int addr;
+    int csum;
+};
+
+
+static void bintape_frame(struct bintape *t, int c, bool sum)
+{
+    fputc(c, t->f);
+    if (sum)
+        t->csum += c;
+}
+
+
+/* Punch LEADER frames of leader */
+static void bintape_begin(struct bintape *t, FILE *f, bool rim, int leader)
+{
+    int i;
+
+    t->f = f;
+    t->rim = rim;
+    t->leader = leader;
+    t->field = -1;
+    t->addr = -1;
+    t->csum = 0;
+
+    for (i = 0; i < leader; i++)
+        fputc(BINTAPE_LEADER, f);
+}
+
+
+/* Returns -1 for a field other than 0 on a RIM tape */
+static int bintape_word(struct bintape *t, int field, int addr, int word)
+{
+    if (t->rim && field != 0) {
+        fprintf(stderr, "RIM tapes can only load field 0, not %o\n", field);
+        return -1;
+    }
+
+    /* Field settings are not part of the checksum */
+    if (!t->rim && field != t->field) {
+        bintape_frame(t, BINTAPE_FIELD | (field & 7) << 3, false);
+        t->field = field;
+        t->addr = -1;
+    }
+
+    if (t->rim || addr != t->addr) {
+        bintape_frame(t, BINTAPE_ORIGIN | (addr >> 6 & BINTAPE_DATA_MASK), true);
+        bintape_frame(t, addr & BINTAPE_DATA_MASK, true);
+    }
+
+    bintape_frame(t, word >> 6 & BINTAPE_DATA_MASK, true);
+    bintape_frame(t, word & BINTAPE_DATA_MASK, true);
+
+    t->addr = (addr + 1) & 07777;
+    return 0;
+}
+
+
+/* Punch the checksum (BIN only) and the trailer */
+static void bintape_end(struct bintape *t)
+{
+    int i;
+
+    if (!t->rim) {
+        int csum = t->csum & 07777;
+
+        fputc(csum >> 6, t->f);
+        fputc(csum & BINTAPE_DATA_MASK, t->f);
+    }
+
+    for (i = 0; i < t->leader; i++)
+        fputc(BINTAPE_LEADER, t->f);
+}
+
+
+
+struct bintape_info {
+    int words;
+    bool rim;           /* Every word had its own origin */
+    int csum;           /* Sum of the frames, BIN only */
+    int csum_tape;      /* The checksum on the tape */
+};
+
+
+/*
+ * Load a tape into MEM, 8 fields of 4096 words, and set LOADED for every
+ * word it gives. Leader and rubouts are skipped and the tape ends at the
+ * trailer. RIM or BIN is told by the origins, on a BIN tape the last word
+ * is the checksum. Returns the number of words, -1 if there are none.
+ */
+static inline int bintape_load(const unsigned char *p, size_t len, int *mem, bool *loaded,
+                               struct bintape_info *info)
+{
+    unsigned char *frame = malloc(len + 1);
+    size_t i, n = 0, last = 0;
+    int pass, field = 0, addr = 0;
+    bool origin = false;
+
+    if (frame == NULL)
+        return -1;
+
+    /* The frames between leader and trailer, without rubouts */
+    for (i = 0; i < len && (p[i] == BINTAPE_LEADER || p[i] == 0 || p[i] == BINTAPE_RUBOUT); i++)
+        ;
+    for (; i < len && p[i] != BINTAPE_LEADER; i++)
+        if (p[i] != BINTAPE_RUBOUT)
+            frame[n++] = p[i];
+
+    /* Pass 0 finds the last word and if any word is without an origin */
+    info->rim = true;
+    info->csum_tape = 0;
+    for (pass = 0; pass < 2; pass++) {
+        info->words = 0;
+        info->csum = 0;
+        for (i = 0; i < n; i++) {
+            int c = frame[i];
+
+            if ((c & BINTAPE_FIELD) == BINTAPE_FIELD) {
+                field = (c >> 3) & 7;
+                origin = false;
+                continue;
+            }
+            if (i + 1 == n)
+                break;
+            if (c & BINTAPE_ORIGIN) {
+                addr = (c & BINTAPE_DATA_MASK) << 6 | (frame[i + 1] & BINTAPE_DATA_MASK);
+                info->csum += c + frame[i + 1];
+                origin = true;
+                i++;
+                continue;
+            }
+
+            if (pass == 0) {
+                if (!origin)
+                    info->rim = false;
+                last = i;
+            } else if (!info->rim && i == last) {
+                info->csum_tape = c << 6 | (frame[i + 1] & BINTAPE_DATA_MASK);
+                break;
+            } else {
+                mem[field << 12 | addr] = c << 6 | (frame[i + 1] & BINTAPE_DATA_MASK);
+                loaded[field << 12 | addr] = true;
+                info->words++;
+                info->csum += c + frame[i + 1];
+                addr = (addr + 1) & 07777;
+            }
+            origin = false;
+            i++;
+        }
+
+        /* A BIN tape ends in the checksum, which doesn't follow an origin */
+        if (pass == 0) {
+            info->rim = info->rim && n > 0;
+            field = 0;
+            addr = 0;
+            origin = false;
+        }
+    }
+    free(frame);
+    info->csum &= 07777;
+    return info->words > 0 ? info->words : -1;
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Boot ROM images for the M8317 in a PDP-8/A
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * The board holds 128 front panel commands in two 256 x 4 bit ROMs.
+ * create-bootrom, sv2bin and verify-bootrom pack and unpack them with
+ * these functions, parse-bootrom reads the same layout. Entry n is at
+ * bytes 2n and 2n + 1:
+ *
+ *     rom1[2n]   = command            rom2[2n]   = data >> 8
+ *     rom1[2n+1] = (data >> 4) & 0xf  rom2[2n+1] = data & 0xf
+ *
+ * where the command bits are load Address, load Extended address,
+ * Deposit and Start.
+ */
+
+#ifndef BOOTROM_H
+#define BOOTROM_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define ROM_LOADADDR    0x8
+#define ROM_LOADEX      0x4
+#define ROM_DEPOSIT     0x2
+#define ROM_START       0x1
+
+#define ROM_BYTES       256
+#define ROM_ENTRIES     (ROM_BYTES / 2)
+
+
+struct rom_entry {
+    int cmd;
+    int data;
+};
+
+
+/* The first eight entries of every ROM made by create-bootrom */
+static const struct rom_entry rom_autostart[] = {
+    {ROM_LOADADDR,            00000},
+    {ROM_START | ROM_LOADEX,  00000},
+    {ROM_LOADADDR,            00200},
+    {ROM_START | ROM_LOADEX,  00000},
+    {ROM_LOADADDR,            02000},
+    {ROM_START | ROM_LOADEX,  00000},
+    {ROM_LOADADDR,            04200},
+    {ROM_START | ROM_LOADEX,  00000},
+};
+
+#define ROM_AUTOSTART   (sizeof(rom_autostart) / sizeof(rom_autostart[0]))
+
+
+static inline void rom_encode(const struct rom_entry *e, unsigned char *rom1, unsigned char *rom2, int n)
+{
+    rom1[2 * n] = e->cmd;
+    rom2[2 * n] = (e->data >> 8) & 0xf;
+    rom1[2 * n + 1] = (e->data >> 4) & 0xf;
+    rom2[2 * n + 1] = e->data & 0xf;
+}
+
+
+static inline void rom_decode(struct rom_entry *e, const unsigned char *rom1, const unsigned char *rom2, int n)
+{
+    e->cmd = rom1[2 * n];
+    e->data = (rom2[2 * n] & 0xf) << 8 | (rom1[2 * n + 1] & 0xf) << 4 | (rom2[2 * n + 1] & 0xf);
+}
+
+
+static inline int rom_write(const char *file, const unsigned char *rom)
+{
+    FILE *f;
+
+    if ((f = fopen(file, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    if (fwrite(rom, 1, ROM_BYTES, f) != ROM_BYTES) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        fclose(f);
+        return -1;
+    }
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+#endif
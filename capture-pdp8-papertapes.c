@@ -7,15 +7,27 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <argp.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <linux/serial.h>
+
+#include "baudot.h"
+#include "flightrec.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "probes.h"
+#include "reconnect.h"
 
 
 const char *argp_program_version =
@@ -28,7 +40,8 @@ const char *argp_program_bug_address =
 /* Program documentation. */
 static char doc[] =
     "Capture program for PDP-8 papertapes, takes input from serial port and saves it to a file." \
-    "PDP-8 rim and bin formats can be validated. Default is 9600 8N1 on device /dev/ttyUSB0.";
+    "PDP-8 rim and bin formats can be validated, 5-level Baudot/ITA2 tapes are converted to text. " \
+    "Default is 9600 8N1 on device /dev/ttyUSB0, 5N1 for baudot.";
 
 
 /* Options to be parsed. */
@@ -39,9 +52,12 @@ static struct argp_option options[] = {
     {"stop",            'S', "1,2",         OPTION_ARG_OPTIONAL, "Number of stop bits"},
     {"speed",           's', "BAUD",        OPTION_ARG_OPTIONAL, "Serial com speed"},
     {"handshake",       'h', 0,             OPTION_ARG_OPTIONAL, "Use RTS/CTS handshake"},
-    {"format",          'F', "raw/rim/bin", OPTION_ARG_OPTIONAL, "Capture papertape format"},
+    {"format",          'F', "raw/rim/bin/baudot/baudot-us", OPTION_ARG_OPTIONAL, "Capture papertape format"},
     {"strip-lead-in",   'x', "0xXX",        OPTION_ARG_OPTIONAL, "Strip lead in chars, just add 16 bytes to get constant start pattern"},
     {"filename",        'f', "FILE",        OPTION_ARG_OPTIONAL, "Dump received data to file"},
+    {"metrics",         'M', "ENDPOINT",    0,                   "Serve metrics on a UNIX socket path or a localhost TCP port"},
+    {"reconnect",       'r', 0,             0,                   "Wait for an unplugged USB adapter to come back and continue"},
+    {"resume",          'R', 0,             0,                   "Splice a new partial read onto the existing capture file, after a jam, not for baudot"},
     { 0 }
 };
 
@@ -128,6 +144,8 @@ enum tape_format {
     TF_RAW,
     TF_BIN,
     TF_RIM,
+    TF_BAUDOT,
+    TF_BAUDOT_US,
 };
 
 
@@ -143,6 +161,9 @@ struct argp_arguments
     enum tape_format format;
     speed_t speed;
     int leadin_strip;
+    char *metrics;
+    bool reconnect;
+    bool resume;
 };
 
 
@@ -246,6 +267,10 @@ parse_opt (int key, char *arg, struct argp_state *state)
             arguments->format = TF_RIM;
         } else if (arg != NULL && (0 == strncmp(arg, "raw", 3))) {
             arguments->format = TF_RAW;
+        } else if (arg != NULL && (0 == strcmp(arg, "baudot-us"))) {
+            arguments->format = TF_BAUDOT_US;
+        } else if (arg != NULL && (0 == strncmp(arg, "baudot", 6))) {
+            arguments->format = TF_BAUDOT;
         } else {
             fprintf(stderr, "Invalid format: %s\n", arg == NULL ? "NONE" : arg);
             argp_usage (state);
@@ -267,6 +292,15 @@ parse_opt (int key, char *arg, struct argp_state *state)
             return ARGP_ERR_UNKNOWN;
         }
         break;
+    case 'M':
+        arguments->metrics = arg;
+        break;
+    case 'r':
+        arguments->reconnect = true;
+        break;
+    case 'R':
+        arguments->resume = true;
+        break;
 
     case ARGP_KEY_ARG:
         if (state->arg_num != 0){
@@ -278,6 +312,12 @@ parse_opt (int key, char *arg, struct argp_state *state)
             argp_usage (state);
             return ARGP_ERR_UNKNOWN;
         }
+        /* A Baudot capture is decoded text, it can't be lined up with the raw codes */
+        if (arguments->resume && (arguments->format == TF_BAUDOT || arguments->format == TF_BAUDOT_US)) {
+            fprintf(stderr, "--resume can't be used with the baudot formats, capture as raw and decode later\n");
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
         break;
 
     default:
@@ -306,9 +346,9 @@ int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop
 
     if (bits == 5)
         tty.c_cflag |= CS5;         /* 5-bit characters */
-    if (bits == 6)
+    else if (bits == 6)
         tty.c_cflag |= CS6;         /* 6-bit characters */
-    if (bits == 7)
+    else if (bits == 7)
         tty.c_cflag |= CS7;         /* 7-bit characters */
     else if (bits == 8)
         tty.c_cflag |= CS8;         /* 8-bit characters */
@@ -353,177 +393,335 @@ int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop
 }
 
 
-/* Define control codes and bit masks */
-#define CC_LEAD         0x80
-#define CC_TRAIL        0x80
-#define CC_ORIGIN       0x40
-#define CC_FIELD        0xC0
-#define CC_FIELD_MASK   0x1C
-#define CC_DATA_MASK    0x3F
-#define CC_CONTROL_MASK 0xC0
+static struct metric m_rx_bytes = {"pdp8_rx_bytes_total", NULL, "counter", "Bytes received from the serial port"};
+static struct metric m_out_bytes = {"pdp8_capture_bytes_total", NULL, "counter", "Bytes written to the capture file"};
+static struct metric m_read_errors = {"pdp8_read_errors_total", NULL, "counter", "Failed reads from the serial port"};
+static struct metric m_timeouts = {"pdp8_read_timeouts_total", NULL, "counter", "Reads that timed out without data"};
+static struct metric m_overrun = {"pdp8_line_errors_total", "{type=\"overrun\"}", "counter", "Serial line errors reported by the driver"};
+static struct metric m_buf_overrun = {"pdp8_line_errors_total", "{type=\"buffer_overrun\"}", "counter", ""};
+static struct metric m_frame = {"pdp8_line_errors_total", "{type=\"frame\"}", "counter", ""};
+static struct metric m_parity = {"pdp8_line_errors_total", "{type=\"parity\"}", "counter", ""};
+static struct metric m_brk = {"pdp8_line_errors_total", "{type=\"break\"}", "counter", ""};
+static struct metric m_checksum_ok = {"pdp8_checksum_total", "{result=\"ok\"}", "counter", "Verified bin tape checksums"};
+static struct metric m_checksum_fail = {"pdp8_checksum_total", "{result=\"fail\"}", "counter", ""};
+static struct metric m_state = {"pdp8_capture_state", NULL, "gauge", "Capture state, 0 start, 1 lead in, 2-3 data, 4 trail, 5 done"};
+static struct metric m_last_rx = {"pdp8_last_rx_timestamp_seconds", NULL, "gauge", "Time of the last received byte"};
+static struct histogram h_write = {"pdp8_write_latency_seconds", "Time to decode and write one read from the serial port"};
+
+static struct metric *metrics[] = {
+    &m_rx_bytes, &m_out_bytes, &m_read_errors, &m_timeouts,
+    &m_overrun, &m_buf_overrun, &m_frame, &m_parity, &m_brk,
+    &m_checksum_ok, &m_checksum_fail, &m_state, &m_last_rx, NULL
+};
 
+static struct histogram *histograms[] = { &h_write, NULL };
 
-enum captureState_e {
-    CS_START = 0,
-    CS_LEAD_IN,
-    CS_DATA_H,
-    CS_DATA_L,
-    CS_TRAIL,
-    CS_DONE
-};
+
+/* Line error counters are fetched from the driver when metrics are read */
+void update_metrics(void *arg)
+{
+    struct serial_icounter_struct icount;
+    int fd = *(int *)arg;
+
+    if (ioctl(fd, TIOCGICOUNT, &icount) == 0) {
+        metric_set(&m_overrun, icount.overrun);
+        metric_set(&m_buf_overrun, icount.buf_overrun);
+        metric_set(&m_frame, icount.frame);
+        metric_set(&m_parity, icount.parity);
+        metric_set(&m_brk, icount.brk);
+    }
+}
 
 
-void capture_raw(FILE *f, enum captureState_e *state, unsigned char c, int strip_char)
+/*
+ * The decoders are the ones in pipeline.h, the same as tape-pipe uses.
+ * Their output goes to the capture file through a small buffer, call
+ * capture_flush() before looking at the file. capture_reset() starts over.
+ */
+static struct tape_decoder decoder;
+static struct baudot baudot;
+static unsigned char capture_buf[256];
+static struct pl_out capture_out;
+
+
+void capture_flush(struct pl_out *out)
 {
-    /*
-     * Just capture every byte recived until time out. Leave CS_START state to allow time out
-     */
-    int i = 16;
-
-    switch (*state) {
-        case CS_START:
-            if (strip_char != c) {
-                if (strip_char != -1) {
-                    while(i--)
-                        fputc(strip_char, f);
-                } else {
-                    fputc(c, f);
-                }
-                *state = CS_LEAD_IN;
-            }
-            break;
-        case CS_LEAD_IN:
-        case CS_DATA_H:
-        case CS_DATA_L:
-        case CS_TRAIL:
-        case CS_DONE:
-            fputc(c, f);
-            break;
+    if (out->len > 0 && fwrite(out->data, 1, out->len, out->ctx) != out->len)
+        fr_error("write", 0, errno);
+    out->len = 0;
+}
+
+
+void capture_reset(FILE *f, int strip_char)
+{
+    baudot.shifted = false;
+    tape_decoder_init(&decoder, strip_char);
+    capture_out.data = capture_buf;
+    capture_out.len = 0;
+    capture_out.size = sizeof(capture_buf);
+    capture_out.flush = capture_flush;
+    capture_out.ctx = f;
+}
+
+
+/* Reported once for every bin tape, when the trailer is seen */
+void capture_checksum(void)
+{
+    PROBE2(checksum, decoder.calc, decoder.recv);
+    fr_record(FR_NOTE, "checksum", decoder.calc, decoder.recv);
+
+    /* Verify C-SUM */
+    if (decoder.verdict > 0) {
+        printf("Checksum OK!: %4o\n", decoder.recv);
+        metric_add(&m_checksum_ok, 1);
+    } else {
+        printf("Checksum FAIL!: calc %4o <-> recv %4o\n", decoder.calc, decoder.recv);
+        metric_add(&m_checksum_fail, 1);
     }
 }
 
 
-void capture_rim(FILE *f, enum captureState_e *state, unsigned char c)
+/* Like the raw decoder without strip, but the codes are written as text */
+void capture_baudot(unsigned char c)
 {
-    static int leadinCount = 0;
+    int ch = baudot_decode(&baudot, c);
 
-    switch (*state) {
-        case CS_START:
-            if (c == CC_LEAD)
-                leadinCount++;
-            *state = CS_LEAD_IN;
-            break;
+    decoder.state = TS_LEAD_IN;
+    if (ch != BAUDOT_NONE)
+        pl_put(&capture_out, ch);
+}
 
-        case CS_LEAD_IN:
-            if (c == CC_LEAD) {
-                leadinCount++;
-            } else if (((c & CC_CONTROL_MASK) == CC_ORIGIN && leadinCount > 7)){
-                while (leadinCount--) {
-                    fputc(CC_LEAD, f);
-                }
-                fputc(c, f);
-                *state = CS_DATA_H;
-            } else {
-                leadinCount = 0;
-            }
-            break;
 
-        case CS_DATA_H:
-            if (c == 0x80) {
-                *state = CS_TRAIL;
-            }
-            fputc(c, f);
-            break;
+/*
+ * Resume after a jam: the new read is collected in memory, aligned with
+ * the end of the old capture and the two are spliced. The old capture is
+ * trusted up to the first frame that differs from the new read inside the
+ * overlap, the rest comes from the new read. The spliced tape is decoded
+ * again from the start, so the checksum covers the whole tape.
+ */
+#define RESUME_WINDOW   32
+
+struct resume {
+    unsigned char *old;
+    size_t old_len;
+    unsigned char *data;
+    size_t len;
+    size_t size;
+};
 
-        case CS_TRAIL:
-            if (c != CC_TRAIL) {
-                *state = CS_DONE;
-            } else {
-                fputc(c, f);
-            }
-            break;
 
-        case CS_DONE:
-            break;
+int resume_load(struct resume *r, const char *file)
+{
+    FILE *f;
+    long len;
 
-        case CS_DATA_L:
-            break;
+    memset(r, 0, sizeof(*r));
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return -1;
     }
+
+    if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Could not read file \"%s\": %s\n", file, strerror(errno));
+        fclose(f);
+        return -1;
+    }
+
+    r->old_len = len;
+    if ((r->old = malloc(len + 1)) == NULL || fread(r->old, 1, len, f) != r->old_len) {
+        fprintf(stderr, "Could not read file \"%s\"\n", file);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
 }
 
 
-void capture_bin(FILE *f, enum captureState_e *state, unsigned char c)
+int resume_add(struct resume *r, const unsigned char *buf, size_t len)
 {
-    static int leadinCount = 0;
-    static int csum = 0;
-    static int c1 = 0;
-    static int c2 = 0;
-
-    switch (*state) {
-        case CS_START:
-            if (c == CC_LEAD)
-                leadinCount++;
-            *state = CS_LEAD_IN;
-            break;
+    if (r->len + len > r->size) {
+        size_t size = r->size ? r->size : 65536;
+        unsigned char *p;
+
+        while (size < r->len + len)
+            size *= 2;
+        if ((p = realloc(r->data, size)) == NULL) {
+            fprintf(stderr, "Out of memory, %zu bytes received\n", r->len);
+            return -1;
+        }
+        r->data = p;
+        r->size = size;
+    }
+    memcpy(r->data + r->len, buf, len);
+    r->len += len;
+    return 0;
+}
 
-        case CS_LEAD_IN:
-            if (c == CC_LEAD) {
-                leadinCount++;
-            } else if (((c & CC_CONTROL_MASK) == CC_ORIGIN && leadinCount > 7) ||
-                                 ((c & CC_CONTROL_MASK) == CC_FIELD && leadinCount > 7))
-            {
-                while (leadinCount--) {
-                    fputc(CC_LEAD, f);
-                }
 
-                /* CC_FIELD is NOT used for checksum */
-                if ((c & CC_CONTROL_MASK) == CC_ORIGIN) {
-                    csum += c;
-                }
+/* Leader, trailer and blank tape windows don't tell where we are */
+static bool resume_uniform(const unsigned char *p)
+{
+    int i;
 
-                fputc(c, f);
-                *state = CS_DATA_L;
-            } else {
-                leadinCount = 0;
-            }
-            break;
+    for (i = 1; i < RESUME_WINDOW; i++)
+        if (p[i] != p[0])
+            return false;
+    return true;
+}
 
-        case CS_DATA_L:
-            fputc(c, f);
 
-            /* CC_TRAIL or CC_FIELD is not used in checksum calculation */
-            if ( !(c & 0x80)) {
-                csum += c;
-                c2 = c1;
-                c1 = c;
-            }
+/*
+ * Find where the new read starts in the old capture with a rolling hash
+ * over RESUME_WINDOW frames. The first window of the new read that is
+ * found in the old capture decides, among its matches the one with the
+ * longest overlap wins, then the latest. Returns -1 if there is no
+ * overlap.
+ */
+int resume_align(struct resume *r, size_t *old_pos, size_t *new_pos, size_t *overlap)
+{
+    unsigned long long pow = 1, h;
+    size_t windows, mask, i, j;
+    long *head, *next;
+    int found = -1;
 
-            if (c == 0x80) {
-                int checksum = (c2 & 0x3f) << 6 | (c1 & 0x3f);
-                csum = (csum - c1 - c2) & 0xfff;
+    if (r->old_len < RESUME_WINDOW || r->len < RESUME_WINDOW)
+        return -1;
 
-                /* Verify C-SUM */
-                if (csum  == checksum){
-                    printf("Checksum OK!: %4o\n", checksum);
-                } else {
-                    printf("Checksum FAIL!: calc %4o <-> recv %4o\n", csum, checksum);
-                }
-                *state = CS_TRAIL;
-            }
-            break;
+    windows = r->old_len - RESUME_WINDOW + 1;
+    for (mask = 1; mask < 2 * windows; mask <<= 1)
+        ;
+    mask--;
+
+    head = malloc((mask + 1) * sizeof(long));
+    next = malloc(windows * sizeof(long));
+    if (head == NULL || next == NULL) {
+        fprintf(stderr, "Out of memory aligning %zu bytes\n", r->old_len);
+        free(head);
+        free(next);
+        return -1;
+    }
+    memset(head, 0xff, (mask + 1) * sizeof(long));
+
+    for (i = 1; i < RESUME_WINDOW; i++)
+        pow *= 257;
+
+    /* Index every window of the old capture */
+    for (h = 0, i = 0; i < r->old_len; i++) {
+        if (i >= RESUME_WINDOW)
+            h -= r->old[i - RESUME_WINDOW] * pow;
+        h = h * 257 + r->old[i];
+
+        if (i + 1 >= RESUME_WINDOW) {
+            size_t pos = i + 1 - RESUME_WINDOW;
+
+            next[pos] = head[h & mask];
+            head[h & mask] = pos;
+        }
+    }
+
+    /* Roll over the new read until a window is found */
+    for (h = 0, j = 0; j < r->len && found < 0; j++) {
+        long pos;
+
+        if (j >= RESUME_WINDOW)
+            h -= r->data[j - RESUME_WINDOW] * pow;
+        h = h * 257 + r->data[j];
+
+        if (j + 1 < RESUME_WINDOW || resume_uniform(r->data + j + 1 - RESUME_WINDOW))
+            continue;
 
-        case CS_TRAIL:
-            if (c != CC_TRAIL) {
-                *state = CS_DONE;
-            } else {
-                fputc(c, f);
+        for (pos = head[h & mask]; pos >= 0; pos = next[pos]) {
+            size_t start = j + 1 - RESUME_WINDOW;
+            size_t m = 0;
+
+            while (pos + m < r->old_len && start + m < r->len && r->old[pos + m] == r->data[start + m])
+                m++;
+
+            if (m < RESUME_WINDOW)
+                continue;
+            if (found < 0 || m > *overlap || (m == *overlap && (size_t)pos > *old_pos)) {
+                *old_pos = pos;
+                *new_pos = start;
+                *overlap = m;
+                found = 0;
             }
-            break;
+        }
+    }
 
-        case CS_DONE:
-        case CS_DATA_H:
-            break;
+    free(head);
+    free(next);
+    return found;
+}
+
+
+void capture_byte(unsigned char c, struct argp_arguments *args)
+{
+    int verdict = decoder.verdict;
+
+    if (args->format == TF_BIN) tape_bin(&decoder, &capture_out, c);
+    if (args->format == TF_RIM) tape_rim(&decoder, &capture_out, c);
+    if (args->format == TF_RAW) tape_raw(&decoder, &capture_out, c);
+    if (args->format == TF_BAUDOT || args->format == TF_BAUDOT_US) capture_baudot(c);
+
+    if (decoder.verdict != verdict)
+        capture_checksum();
+}
+
+
+/* Splice the new read onto the old capture and decode the result into the capture file */
+int resume_finish(struct resume *r, struct argp_arguments *args)
+{
+    size_t old_pos, new_pos, overlap, i;
+    char path[PATH_MAX];
+    FILE *f;
+
+    if (resume_align(r, &old_pos, &new_pos, &overlap) < 0) {
+        snprintf(path, sizeof(path), "%s.part", args->file);
+        fprintf(stderr, "No overlap found between \"%s\" and the new read, saving it in \"%s\"\n", args->file, path);
+        if ((f = fopen(path, "w")) != NULL) {
+            fwrite(r->data, 1, r->len, f);
+            fclose(f);
+        }
+        return -1;
     }
+
+    printf("New read of %zu bytes overlaps %zu bytes at offset %zu, spliced at offset %zu\n",
+           r->len, overlap, old_pos, old_pos + overlap);
+
+    /* Write next to the old capture, it is only replaced when all is written */
+    snprintf(path, sizeof(path), "%s.tmp", args->file);
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    capture_reset(f, args->leadin_strip);
+    for (i = 0; i < old_pos + overlap; i++)
+        capture_byte(r->old[i], args);
+    for (i = new_pos + overlap; i < r->len; i++)
+        capture_byte(r->data[i], args);
+    capture_flush(&capture_out);
+
+    if (fclose(f) != 0 || rename(path, args->file) < 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", args->file, strerror(errno));
+        return -1;
+    }
+
+    if (args->format != TF_RAW && decoder.state != TS_TRAIL && decoder.state != TS_DONE)
+        fprintf(stderr, "No trailer found, the tape is still incomplete, resume again\n");
+    return 0;
+}
+
+
+/* Ctrl-C or SIGTERM ends the capture at the next read, or a wait for a lost adapter */
+static atomic_bool stop;
+
+static void on_stop(int sig)
+{
+    fr_record(FR_NOTE, "stop", sig, 0);
+    atomic_store(&stop, true);
 }
 
 
@@ -531,11 +729,13 @@ int main(int argc, char **argv)
 {
     int fd;
     FILE *fCapture;
-    enum captureState_e state = CS_START;
     bool time_out = false;
     struct argp_arguments args;
+    struct reconnect rc;
+    struct resume resume;
+    long offset = 0;
 
-    args.bits = 8;
+    args.bits = 0;
     args.parity = 'N';
     args.stop_bits = 1;
     args.device = "/dev/ttyUSB0";
@@ -544,26 +744,70 @@ int main(int argc, char **argv)
     args.handshake = false;
     args.format = TF_RAW;
     args.leadin_strip = -1;
+    args.metrics = NULL;
+    args.reconnect = false;
+    args.resume = false;
 
     if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
         return -1;
 
+    /* 5-level tapes, unless the adapter can only do more bits */
+    if (args.bits == 0)
+        args.bits = (args.format == TF_BAUDOT || args.format == TF_BAUDOT_US) ? 5 : 8;
+    baudot_init(&baudot, args.format == TF_BAUDOT_US ? BAUDOT_US : BAUDOT_ITA2, false);
+
+    /* Before fr_init(), so the flight recorder leaves these two alone. A second one kills */
+    {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        sigemptyset(&sa.sa_mask);
+        sa.sa_handler = on_stop;
+        sa.sa_flags = SA_RESTART | SA_RESETHAND;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+    fr_init("capture-papertape");
+
+    if (args.reconnect && reconnect_init(&rc, args.device, args.file) < 0)
+        return -1;
+
     fd = open(args.device, O_RDWR | O_NOCTTY | O_SYNC);
     if (fd < 0) {
+        fr_error("open", 0, errno);
         fprintf(stderr, "Error opening device %s: %s\n", args.device, strerror(errno));
         return -1;
     }
+    fr_record(FR_NOTE, "open", fd, 0);
 
     if (set_interface_attribs(fd, args.speed, args.parity, args.bits, args.stop_bits, args.handshake) < 0) {
+        fr_error("termios", 0, errno);
         close(fd);
         return -1;
     }
+    fr_termios(fd, "set");
 
-    if ((fCapture = fopen(args.file, "w")) == NULL) {
+    /* On resume the old capture is read now and only rewritten at the end */
+    if (args.resume) {
+        if (resume_load(&resume, args.file) < 0) {
+            close(fd);
+            return -1;
+        }
+        fCapture = NULL;
+    } else if ((fCapture = fopen(args.file, "w")) == NULL) {
+        fr_error("output", 0, errno);
         fprintf(stderr, "Could not write to file \"%s\": %s\n", args.file, strerror(errno));
         close(fd);
         return -1;
     }
+    capture_reset(fCapture, args.leadin_strip);
+
+    if (args.metrics && metrics_start(args.metrics, metrics, histograms, update_metrics, &fd) < 0) {
+        close(fd);
+        if (fCapture != NULL)
+            fclose(fCapture);
+        return -1;
+    }
 
     /* Simple non canonical input */
     do {
@@ -571,23 +815,95 @@ int main(int argc, char **argv)
         int rdlen;
 
         rdlen = read(fd, buf, sizeof(buf) - 1);
-        if (rdlen > 0) {
+        PROBE2(rx_read, offset, rdlen);
+        fr_record(FR_READ, "rx", offset, rdlen);
+        fr_modem(fd);
+
+        /* A lost adapter gives errors or end of file, not timeouts */
+        if (rdlen <= 0 && args.reconnect && serial_gone(fd)) {
+            fr_record(FR_NOTE, "gone", offset, fd);
+            fd = reconnect_wait(&rc, fd, offset, &stop);
+            if (fd < 0)
+                break;
+            fr_record(FR_NOTE, "reconnected", offset, fd);
+            if (set_interface_attribs(fd, args.speed, args.parity, args.bits, args.stop_bits, args.handshake) < 0) {
+                fr_error("termios", offset, errno);
+                break;
+            }
+            fr_termios(fd, "set");
+            if (fCapture != NULL) {
+                capture_flush(&capture_out);
+                fflush(fCapture);
+                reconnect_note_gap(&rc, ftell(fCapture));
+            }
+            time_out = false;
+            continue;
+        }
+
+        if (rdlen > 0 && args.resume) {
+            metric_add(&m_rx_bytes, rdlen);
+            metric_set(&m_last_rx, time(NULL));
+            offset += rdlen;
+
+            if (resume_add(&resume, buf, rdlen) < 0) {
+                fr_error("resume", offset, errno);
+                break;
+            }
+            time_out = false;
+        } else if (rdlen > 0) {
+            unsigned long long start = metrics_now_us();
+            long pos = ftell(fCapture);
             unsigned char *p;
 
-            for (p = buf; rdlen-- > 0; p++) {
-                if (args.format == TF_BIN) capture_bin(fCapture, &state, *p);
-                if (args.format == TF_RIM) capture_rim(fCapture, &state, *p);
-                if (args.format == TF_RAW) capture_raw(fCapture, &state, *p, args.leadin_strip);
+            metric_add(&m_rx_bytes, rdlen);
+            metric_set(&m_last_rx, time(NULL));
+
+            for (p = buf; rdlen-- > 0; p++, offset++) {
+                enum tape_state old_state = decoder.state;
+
+                capture_byte(*p, &args);
+
+                if (decoder.state != old_state) {
+                    PROBE4(decode_state, offset, *p, old_state, decoder.state);
+                    fr_record(FR_STATE, "decode", old_state, decoder.state);
+                }
             }
+            capture_flush(&capture_out);
             time_out = false;
+
+            metric_add(&m_out_bytes, ftell(fCapture) - pos);
+            metric_set(&m_state, decoder.state);
+            histogram_observe(&h_write, metrics_now_us() - start);
         } else if (rdlen == 0) {
+            if (!time_out)
+                fr_record(FR_NOTE, "timeout", offset, decoder.state);
             time_out = true;
+            metric_add(&m_timeouts, 1);
         } else {
+            fr_error("read", offset, errno);
             fprintf(stderr, "Error from read: %d: %s\n", rdlen, strerror(errno));
             time_out = true;
+            metric_add(&m_read_errors, 1);
         }
-    } while (state == CS_START || (state != CS_DONE && !time_out));
+    } while (!atomic_load(&stop) &&
+             (args.resume ? (resume.len == 0 || !time_out) :
+              (decoder.state == TS_START || (decoder.state != TS_DONE && !time_out))));
+
+    if (fd >= 0)
+        close(fd);
+
+    /* What was captured is kept, a resume leaves the old capture as it was */
+    if (atomic_load(&stop)) {
+        fprintf(stderr, "Capture stopped at offset %ld\n", offset);
+        if (fCapture != NULL)
+            fclose(fCapture);
+        return -1;
+    }
+
+    /* The reader is run to the end of the tape, so a resume ends on time out */
+    if (args.resume)
+        return resume_finish(&resume, &args);
 
-    close(fd);
     fclose(fCapture);
+    return 0;
 }
@@ -7,48 +7,21 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "bootrom.h"
+
 #define TRAIL 0x80
 #define FIELD 0xC0
 #define ORIGIN 0x40
 #define DATA 0x00
 #define MASK  0xC0
 
-#define ROM_LOADADDR  0x8
-#define ROM_LOADEX    0x4
-#define ROM_DEPOSIT   0x2
-#define ROM_START     0x1
-
-struct romData {
-	int cmd;
-	int data;
-};
-
-struct romData autoStart[] = {
-	{ROM_LOADADDR,            00000},
-	{ROM_START | ROM_LOADEX,  00000},
-	{ROM_LOADADDR,            00200},
-	{ROM_START | ROM_LOADEX,  00000},
-	{ROM_LOADADDR,            02000},
-	{ROM_START | ROM_LOADEX,  00000},
-	{ROM_LOADADDR,            04200},
-	{ROM_START | ROM_LOADEX,  00000}};
-
-void write_entry (struct romData data, FILE *out1, FILE *out2)
-{
-	// Even address
-	fputc(data.cmd, out1);
-	fputc((data.data >> 8) & 0xf , out2);
-	// Odd address
-	fputc((data.data >> 4) & 0xf, out1);
-	fputc(data.data & 0xf , out2);
-}
-
 int main(void)
 {
-	FILE *fp, *out1, *out2;
+	FILE *fp;
 	int i=0, n=0, ch, ch1;
 	int checksum = 0;
-	struct romData bootloader[128];
+	struct rom_entry bootloader[ROM_ENTRIES];
+	unsigned char rom1[ROM_BYTES], rom2[ROM_BYTES];
 
 	memset (bootloader, 0, sizeof bootloader);
 
@@ -85,12 +58,9 @@ int main(void)
 	}
 	fclose(fp);
 
-	out1 = fopen("rom1.bin", "w");
-	out2 = fopen("rom2.bin", "w");
-
-	// Write autostart data
-	for (i=0; i < sizeof(autoStart) / (2 * sizeof(int)) ; i++)
-		write_entry (autoStart[i], out1, out2);
+	// Autostart data first, the packing is shared with parse-bootrom
+	for (i=0; i < ROM_AUTOSTART; i++)
+		rom_encode (&rom_autostart[i], rom1, rom2, i);
 
 	//Strip checksum
 	n--;
@@ -98,9 +68,10 @@ int main(void)
 	bootloader[n].cmd = ROM_LOADADDR | ROM_START;
 	bootloader[n++].data = 020; //HARD START ADDRESS (should be in param)
 
-	for (i=8; i < 128 ; i++)
-		write_entry (bootloader[i-8], out1, out2);
+	for (i=ROM_AUTOSTART; i < ROM_ENTRIES ; i++)
+		rom_encode (&bootloader[i-ROM_AUTOSTART], rom1, rom2, i);
 
-	fclose (out1);
-	fclose (out2);
+	if (rom_write("rom1.bin", rom1) < 0 || rom_write("rom2.bin", rom2) < 0)
+		return -1;
+	return 0;
 }
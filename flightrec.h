@@ -0,0 +1,362 @@
+/*
+ * Flight recorder for the PDP-8 tools
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * A fixed ring of the latest internal events, always on: reads and writes
+ * with their sizes, state changes, termios settings and modem lines. An
+ * event is claimed with one atomic add and marked complete by storing its
+ * sequence number last, so any thread or signal handler can record without
+ * a lock, and the dump skips an event that is half written.
+ *
+ * The ring is written as text to PROGRAM.flightrec, or the file named in
+ * $PDP8_FLIGHTREC, when fr_error() is called, on SIGUSR1, at exit and when
+ * killed by SIGINT, SIGTERM or a crash. The dump only uses write(), so it
+ * is safe in a signal handler. Example:
+ *
+ *     kill -USR1 $(pidof put-tape); cat put-tape.flightrec
+ */
+
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define FR_EVENTS       4096        /* Power of two */
+
+
+enum fr_type {
+    FR_READ,            /* a = offset, b = length or -1 */
+    FR_WRITE,           /* a = offset, b = length or -1 */
+    FR_STATE,           /* a = old state, b = new state */
+    FR_TERMIOS,         /* a = speed, b = c_cflag */
+    FR_MODEM,           /* a = old lines, b = new lines */
+    FR_ERROR,           /* a = offset, b = errno */
+    FR_NOTE,            /* a, b as the caller likes */
+};
+
+
+struct fr_event {
+    atomic_ulong seq;   /* Event number + 1 when complete, 0 while written */
+    long long time;     /* Microseconds from fr_init() */
+    enum fr_type type;
+    const char *what;   /* A string literal */
+    long a;
+    long b;
+};
+
+
+static struct {
+    struct fr_event ring[FR_EVENTS];
+    atomic_ulong head;
+    char file[4096];
+    const char *program;
+    long long start;
+    time_t start_wall;
+    int modem;
+} fr;
+
+
+static long long fr_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+static inline void fr_record(enum fr_type type, const char *what, long a, long b)
+{
+    unsigned long n = atomic_fetch_add_explicit(&fr.head, 1, memory_order_relaxed);
+    struct fr_event *e = &fr.ring[n & (FR_EVENTS - 1)];
+
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->time = fr_now() - fr.start;
+    e->type = type;
+    e->what = what;
+    e->a = a;
+    e->b = b;
+    atomic_store_explicit(&e->seq, n + 1, memory_order_release);
+}
+
+
+/* Text output without stdio, for the signal handlers */
+struct fr_out {
+    int fd;
+    char buf[256];
+    int len;
+};
+
+
+static void fr_flush(struct fr_out *o)
+{
+    if (o->len > 0 && write(o->fd, o->buf, o->len) < 0)
+        o->fd = -1;
+    o->len = 0;
+}
+
+
+static void fr_str(struct fr_out *o, const char *s)
+{
+    while (*s) {
+        if (o->len == sizeof(o->buf))
+            fr_flush(o);
+        o->buf[o->len++] = *s++;
+    }
+}
+
+
+/* At least WIDTH digits, zero filled if ZERO */
+static void fr_num(struct fr_out *o, long long v, int base, int width, bool zero)
+{
+    char tmp[32];
+    int i = sizeof(tmp) - 1;
+    bool neg = v < 0;
+    unsigned long long u = neg ? -(unsigned long long)v : (unsigned long long)v;
+
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = "0123456789abcdef"[u % base];
+        u /= base;
+    } while (u != 0);
+    if (neg)
+        tmp[--i] = '-';
+    while (i > 0 && (int)sizeof(tmp) - 1 - i < width)
+        tmp[--i] = zero ? '0' : ' ';
+    fr_str(o, tmp + i);
+}
+
+
+static void fr_modem_names(struct fr_out *o, long lines)
+{
+    static const struct { int bit; const char *name; } names[] = {
+        {TIOCM_DTR, " DTR"}, {TIOCM_RTS, " RTS"}, {TIOCM_CTS, " CTS"},
+        {TIOCM_DSR, " DSR"}, {TIOCM_CD, " CD"}, {TIOCM_RI, " RI"},
+    };
+    unsigned int i;
+
+    /* -2 is before the first look, -1 a port without modem lines */
+    if (lines < 0) {
+        fr_str(o, lines == -2 ? " -" : " ?");
+        return;
+    }
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (lines & names[i].bit)
+            fr_str(o, names[i].name);
+}
+
+
+static void fr_line(struct fr_out *o, const struct fr_event *e)
+{
+    static const char *types[] = {
+        "read", "write", "state", "termios", "modem", "error", "note",
+    };
+
+    fr_num(o, e->time / 1000000, 10, 6, false);
+    fr_str(o, ".");
+    fr_num(o, e->time % 1000000, 10, 6, true);
+    fr_str(o, " ");
+    fr_str(o, types[e->type]);
+    fr_str(o, " ");
+    fr_str(o, e->what ? e->what : "-");
+
+    switch (e->type) {
+    case FR_READ:
+    case FR_WRITE:
+        fr_str(o, " offset ");
+        fr_num(o, e->a, 10, 0, false);
+        fr_str(o, " len ");
+        fr_num(o, e->b, 10, 0, false);
+        break;
+    case FR_STATE:
+        fr_str(o, " ");
+        fr_num(o, e->a, 10, 0, false);
+        fr_str(o, " -> ");
+        fr_num(o, e->b, 10, 0, false);
+        break;
+    case FR_TERMIOS:
+        fr_str(o, " speed ");
+        fr_num(o, e->a, 10, 0, false);
+        fr_str(o, " cflag 0");
+        fr_num(o, e->b, 8, 0, false);
+        break;
+    case FR_MODEM:
+        fr_modem_names(o, e->a);
+        fr_str(o, " ->");
+        fr_modem_names(o, e->b);
+        break;
+    case FR_ERROR:
+        fr_str(o, " offset ");
+        fr_num(o, e->a, 10, 0, false);
+        fr_str(o, " errno ");
+        fr_num(o, e->b, 10, 0, false);
+        break;
+    default:
+        fr_str(o, " ");
+        fr_num(o, e->a, 10, 0, false);
+        fr_str(o, " ");
+        fr_num(o, e->b, 10, 0, false);
+    }
+    fr_str(o, "\n");
+}
+
+
+/* Write the ring to the dump file, oldest event first */
+static void fr_dump(const char *why)
+{
+    int saved_errno = errno;
+    unsigned long head = atomic_load_explicit(&fr.head, memory_order_acquire);
+    unsigned long n = head > FR_EVENTS ? head - FR_EVENTS : 0;
+    struct fr_out o;
+
+    if (fr.file[0] == '\0')
+        return;
+    if ((o.fd = open(fr.file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        errno = saved_errno;
+        return;
+    }
+    o.len = 0;
+
+    fr_str(&o, "# ");
+    fr_str(&o, fr.program);
+    fr_str(&o, " pid ");
+    fr_num(&o, getpid(), 10, 0, false);
+    fr_str(&o, ", started at ");
+    fr_num(&o, fr.start_wall, 10, 0, false);
+    fr_str(&o, ", dumped on ");
+    fr_str(&o, why);
+    fr_str(&o, " after ");
+    fr_num(&o, head, 10, 0, false);
+    fr_str(&o, " events\n");
+
+    for (; n < head; n++) {
+        struct fr_event *e = &fr.ring[n & (FR_EVENTS - 1)];
+        struct fr_event copy;
+
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != n + 1)
+            continue;
+        copy.time = e->time;
+        copy.type = e->type;
+        copy.what = e->what;
+        copy.a = e->a;
+        copy.b = e->b;
+        atomic_thread_fence(memory_order_acquire);
+
+        /* Overwritten while copied */
+        if (atomic_load_explicit(&e->seq, memory_order_relaxed) != n + 1)
+            continue;
+        fr_line(&o, &copy);
+    }
+    fr_flush(&o);
+    close(o.fd);
+    errno = saved_errno;
+}
+
+
+/* Record an error and dump, the caller reports it and goes on as before */
+static inline void fr_error(const char *what, long offset, int err)
+{
+    fr_record(FR_ERROR, what, offset, err);
+    fr_dump("error");
+}
+
+
+/* The settings the port really got */
+static inline void fr_termios(int fd, const char *what)
+{
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) == 0)
+        fr_record(FR_TERMIOS, what, cfgetospeed(&tty), tty.c_cflag);
+}
+
+
+/* Record the modem lines when they have changed, cheap enough for every read */
+static inline void fr_modem(int fd)
+{
+    int lines;
+
+    if (ioctl(fd, TIOCMGET, &lines) < 0)
+        lines = -1;
+    if (lines != fr.modem) {
+        fr_record(FR_MODEM, "lines", fr.modem, lines);
+        fr.modem = lines;
+    }
+}
+
+
+static void fr_on_usr1(int sig)
+{
+    fr_record(FR_NOTE, "SIGUSR1", sig, 0);
+    fr_dump("SIGUSR1");
+}
+
+
+/* Dump and die the way the signal would have done */
+static void fr_on_fatal(int sig)
+{
+    fr_record(FR_NOTE, "signal", sig, 0);
+    fr_dump("signal");
+    raise(sig);
+}
+
+
+static void fr_on_exit(void)
+{
+    fr_dump("exit");
+}
+
+
+static inline void fr_init(const char *program)
+{
+    static const int fatal[] = { SIGINT, SIGTERM, SIGHUP, SIGSEGV, SIGBUS, SIGABRT };
+    const char *env = getenv("PDP8_FLIGHTREC");
+    struct sigaction sa;
+    unsigned int i;
+
+    fr.program = program;
+    fr.start = fr_now();
+    fr.start_wall = time(NULL);
+    fr.modem = -2;
+    if (env != NULL)
+        snprintf(fr.file, sizeof(fr.file), "%s", env);
+    else
+        snprintf(fr.file, sizeof(fr.file), "%s.flightrec", program);
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = fr_on_usr1;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    /* Signals the program handles itself are left alone */
+    sa.sa_handler = fr_on_fatal;
+    sa.sa_flags = SA_RESETHAND;
+    for (i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++) {
+        struct sigaction old;
+
+        if (sigaction(fatal[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+            sigaction(fatal[i], &sa, NULL);
+    }
+
+    atexit(fr_on_exit);
+    fr_record(FR_NOTE, "start", getpid(), 0);
+}
+
+#endif
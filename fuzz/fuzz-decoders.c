@@ -0,0 +1,441 @@
+/*
+ * Differential fuzz harness for the papertape decoders
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * Every input is run through the reference decoders below, the state
+ * machines capture-papertape had before it used the ones in pipeline.h,
+ * and through every entry in candidates[]. The harness aborts as soon as
+ * a candidate gives other output bytes, another checksum verdict or ends
+ * in another state than the reference, so the fuzzer saves the input as a
+ * crash.
+ *
+ * A faster decoder is checked by adding a run function for it to
+ * candidates[]. The decoders in pipeline.h are there, on their own and
+ * through capture_byte() in capture-papertape.
+ *
+ *     make fuzz-libfuzzer fuzz/corpus
+ *     ./fuzz/fuzz-decoders-libfuzzer fuzz/corpus
+ *
+ *     make fuzz fuzz/corpus
+ *     afl-fuzz -i fuzz/corpus -o fuzz/findings -- ./fuzz/fuzz-decoders
+ *
+ * Without libFuzzer the harness reads the files given as arguments, or
+ * stdin, which is what AFL and replaying a crash need.
+ */
+
+#define _GNU_SOURCE
+
+/* capture-papertape, main() renamed out of the way */
+#define main capture_papertape_main
+#include "../capture-pdp8-papertapes.c"
+#undef main
+
+#include "../pipeline.h"
+
+#include <stdint.h>
+
+
+/* What one decoder made of one input */
+struct result {
+    unsigned char *data;
+    size_t len;
+    int checksum_ok;
+    int checksum_fail;
+    bool done;
+};
+
+
+/* format is TF_RAW, TF_RIM or TF_BIN, strip_char is only used for TF_RAW */
+struct candidate {
+    const char *name;
+    void (*run)(struct result *r, int format, int strip_char, const uint8_t *data, size_t size);
+};
+
+
+/* The reference, kept as it was written and not changed */
+enum ref_state {
+    RS_START = 0,
+    RS_LEAD_IN,
+    RS_DATA_H,
+    RS_DATA_L,
+    RS_TRAIL,
+    RS_DONE
+};
+
+#define CC_LEAD         0x80
+#define CC_TRAIL        0x80
+#define CC_ORIGIN       0x40
+#define CC_FIELD        0xC0
+#define CC_CONTROL_MASK 0xC0
+
+static int rimLeadinCount;
+static int binLeadinCount;
+static int binCsum;
+static int binC1;
+static int binC2;
+static int refChecksumOk;
+static int refChecksumFail;
+
+
+static void ref_raw(FILE *f, enum ref_state *state, unsigned char c, int strip_char)
+{
+    int i = 16;
+
+    switch (*state) {
+        case RS_START:
+            if (strip_char != c) {
+                if (strip_char != -1) {
+                    while(i--)
+                        fputc(strip_char, f);
+                } else {
+                    fputc(c, f);
+                }
+                *state = RS_LEAD_IN;
+            }
+            break;
+        case RS_LEAD_IN:
+        case RS_DATA_H:
+        case RS_DATA_L:
+        case RS_TRAIL:
+        case RS_DONE:
+            fputc(c, f);
+            break;
+    }
+}
+
+
+static void ref_rim(FILE *f, enum ref_state *state, unsigned char c)
+{
+    switch (*state) {
+        case RS_START:
+            if (c == CC_LEAD)
+                rimLeadinCount++;
+            *state = RS_LEAD_IN;
+            break;
+
+        case RS_LEAD_IN:
+            if (c == CC_LEAD) {
+                rimLeadinCount++;
+            } else if (((c & CC_CONTROL_MASK) == CC_ORIGIN && rimLeadinCount > 7)){
+                while (rimLeadinCount--) {
+                    fputc(CC_LEAD, f);
+                }
+                fputc(c, f);
+                *state = RS_DATA_H;
+            } else {
+                rimLeadinCount = 0;
+            }
+            break;
+
+        case RS_DATA_H:
+            if (c == 0x80) {
+                *state = RS_TRAIL;
+            }
+            fputc(c, f);
+            break;
+
+        case RS_TRAIL:
+            if (c != CC_TRAIL) {
+                *state = RS_DONE;
+            } else {
+                fputc(c, f);
+            }
+            break;
+
+        case RS_DONE:
+        case RS_DATA_L:
+            break;
+    }
+}
+
+
+static void ref_bin(FILE *f, enum ref_state *state, unsigned char c)
+{
+    switch (*state) {
+        case RS_START:
+            if (c == CC_LEAD)
+                binLeadinCount++;
+            *state = RS_LEAD_IN;
+            break;
+
+        case RS_LEAD_IN:
+            if (c == CC_LEAD) {
+                binLeadinCount++;
+            } else if (((c & CC_CONTROL_MASK) == CC_ORIGIN && binLeadinCount > 7) ||
+                                 ((c & CC_CONTROL_MASK) == CC_FIELD && binLeadinCount > 7))
+            {
+                while (binLeadinCount--) {
+                    fputc(CC_LEAD, f);
+                }
+
+                /* CC_FIELD is NOT used for checksum */
+                if ((c & CC_CONTROL_MASK) == CC_ORIGIN) {
+                    binCsum += c;
+                }
+
+                fputc(c, f);
+                *state = RS_DATA_L;
+            } else {
+                binLeadinCount = 0;
+            }
+            break;
+
+        case RS_DATA_L:
+            fputc(c, f);
+
+            /* CC_TRAIL or CC_FIELD is not used in checksum calculation */
+            if ( !(c & 0x80)) {
+                binCsum += c;
+                binC2 = binC1;
+                binC1 = c;
+            }
+
+            if (c == 0x80) {
+                int checksum = (binC2 & 0x3f) << 6 | (binC1 & 0x3f);
+                binCsum = (binCsum - binC1 - binC2) & 0xfff;
+
+                /* Verify C-SUM */
+                if (binCsum  == checksum)
+                    refChecksumOk++;
+                else
+                    refChecksumFail++;
+                *state = RS_TRAIL;
+            }
+            break;
+
+        case RS_TRAIL:
+            if (c != CC_TRAIL) {
+                *state = RS_DONE;
+            } else {
+                fputc(c, f);
+            }
+            break;
+
+        case RS_DONE:
+        case RS_DATA_H:
+            break;
+    }
+}
+
+
+static void reference_run(struct result *r, int format, int strip_char, const uint8_t *data, size_t size)
+{
+    enum ref_state state = RS_START;
+    FILE *f;
+    size_t i;
+
+    rimLeadinCount = 0;
+    binLeadinCount = 0;
+    binCsum = 0;
+    binC1 = 0;
+    binC2 = 0;
+    refChecksumOk = 0;
+    refChecksumFail = 0;
+
+    if ((f = open_memstream((char **)&r->data, &r->len)) == NULL) {
+        fprintf(stderr, "Error from open_memstream: %s\n", strerror(errno));
+        abort();
+    }
+
+    for (i = 0; i < size; i++) {
+        if (format == TF_BIN) ref_bin(f, &state, data[i]);
+        if (format == TF_RIM) ref_rim(f, &state, data[i]);
+        if (format == TF_RAW) ref_raw(f, &state, data[i], strip_char);
+    }
+    fclose(f);
+
+    r->checksum_ok = refChecksumOk;
+    r->checksum_fail = refChecksumFail;
+    r->done = state == RS_DONE;
+}
+
+
+/* capture-papertape as it runs, through its output buffer and checksum report */
+static void capture_run(struct result *r, int format, int strip_char, const uint8_t *data, size_t size)
+{
+    struct argp_arguments args = { .format = format, .leadin_strip = strip_char };
+    FILE *f;
+    size_t i;
+
+    metric_set(&m_checksum_ok, 0);
+    metric_set(&m_checksum_fail, 0);
+
+    if ((f = open_memstream((char **)&r->data, &r->len)) == NULL) {
+        fprintf(stderr, "Error from open_memstream: %s\n", strerror(errno));
+        abort();
+    }
+
+    capture_reset(f, strip_char);
+    for (i = 0; i < size; i++)
+        capture_byte(data[i], &args);
+    capture_flush(&capture_out);
+    fclose(f);
+
+    r->checksum_ok = atomic_load(&m_checksum_ok.value);
+    r->checksum_fail = atomic_load(&m_checksum_fail.value);
+    r->done = decoder.state == TS_DONE;
+}
+
+
+/* Grow the output buffer instead of handing it on */
+static void pipeline_grow(struct pl_out *out)
+{
+    out->size *= 2;
+    if ((out->data = realloc(out->data, out->size)) == NULL)
+        abort();
+}
+
+
+static void pipeline_run(struct result *r, int format, int strip_char, const uint8_t *data, size_t size)
+{
+    struct pl_out out = { .size = 256, .flush = pipeline_grow };
+    struct tape_decoder d;
+    size_t i;
+
+    if ((out.data = malloc(out.size)) == NULL)
+        abort();
+    tape_decoder_init(&d, strip_char);
+
+    for (i = 0; i < size; i++) {
+        if (format == TF_BIN) tape_bin(&d, &out, data[i]);
+        if (format == TF_RIM) tape_rim(&d, &out, data[i]);
+        if (format == TF_RAW) tape_raw(&d, &out, data[i]);
+    }
+
+    r->data = out.data;
+    r->len = out.len;
+    r->checksum_ok = d.verdict == 1;
+    r->checksum_fail = d.verdict == -1;
+    r->done = d.state == TS_DONE;
+}
+
+
+static struct candidate candidates[] = {
+    { "pipeline.h", pipeline_run },
+    { "capture-papertape", capture_run },
+};
+
+
+static void compare(const char *name, const char *mode, struct result *ref, struct result *r)
+{
+    size_t i;
+
+    if (ref->len != r->len || memcmp(ref->data, r->data, ref->len)) {
+        for (i = 0; i < ref->len && i < r->len && ref->data[i] == r->data[i]; i++)
+            ;
+        fprintf(stderr, "%s %s: output differs at byte %zu, length %zu <-> %zu\n",
+                name, mode, i, ref->len, r->len);
+        abort();
+    }
+
+    if (ref->checksum_ok != r->checksum_ok || ref->checksum_fail != r->checksum_fail) {
+        fprintf(stderr, "%s %s: checksum ok/fail %d/%d <-> %d/%d\n", name, mode,
+                ref->checksum_ok, ref->checksum_fail, r->checksum_ok, r->checksum_fail);
+        abort();
+    }
+
+    if (ref->done != r->done) {
+        fprintf(stderr, "%s %s: done %d <-> %d\n", name, mode, ref->done, r->done);
+        abort();
+    }
+}
+
+
+static void check(const char *mode, int format, int strip_char, const uint8_t *data, size_t size)
+{
+    struct result ref = { 0 };
+    size_t i;
+
+    reference_run(&ref, format, strip_char, data, size);
+
+    for (i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        struct result r = { 0 };
+
+        candidates[i].run(&r, format, strip_char, data, size);
+        compare(candidates[i].name, mode, &ref, &r);
+        free(r.data);
+    }
+    free(ref.data);
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static bool init = false;
+
+    /* capture_byte() prints the checksum result on stdout */
+    if (!init) {
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            abort();
+        init = true;
+    }
+
+    check("raw", TF_RAW, -1, data, size);
+    check("raw strip 0x80", TF_RAW, 0x80, data, size);
+    if (size > 0)
+        check("raw strip first", TF_RAW, data[0], data + 1, size - 1);
+    check("rim", TF_RIM, 0, data, size);
+    check("bin", TF_BIN, 0, data, size);
+    return 0;
+}
+
+
+#ifndef LIBFUZZER
+static int run_file(FILE *f, const char *name)
+{
+    unsigned char *data = NULL;
+    size_t len = 0, size = 0, n;
+
+    for (;;) {
+        if (len == size) {
+            size = size ? size * 2 : 65536;
+            if ((data = realloc(data, size)) == NULL) {
+                fprintf(stderr, "Out of memory reading %s\n", name);
+                return -1;
+            }
+        }
+        n = fread(data + len, 1, size - len, f);
+        if (n == 0)
+            break;
+        len += n;
+    }
+
+    if (ferror(f)) {
+        fprintf(stderr, "Error reading %s: %s\n", name, strerror(errno));
+        free(data);
+        return -1;
+    }
+
+    LLVMFuzzerTestOneInput(data, len);
+    free(data);
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2)
+        return run_file(stdin, "stdin") < 0 ? 1 : 0;
+
+    for (i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+
+        if (f == NULL) {
+            fprintf(stderr, "Could not open file \"%s\": %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+        if (run_file(f, argv[i]) < 0) {
+            fclose(f);
+            return 1;
+        }
+        fclose(f);
+        fprintf(stderr, "%s: ok\n", argv[i]);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,480 @@
+/*
+ * Program for generating synthetic PDP-8 papertapes
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+const char *argp_program_version =
+    "gen-tapes 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for generating synthetic PDP-8 papertapes in bin, rim or ascii format, for benchmarks and " \
+    "stress tests. Tapes are written back to back until the requested size is reached. The output only " \
+    "depends on the options and the seed.";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"format",          'F', "bin/rim/ascii",   0, "Papertape format, default bin"},
+    {"size",            'n', "BYTES[k,M,G]",    0, "Total output size, default one tape"},
+    {"length",          'l', "WORDS",           0, "Words per tape (characters for ascii), default 4096"},
+    {"origin",          'o', "OCTAL",           0, "First load address, default 0200"},
+    {"random-origin",   'r', 0,                 0, "Use a random origin for every block"},
+    {"block",           'B', "WORDS",           0, "Words per contiguous block, default 128"},
+    {"fields",          'x', "LIST",            0, "Comma separated fields cycled per block (bin only), default 0"},
+    {"leader",          'L', "NUMBER",          0, "Leader and trailer length, default 16"},
+    {"flip",            'e', "RATE",            0, "Probability of a flipped bit per frame"},
+    {"drop",            'D', "RATE",            0, "Probability of a dropped frame"},
+    {"seed",            'z', "NUMBER",          0, "Random seed, default 1"},
+    {"filename",        'f', "FILE",            0, "Output file, default stdout"},
+    { 0 }
+};
+
+
+enum tape_format {
+    TF_BIN,
+    TF_RIM,
+    TF_ASCII,
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *file;
+    enum tape_format format;
+    unsigned long long size;
+    int length;
+    int origin;
+    bool random_origin;
+    int block;
+    int fields[8];
+    int num_fields;
+    int leader;
+    double flip;
+    double drop;
+    unsigned long long seed;
+};
+
+
+unsigned long long parse_size(char *arg)
+{
+    char *end;
+    unsigned long long size = strtoull(arg, &end, 0);
+
+    switch (*end) {
+    case 'k':
+    case 'K':
+        size <<= 10;
+        break;
+    case 'M':
+        size <<= 20;
+        break;
+    case 'G':
+        size <<= 30;
+        break;
+    }
+    return size;
+}
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+    char *p;
+
+    switch (key){
+    case 'F':
+        if (0 == strcmp(arg, "bin")) {
+            arguments->format = TF_BIN;
+        } else if (0 == strcmp(arg, "rim")) {
+            arguments->format = TF_RIM;
+        } else if (0 == strcmp(arg, "ascii")) {
+            arguments->format = TF_ASCII;
+        } else {
+            fprintf(stderr, "Invalid format: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'n':
+        arguments->size = parse_size(arg);
+        break;
+    case 'l':
+        arguments->length = atoi(arg);
+        if (arguments->length < 1) {
+            fprintf(stderr, "Invalid tape length: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'o':
+        arguments->origin = strtol(arg, NULL, 8);
+        if (arguments->origin < 0 || arguments->origin > 07777) {
+            fprintf(stderr, "Invalid origin, must be 0000 - 7777: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'r':
+        arguments->random_origin = true;
+        break;
+    case 'B':
+        arguments->block = atoi(arg);
+        if (arguments->block < 1 || arguments->block > 4096) {
+            fprintf(stderr, "Invalid block size, must be 1 - 4096: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'x':
+        arguments->num_fields = 0;
+        for (p = strtok(arg, ","); p != NULL; p = strtok(NULL, ",")) {
+            if (arguments->num_fields == 8 || p[0] < '0' || p[0] > '7' || p[1] != '\0') {
+                fprintf(stderr, "Invalid field list: %s\n", arg);
+                argp_usage (state);
+                return ARGP_ERR_UNKNOWN;
+            }
+            arguments->fields[arguments->num_fields++] = p[0] - '0';
+        }
+        break;
+    case 'L':
+        arguments->leader = atoi(arg);
+        if (arguments->leader < 0) {
+            fprintf(stderr, "Invalid leader length: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'e':
+        arguments->flip = atof(arg);
+        if (!(arguments->flip >= 0 && arguments->flip <= 1)) {
+            fprintf(stderr, "Invalid flip rate, must be 0 - 1: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'D':
+        arguments->drop = atof(arg);
+        if (!(arguments->drop >= 0 && arguments->drop < 1)) {
+            fprintf(stderr, "Invalid drop rate, must be at least 0 and below 1: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'z':
+        arguments->seed = strtoull(arg, NULL, 0);
+        break;
+    case 'f':
+        arguments->file = arg;
+        break;
+
+    case ARGP_KEY_ARG:
+        argp_usage (state);
+        return ARGP_ERR_UNKNOWN;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, NULL, doc };
+
+
+/* Define control codes and bit masks */
+#define CC_LEAD         0x80
+#define CC_TRAIL        0x80
+#define CC_ORIGIN       0x40
+#define CC_FIELD        0xC0
+#define CC_DATA_MASK    0x3F
+
+#define OUT_BUFF_SIZE   (1 << 20)
+
+
+/*
+ * xorshift64*, small and fast enough to not show up next to the writes.
+ * Errors use a stream of their own, so a tape with errors is a corrupted
+ * copy of the clean tape from the same seed.
+ */
+static unsigned long long rnd_state;
+static unsigned long long err_state;
+
+static inline uint32_t xorshift(unsigned long long *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (*state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+
+static inline uint32_t rnd(void)
+{
+    return xorshift(&rnd_state);
+}
+
+
+/*
+ * All frames pass through put_frame() where the error profile is applied.
+ * The distance to the next flipped or dropped frame is drawn from a
+ * geometric distribution, so a frame only costs a counter decrement.
+ */
+struct output {
+    FILE *f;
+    unsigned char buff[OUT_BUFF_SIZE];
+    size_t n;
+    unsigned long long total;
+    double flip;
+    double drop;
+    unsigned long long next_flip;
+    unsigned long long next_drop;
+};
+
+
+unsigned long long error_gap(double rate)
+{
+    double u;
+
+    if (rate <= 0.0)
+        return ~0ULL;
+    if (rate >= 1.0)
+        return 0;
+
+    u = (xorshift(&err_state) + 1.0) / 4294967297.0;
+    return log(u) / log(1.0 - rate);
+}
+
+
+void flush_output(struct output *out)
+{
+    if (out->n && fwrite(out->buff, 1, out->n, out->f) != out->n) {
+        fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+        exit(-1);
+    }
+    out->n = 0;
+}
+
+
+static inline void put_frame(struct output *out, unsigned char c)
+{
+    if (out->next_drop-- == 0) {
+        out->next_drop = error_gap(out->drop);
+        return;
+    }
+    if (out->next_flip-- == 0) {
+        out->next_flip = error_gap(out->flip);
+        c ^= 1 << (xorshift(&err_state) & 7);
+    }
+
+    out->buff[out->n++] = c;
+    out->total++;
+    if (out->n == OUT_BUFF_SIZE)
+        flush_output(out);
+}
+
+
+void put_leader(struct output *out, int len)
+{
+    while (len--)
+        put_frame(out, CC_LEAD);
+}
+
+
+int next_origin(struct argp_arguments *args, int origin, int block)
+{
+    if (args->random_origin)
+        return rnd() & 07777;
+    return (origin + block) & 07777;
+}
+
+
+void gen_bin(struct output *out, struct argp_arguments *args, int tape)
+{
+    int origin = args->origin;
+    int field = -1;
+    int csum = 0;
+    int i, n;
+
+    put_leader(out, args->leader);
+
+    for (i = 0, n = 0; i < args->length; n++) {
+        int f = args->fields[(tape + n) % args->num_fields];
+        int words = args->length - i < args->block ? args->length - i : args->block;
+
+        /* CC_FIELD is NOT used for checksum */
+        if (f != field) {
+            put_frame(out, CC_FIELD | f << 3);
+            field = f;
+        }
+
+        put_frame(out, CC_ORIGIN | origin >> 6);
+        put_frame(out, origin & CC_DATA_MASK);
+        csum += (CC_ORIGIN | origin >> 6) + (origin & CC_DATA_MASK);
+
+        for (i += words; words--; ) {
+            int data = rnd() & 07777;
+
+            put_frame(out, data >> 6);
+            put_frame(out, data & CC_DATA_MASK);
+            csum += (data >> 6) + (data & CC_DATA_MASK);
+        }
+        origin = next_origin(args, origin, args->block);
+    }
+
+    csum &= 07777;
+    put_frame(out, csum >> 6);
+    put_frame(out, csum & CC_DATA_MASK);
+
+    put_leader(out, args->leader);
+}
+
+
+void gen_rim(struct output *out, struct argp_arguments *args)
+{
+    int origin = args->origin;
+    int addr = origin;
+    int i;
+
+    put_leader(out, args->leader);
+
+    for (i = 0; i < args->length; i++) {
+        int data = rnd() & 07777;
+
+        if (i && i % args->block == 0)
+            addr = origin = next_origin(args, origin, args->block);
+
+        put_frame(out, CC_ORIGIN | addr >> 6);
+        put_frame(out, addr & CC_DATA_MASK);
+        put_frame(out, data >> 6);
+        put_frame(out, data & CC_DATA_MASK);
+        addr = (addr + 1) & 07777;
+    }
+
+    put_leader(out, args->leader);
+}
+
+
+void gen_ascii(struct output *out, struct argp_arguments *args)
+{
+    static const char *words[] = {
+        "C", "TAD", "DCA", "JMP", "JMS", "ISZ", "AND", "CLA", "CLL", "HLT",
+        "TYPE", "ASK", "SET", "FOR", "IF", "GOTO", "DO", "RETURN", "COMMENT",
+        "LET", "PRINT", "INPUT", "NEXT", "END", "X", "Y", "I", "J", "0", "1", "10", "100",
+    };
+    int col = 0;
+    int i = 0;
+
+    put_leader(out, args->leader);
+
+    while (i < args->length) {
+        const char *w = words[rnd() % (sizeof(words) / sizeof(words[0]))];
+        int len = strlen(w);
+
+        if (col + len > 64 || i + len + 2 > args->length) {
+            put_frame(out, '\r' | 0x80);
+            put_frame(out, '\n' | 0x80);
+            i += 2;
+            col = 0;
+            if (i + len + 2 > args->length)
+                break;
+        }
+
+        while (*w) {
+            put_frame(out, *w++ | 0x80);
+            i++;
+        }
+        put_frame(out, ' ' | 0x80);
+        i++;
+        col += len + 1;
+    }
+
+    put_leader(out, args->leader);
+}
+
+
+int main(int argc, char **argv)
+{
+    static struct output out;
+    struct argp_arguments args;
+    int tape = 0;
+
+    args.file = NULL;
+    args.format = TF_BIN;
+    args.size = 0;
+    args.length = 4096;
+    args.origin = 0200;
+    args.random_origin = false;
+    args.block = 128;
+    args.fields[0] = 0;
+    args.num_fields = 1;
+    args.leader = 16;
+    args.flip = 0.0;
+    args.drop = 0.0;
+    args.seed = 1;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (args.file != NULL) {
+        if ((out.f = fopen(args.file, "w")) == NULL) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", args.file, strerror(errno));
+            return -1;
+        }
+    } else {
+        out.f = stdout;
+    }
+
+    /* Zero is a fixed point of xorshift */
+    rnd_state = args.seed ? args.seed : 0x9E3779B97F4A7C15ULL;
+    err_state = rnd_state ^ 0xD1B54A32D192ED03ULL;
+    out.flip = args.flip;
+    out.drop = args.drop;
+    out.next_flip = error_gap(out.flip);
+    out.next_drop = error_gap(out.drop);
+
+    do {
+        switch (args.format) {
+        case TF_BIN:
+            gen_bin(&out, &args, tape);
+            break;
+        case TF_RIM:
+            gen_rim(&out, &args);
+            break;
+        case TF_ASCII:
+            gen_ascii(&out, &args);
+            break;
+        }
+        tape++;
+    } while (out.total < args.size);
+
+    flush_output(&out);
+    if (out.f != stdout)
+        fclose(out.f);
+    return 0;
+}
@@ -0,0 +1,644 @@
+/*
+ * Program for dumping PDP-8 memory to a core image over the console port
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bintape.h"
+
+
+const char *argp_program_version =
+    "get-core 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for dumping the memory of a PDP-8 to a core image, using a small dumper program that " \
+    "is loaded over the console port.\v" \
+    "The dumper is sent as a BIN (or RIM) tape to the loader waiting on the PDP-8, then it has to " \
+    "be started at its origin, 07400 in field 0 by default. It is position independent within " \
+    "a page, --origin moves it to any page of any field. The host then asks for one page of 128 " \
+    "words at a time and gets it packed as 3 bytes for every 2 words, with an echo of the " \
+    "request and two 12-bit Fletcher sums. A page with a bad checksum, a wrong echo or that doesn't " \
+    "arrive in time is asked for again. The page of the dumper is dumped as the dumper itself.\n\n" \
+    "The core image has one 12-bit word in two bytes, little endian, 4096 words for each field " \
+    "from field 0. Default is 9600 8N1 on device /dev/ttyUSB0.";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"device",          'd', "DEV",         0,  "Serial device, /dev/ttyXXX"},
+    {"speed",           's', "BAUD",        0,  "Serial com speed, default 9600"},
+    {"transmit-delay",  't', "NUMBER",      0,  "Character transmit delay for the tape 0-1000ms"},
+    {"output",          'o', "FILE",        0,  "Core image, default core.img"},
+    {"fields",          'f', "NUMBER",      0,  "Number of fields to dump from field 0, default 1"},
+    {"origin",          'O', "FADDR",       0,  "Field and page of the dumper in octal, default 07400"},
+    {"format",          'F', "bin/rim",     0,  "Format of the dumper tape, default bin"},
+    {"retries",         'r', "NUMBER",      0,  "Tries for each page before giving up, default 8"},
+    {"no-load",         'n', 0,             0,  "The dumper is already running, don't send it"},
+    {"tape",            'T', "FILE",        0,  "Only write the dumper tape to FILE, for put-tape"},
+    { 0 }
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *device;
+    int baud;
+    int transmit_delay;
+    char *output;
+    int fields;
+    int origin;
+    bool rim;
+    int retries;
+    bool no_load;
+    char *tape;
+};
+
+
+speed_t map_baudrate(int baud){
+    speed_t speed;
+
+    switch (baud) {
+    case 110:
+        speed = B110;
+        break;
+    case 150:
+        speed = B150;
+        break;
+    case 300:
+        speed = B300;
+        break;
+    case 600:
+        speed = B600;
+        break;
+    case 1200:
+        speed = B1200;
+        break;
+    case 2400:
+        speed = B2400;
+        break;
+    case 4800:
+        speed = B4800;
+        break;
+    case 9600:
+        speed = B9600;
+        break;
+    case 19200:
+        speed = B19200;
+        break;
+    case 38400:
+        speed = B38400;
+        break;
+    case 57600:
+        speed = B57600;
+        break;
+    case 115200:
+        speed = B115200;
+        break;
+    default:
+        speed = -1;
+    }
+    return speed;
+}
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+    char *end;
+
+    switch (key){
+    case 'd':
+        arguments->device = arg;
+        break;
+    case 's':
+        arguments->baud = atoi(arg);
+        if (map_baudrate(arguments->baud) == (speed_t)-1) {
+            fprintf(stderr, "Invalid speed: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 't':
+        arguments->transmit_delay = atoi(arg);
+        if (arguments->transmit_delay < 0 || arguments->transmit_delay > 1000) {
+            fprintf(stderr, "Invalid transmit delay: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'o':
+        arguments->output = arg;
+        break;
+    case 'f':
+        arguments->fields = atoi(arg);
+        if (arguments->fields < 1 || arguments->fields > 8) {
+            fprintf(stderr, "Invalid number of fields: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'O':
+        arguments->origin = strtol(arg, &end, 8);
+        if (*end != '\0' || arguments->origin < 0 || arguments->origin > 077777 ||
+            (arguments->origin & 0177) != 0) {
+            fprintf(stderr, "Invalid origin, must be the start of a page: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'F':
+        if (0 == strcmp(arg, "bin")) {
+            arguments->rim = false;
+        } else if (0 == strcmp(arg, "rim")) {
+            arguments->rim = true;
+        } else {
+            fprintf(stderr, "Invalid format: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'r':
+        arguments->retries = atoi(arg);
+        if (arguments->retries < 1) {
+            fprintf(stderr, "Invalid number of retries: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'n':
+        arguments->no_load = true;
+        break;
+    case 'T':
+        arguments->tape = arg;
+        break;
+
+    case ARGP_KEY_ARG:
+        argp_usage (state);
+        return ARGP_ERR_UNKNOWN;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, 0, doc };
+
+
+/*
+ * The dumper, one page. Only current page addressing is used, so it runs
+ * at the start of any page. It waits for a request of two chars, 0100+field
+ * and the page 0-37, and answers with the two chars echoed and the 128
+ * words as 3 chars for each 2. Last come two 12-bit Fletcher sums, the sum
+ * of the words and the sum of those sums, packed as a pair, so two errors
+ * in the same bit of different words don't cancel. Chars without the 0100
+ * bit are skipped while waiting for the field, so the host gets back in
+ * step with a retry. The variables after KM100 are not on the tape.
+ */
+static const int dumper[] = {
+    06032,  /* 000 START, KCC             / clear anything from the loader */
+    04316,  /* 001 LOOP,  JMS GETC */
+    03341,  /* 002        DCA FLD */
+    01341,  /* 003        TAD FLD */
+    00335,  /* 004        AND K100 */
+    07650,  /* 005        SNA CLA         / a field request? */
+    05201,  /* 006        JMP LOOP */
+    04316,  /* 007        JMS GETC */
+    00334,  /* 010        AND K37 */
+    03342,  /* 011        DCA PG */
+    01341,  /* 012        TAD FLD         / echo the request */
+    04323,  /* 013        JMS PUTC */
+    01342,  /* 014        TAD PG */
+    04323,  /* 015        JMS PUTC */
+    01341,  /* 016        TAD FLD         / CDF to the field */
+    00332,  /* 017        AND K7 */
+    07106,  /* 020        CLL RTL */
+    07004,  /* 021        RAL */
+    01337,  /* 022        TAD KCDF */
+    03235,  /* 023        DCA CDFI */
+    01342,  /* 024        TAD PG          / page number to address */
+    07112,  /* 025        CLL RTR */
+    07012,  /* 026        RTR */
+    07012,  /* 027        RTR */
+    03343,  /* 030        DCA PTR */
+    03344,  /* 031        DCA S1 */
+    03345,  /* 032        DCA S2 */
+    01340,  /* 033        TAD KM100 */
+    03346,  /* 034        DCA CNT */
+    06201,  /* 035 CDFI,  CDF 0           / set above */
+    01743,  /* 036 PAIR,  TAD I PTR */
+    03347,  /* 037        DCA W1 */
+    02343,  /* 040        ISZ PTR */
+    07000,  /* 041        NOP             / PTR wraps after 7777 */
+    01743,  /* 042        TAD I PTR */
+    03350,  /* 043        DCA W2 */
+    02343,  /* 044        ISZ PTR */
+    07000,  /* 045        NOP */
+    01347,  /* 046        TAD W1          / Fletcher sums of the words */
+    04263,  /* 047        JMS SUM */
+    01350,  /* 050        TAD W2 */
+    04263,  /* 051        JMS SUM */
+    04272,  /* 052        JMS PACK */
+    02346,  /* 053        ISZ CNT */
+    05236,  /* 054        JMP PAIR */
+    01344,  /* 055        TAD S1          / the sums packed as a pair */
+    03347,  /* 056        DCA W1 */
+    01345,  /* 057        TAD S2 */
+    03350,  /* 060        DCA W2 */
+    04272,  /* 061        JMS PACK */
+    05201,  /* 062        JMP LOOP */
+    00000,  /* 063 SUM,   0               / AC to S1, S1 to S2 */
+    01344,  /* 064        TAD S1 */
+    03344,  /* 065        DCA S1 */
+    01344,  /* 066        TAD S1 */
+    01345,  /* 067        TAD S2 */
+    03345,  /* 070        DCA S2 */
+    05663,  /* 071        JMP I SUM */
+    00000,  /* 072 PACK,  0               / W1 and W2 in 3 chars */
+    01347,  /* 073        TAD W1 */
+    07112,  /* 074        CLL RTR */
+    07012,  /* 075        RTR */
+    04323,  /* 076        JMS PUTC */
+    01347,  /* 077        TAD W1 */
+    00333,  /* 100        AND K17 */
+    07106,  /* 101        CLL RTL */
+    07006,  /* 102        RTL */
+    03351,  /* 103        DCA TMP */
+    01350,  /* 104        TAD W2 */
+    07106,  /* 105        CLL RTL */
+    07006,  /* 106        RTL */
+    07004,  /* 107        RAL */
+    00333,  /* 110        AND K17 */
+    01351,  /* 111        TAD TMP */
+    04323,  /* 112        JMS PUTC */
+    01350,  /* 113        TAD W2 */
+    04323,  /* 114        JMS PUTC */
+    05672,  /* 115        JMP I PACK */
+    00000,  /* 116 GETC,  0 */
+    06031,  /* 117        KSF */
+    05317,  /* 120        JMP .-1 */
+    06036,  /* 121        KRB */
+    05716,  /* 122        JMP I GETC */
+    00000,  /* 123 PUTC,  0 */
+    00336,  /* 124        AND K377 */
+    06046,  /* 125        TLS */
+    06041,  /* 126        TSF */
+    05326,  /* 127        JMP .-1 */
+    07200,  /* 130        CLA */
+    05723,  /* 131        JMP I PUTC */
+    00007,  /* 132 K7 */
+    00017,  /* 133 K17 */
+    00037,  /* 134 K37 */
+    00100,  /* 135 K100 */
+    00377,  /* 136 K377 */
+    06201,  /* 137 KCDF,  CDF 0 */
+    07700,  /* 140 KM100, -100 */
+    /* 141 FLD, PG, PTR, S1, S2, CNT, W1, W2, TMP */
+};
+
+#define DUMPER_WORDS        (sizeof(dumper) / sizeof(dumper[0]))
+
+/* A page as the dumper sends it */
+#define PAGE_WORDS          0200
+#define PAGES               040
+#define PACKET_BYTES        (2 + (PAGE_WORDS + 2) / 2 * 3)
+
+
+/* 8N1, reads return at once with what has arrived, poll() does the waiting */
+int set_interface_attribs(int fd, speed_t speed)
+{
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) < 0) {
+        fprintf(stderr, "Error from tcgetattr: %s\n", strerror(errno));
+        return -1;
+    }
+
+    cfsetspeed(&tty, speed);
+    tty.c_cflag |= (CLOCAL | CREAD);    /* ignore modem controls */
+    tty.c_cflag &= ~CSIZE;
+    tty.c_cflag |= CS8;                 /* 8-bit characters */
+    tty.c_cflag &= ~PARENB;             /* no parity */
+    tty.c_cflag &= ~CSTOPB;             /* 1 stop bit */
+    tty.c_cflag &= ~CRTSCTS;            /* no hardware flowcontrol */
+
+    /* setup for non-canonical mode */
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_oflag &= ~OPOST;
+
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        fprintf(stderr, "Error from tcsetattr: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+
+/* The dumper as a tape, at ORIGIN (field and address) */
+static int write_dumper(FILE *f, int origin, bool rim)
+{
+    struct bintape tape;
+    int i;
+
+    bintape_begin(&tape, f, rim, 16);
+    for (i = 0; i < (int)DUMPER_WORDS; i++) {
+        int word = dumper[i];
+
+        if (bintape_word(&tape, origin >> 12, (origin + i) & 07777, word) < 0)
+            return -1;
+    }
+    bintape_end(&tape);
+    return 0;
+}
+
+
+static int send_dumper(int fd, int origin, bool rim, int transmit_delay)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    size_t i;
+    FILE *f;
+
+    if ((f = open_memstream(&buf, &size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    if (write_dumper(f, origin, rim) < 0) {
+        fclose(f);
+        free(buf);
+        return -1;
+    }
+    fclose(f);
+
+    fprintf(stderr, "Sending the dumper, %zu chars\n", size);
+    for (i = 0; i < size; ) {
+        size_t n = transmit_delay ? 1 : size - i;
+        ssize_t ret = write(fd, buf + i, n);
+
+        if (ret < 0) {
+            fprintf(stderr, "Write error: %s\n", strerror(errno));
+            free(buf);
+            return -1;
+        }
+        i += ret;
+        if (transmit_delay) {
+            tcdrain(fd);
+            usleep(1000 * transmit_delay);
+        }
+    }
+    tcdrain(fd);
+    free(buf);
+    return 0;
+}
+
+
+/* Throw away what arrives until the line has been quiet for QUIET ms */
+static void drain(int fd, int quiet)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    char buf[256];
+
+    while (poll(&pfd, 1, quiet) > 0 && read(fd, buf, sizeof(buf)) > 0)
+        ;
+    tcflush(fd, TCIFLUSH);
+}
+
+
+/* Read LEN chars, returns the number read before TIMEOUT ms */
+static int receive(int fd, unsigned char *buf, int len, int timeout)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    long long deadline = now_ms() + timeout;
+    int got = 0;
+
+    while (got < len) {
+        long long left = deadline - now_ms();
+        ssize_t n;
+
+        if (left <= 0 || poll(&pfd, 1, left) <= 0)
+            break;
+        n = read(fd, buf + got, len - got);
+        if (n < 0) {
+            fprintf(stderr, "Read error: %s\n", strerror(errno));
+            return -1;
+        }
+        got += n;
+    }
+    return got;
+}
+
+
+/*
+ * Ask for one page and unpack it into WORDS. Returns 0, 1 for a page to
+ * ask for again or -1 for an error on the port.
+ */
+static int get_page(int fd, int field, int page, int *words, int timeout)
+{
+    unsigned char req[2] = { 0100 | field, page };
+    unsigned char buf[PACKET_BYTES];
+    unsigned char *p = buf + 2;
+    int got, i, s1 = 0, s2 = 0;
+    int w[2];
+
+    if (write(fd, req, sizeof(req)) != sizeof(req)) {
+        fprintf(stderr, "Write error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if ((got = receive(fd, buf, PACKET_BYTES, timeout)) < 0)
+        return -1;
+    if (got < PACKET_BYTES) {
+        if (got > 0)
+            fprintf(stderr, "%o%04o: Only %d of %d chars\n", field, page * PAGE_WORDS, got, PACKET_BYTES);
+        return 1;
+    }
+    if (buf[0] != req[0] || buf[1] != req[1]) {
+        fprintf(stderr, "%o%04o: Answer for %03o %03o\n", field, page * PAGE_WORDS, buf[0], buf[1]);
+        return 1;
+    }
+
+    for (i = 0; i < PAGE_WORDS + 2; i += 2, p += 3) {
+        w[0] = p[0] << 4 | p[1] >> 4;
+        w[1] = (p[1] & 017) << 8 | p[2];
+        if (i == PAGE_WORDS)
+            break;
+        words[i] = w[0];
+        words[i + 1] = w[1];
+        s1 = (s1 + w[0]) & 07777;
+        s2 = (s2 + s1) & 07777;
+        s1 = (s1 + w[1]) & 07777;
+        s2 = (s2 + s1) & 07777;
+    }
+    if (s1 != w[0] || s2 != w[1]) {
+        fprintf(stderr, "%o%04o: Checksum %04o %04o, should be %04o %04o\n", field, page * PAGE_WORDS,
+                s1, s2, w[0], w[1]);
+        return 1;
+    }
+    return 0;
+}
+
+
+static int write_core(const char *file, const int *core, int words)
+{
+    FILE *f;
+    int i;
+
+    if ((f = fopen(file, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < words; i++) {
+        fputc(core[i] & 0377, f);
+        fputc(core[i] >> 8, f);
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    static int core[8 * 010000];
+    int field, page, timeout, fd;
+    int retries = 0;
+    bool started;
+    long long start;
+
+    args.device = "/dev/ttyUSB0";
+    args.baud = 9600;
+    args.transmit_delay = 0;
+    args.output = "core.img";
+    args.fields = 1;
+    args.origin = 07400;
+    args.rim = false;
+    args.retries = 8;
+    args.no_load = false;
+    args.tape = NULL;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (args.tape != NULL) {
+        FILE *f;
+
+        if ((f = fopen(args.tape, "w")) == NULL) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", args.tape, strerror(errno));
+            return -1;
+        }
+        if (write_dumper(f, args.origin, args.rim) < 0) {
+            fclose(f);
+            return -1;
+        }
+        if (fclose(f) != 0) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", args.tape, strerror(errno));
+            return -1;
+        }
+        fprintf(stderr, "Start the dumper at %05o\n", args.origin);
+        return 0;
+    }
+
+    fd = open(args.device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening device %s: %s\n", args.device, strerror(errno));
+        return -1;
+    }
+    if (set_interface_attribs(fd, map_baudrate(args.baud)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (!args.no_load && send_dumper(fd, args.origin, args.rim, args.transmit_delay) < 0) {
+        close(fd);
+        return -1;
+    }
+    drain(fd, 200);
+
+    /* Twice the time of a page on the line, and some for the PDP-8 to turn around */
+    timeout = 2 * PACKET_BYTES * 10 * 1000 / args.baud + 500;
+
+    /* Until the first page arrives the dumper may not be started yet, wait for it */
+    fprintf(stderr, "Start the dumper at %05o\n", args.origin);
+    started = false;
+    start = now_ms();
+
+    for (field = 0; field < args.fields; field++) {
+        int field_retries = 0;
+
+        for (page = 0; page < PAGES; page++) {
+            int tries = 0;
+            int ret;
+
+            while ((ret = get_page(fd, field, page, core + field * 010000 + page * PAGE_WORDS, timeout)) != 0) {
+                if (ret < 0) {
+                    close(fd);
+                    return -1;
+                }
+                drain(fd, 200);
+                if (!started)
+                    continue;
+                if (++tries >= args.retries) {
+                    fprintf(stderr, "%o%04o: No good answer in %d tries\n", field, page * PAGE_WORDS, tries);
+                    close(fd);
+                    return -1;
+                }
+                field_retries++;
+            }
+            if (!started) {
+                started = true;
+                start = now_ms();
+            }
+        }
+        fprintf(stderr, "Field %o: %d pages, %d retries\n", field, PAGES, field_retries);
+        retries += field_retries;
+    }
+    close(fd);
+
+    fprintf(stderr, "%d words in %.1f s, %d retries\n", args.fields * 010000,
+            (now_ms() - start) / 1000.0, retries);
+
+    return write_core(args.output, core, args.fields * 010000);
+}
@@ -0,0 +1,520 @@
+/*
+ * Program for computing safe papertape send rates for the PDP-8 loaders
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+const char *argp_program_version =
+    "loader-timing 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for computing the fastest safe character rate for loading RIM and BIN papertapes over a " \
+    "KL8E style console interface, and the put-tape --transmit-delay that gives it for the RIM loader.\v" \
+    "The instruction paths of the loaders are run against characters arriving at a fixed interval, " \
+    "with every phase between the characters and the KSF poll loop. A character is lost when the next " \
+    "one is assembled by the UART before the loader has read it and cleared the flag (KRB, or KCC after " \
+    "KRS in the RIM loader), as the interface only has one holding register. The RIM loader is the DEC " \
+    "listing at 7756. The BIN loader paths are only an approximation of the instruction mix per frame, " \
+    "its rates are an estimate and no put-tape setting is given for it. CPU timings are the nominal " \
+    "figures from the DEC handbooks.";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"cpu",             'c', "8,8i,8e,8a",  0, "CPU model, default 8e"},
+    {"loader",          'l', "rim/bin/all", 0, "Loader, default all"},
+    {"speed",           's', "BAUD",        0, "Serial com speed, default 9600"},
+    {"bits",            'b', "5,6,7,8",     0, "Number of data bits, default 8"},
+    {"parity",          'p', "N,E,O,M",     0, "Parity, default N"},
+    {"stop",            'S', "1,2",         0, "Number of stop bits, default 1"},
+    {"margin",          'm', "PERCENT",     0, "Safety margin on the computed interval, default 20"},
+    {"verbose",         'v', 0,             0, "List the instruction path of every frame"},
+    { 0 }
+};
+
+
+/* Instruction times in ns */
+struct cpu {
+    const char *name;
+    const char *desc;
+    int mri;            /* AND, TAD, ISZ, DCA */
+    int mri_ind;
+    int jms;
+    int jms_ind;
+    int jmp;
+    int jmp_ind;
+    int iot;
+    int opr;
+};
+
+static const struct cpu cpus[] = {
+    { "8",  "PDP-8",   3000, 4500, 3000, 4500, 1500, 3000, 4500, 1500 },
+    { "8i", "PDP-8/I", 3000, 4500, 3000, 4500, 1500, 3000, 4250, 1500 },
+    { "8e", "PDP-8/E", 2600, 3800, 2600, 3800, 1200, 2600, 2600, 1200 },
+    /* The KK8-A runs the 8/E cycle timing */
+    { "8a", "PDP-8/A", 2600, 3800, 2600, 3800, 1200, 2600, 2600, 1200 },
+    { NULL }
+};
+
+
+/* KL8E console IOTs */
+#define KCC     06032
+#define KSF     06031
+#define KRS     06034
+#define KRB     06036
+
+#define PATH_END    -1
+#define MAX_PATH    48
+
+
+/*
+ * The instructions from the KSF that finds the flag set up to, not
+ * including, the next KSF. The poll loop is KSF, JMP .-1.
+ */
+struct frame {
+    const char *name;
+    int path[MAX_PATH];
+};
+
+struct loader {
+    const char *name;
+    const char *desc;
+    const struct frame *frames;
+    int num_frames;
+    int poll_jmp;
+    int *tape;
+    int tape_len;
+    bool listing;       /* The paths are the DEC listing, only then is put-tape advised */
+};
+
+
+/*
+ * RIM loader, DEC listing:
+ *
+ *  7756  6032  BEG,  KCC
+ *  7757  6031        KSF
+ *  7760  5357        JMP .-1
+ *  7761  6036        KRB
+ *  7762  7106        CLL RTL
+ *  7763  7006        RTL
+ *  7764  7510        SPA
+ *  7765  5357        JMP BEG+1
+ *  7766  7006        RTL
+ *  7767  6031        KSF
+ *  7770  5367        JMP .-1
+ *  7771  6034        KRS
+ *  7772  7420        SNL
+ *  7773  3776        DCA I TEMP
+ *  7774  3376        DCA TEMP
+ *  7775  5356        JMP BEG
+ *  7776  0000  TEMP, 0
+ */
+enum rim_frame { RIM_LEADER, RIM_ORIGIN_H, RIM_ORIGIN_L, RIM_DATA_H, RIM_DATA_L, RIM_FRAMES };
+
+static const struct frame rim_frames[RIM_FRAMES] = {
+    [RIM_LEADER]   = { "leader",   { KRB, 07106, 07006, 07510, 05357, PATH_END } },
+    [RIM_ORIGIN_H] = { "origin-h", { KRB, 07106, 07006, 07510, 07006, PATH_END } },
+    [RIM_ORIGIN_L] = { "origin-l", { KRS, 07420, 03376, 05356, KCC, PATH_END } },
+    [RIM_DATA_H]   = { "data-h",   { KRB, 07106, 07006, 07510, 07006, PATH_END } },
+    [RIM_DATA_L]   = { "data-l",   { KRS, 07420, 03776, 03376, 05356, KCC, PATH_END } },
+};
+
+
+/*
+ * BIN loader, not the DEC listing and at made up addresses, so the
+ * result is only an estimate. It does about the same work per frame: a read
+ * subroutine (JMS READ, CLA, KSF, JMP .-1, KRB, DCA CHAR, TAD CHAR,
+ * JMP I READ), leader and field tests, checksum, word assembly from two
+ * frames and the store of the previous word under the current field,
+ * as the last word is the checksum.
+ */
+#define BIN_READ_TAIL   KRB, 03212, 01212, 05663
+#define BIN_READ_HEAD   04263, 07200
+#define BIN_CLASSIFY    01214, 07650, 01212, 00215, 01216, 07640
+#define BIN_CHECKSUM    01212, 01224, 03224
+
+enum bin_frame { BIN_LEADER, BIN_FIELD, BIN_ORIGIN_H, BIN_ORIGIN_L, BIN_DATA_H, BIN_DATA_L, BIN_TRAILER, BIN_FRAMES };
+
+static const struct frame bin_frames[BIN_FRAMES] = {
+    [BIN_LEADER]   = { "leader",   { BIN_READ_TAIL, 01214, 07650, 05251, BIN_READ_HEAD, PATH_END } },
+    [BIN_FIELD]    = { "field",    { BIN_READ_TAIL, BIN_CLASSIFY, 05270, 01212, 00217, 01220, 03221, 05251,
+                                     BIN_READ_HEAD, PATH_END } },
+    [BIN_ORIGIN_H] = { "origin-h", { BIN_READ_TAIL, BIN_CLASSIFY, 01221, 03230, 06201, 01223, 03623, 02231,
+                                     06201, BIN_CHECKSUM, 01212, 00226, 03227, 01212, 00232, 07106, 07006,
+                                     07006, 03223, BIN_READ_HEAD, PATH_END } },
+    [BIN_ORIGIN_L] = { "origin-l", { BIN_READ_TAIL, BIN_CHECKSUM, 01212, 01223, 03223, 01227, 07650, 01223,
+                                     03231, 05251, BIN_READ_HEAD, PATH_END } },
+    [BIN_DATA_H]   = { "data-h",   { BIN_READ_TAIL, BIN_CLASSIFY, 01221, 03230, 06201, 01223, 03623, 02231,
+                                     06201, BIN_CHECKSUM, 01212, 00226, 03227, 01212, 00232, 07106, 07006,
+                                     07006, 03223, BIN_READ_HEAD, PATH_END } },
+    [BIN_DATA_L]   = { "data-l",   { BIN_READ_TAIL, BIN_CHECKSUM, 01212, 01223, 03223, 01227, 07650, 05251,
+                                     BIN_READ_HEAD, PATH_END } },
+    [BIN_TRAILER]  = { "trailer",  { BIN_READ_TAIL, 01214, 07650, 01224, 07041, 01223, 07650, 07402,
+                                     PATH_END } },
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    const struct cpu *cpu;
+    char *loader;
+    int speed;
+    int bits;
+    char parity;
+    int stop_bits;
+    int margin;
+    bool verbose;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+    int i;
+
+    switch (key){
+    case 'c':
+        for (i = 0; cpus[i].name != NULL; i++)
+            if (0 == strcmp(arg, cpus[i].name))
+                break;
+        if (cpus[i].name == NULL) {
+            fprintf(stderr, "Error, unknown CPU: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->cpu = &cpus[i];
+        break;
+    case 'l':
+        if (strcmp(arg, "rim") && strcmp(arg, "bin") && strcmp(arg, "all")) {
+            fprintf(stderr, "Error, unknown loader: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->loader = arg;
+        break;
+    case 's':
+        arguments->speed = atoi(arg);
+        if (arguments->speed <= 0) {
+            fprintf(stderr, "Invalid baudrate: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'b':
+        if (arg[0] < '5' || arg[0] > '8' || arg[1] != '\0') {
+            fprintf(stderr, "Error, invalid number of bits: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->bits = arg[0] - '0';
+        break;
+    case 'p':
+        if (strchr("NOEM", arg[0]) == NULL || arg[0] == '\0') {
+            fprintf(stderr, "Error, invalid parity (N/O/E/M): %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->parity = arg[0];
+        break;
+    case 'S':
+        if (arg[0] != '1' && arg[0] != '2') {
+            fprintf(stderr, "Error, invalid number of stop bits: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->stop_bits = arg[0] - '0';
+        break;
+    case 'm':
+        arguments->margin = atoi(arg);
+        if (arguments->margin < 0 || arguments->margin > 1000) {
+            fprintf(stderr, "Invalid margin: %s%%\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'v':
+        arguments->verbose = true;
+        break;
+
+    case ARGP_KEY_ARG:
+        argp_usage (state);
+        return ARGP_ERR_UNKNOWN;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, NULL, doc };
+
+
+/* Execution time of one instruction in ns */
+static int instr_time(const struct cpu *cpu, int w)
+{
+    bool ind = w & 0400;
+
+    switch (w >> 9) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+        return ind ? cpu->mri_ind : cpu->mri;
+    case 4:
+        return ind ? cpu->jms_ind : cpu->jms;
+    case 5:
+        return ind ? cpu->jmp_ind : cpu->jmp;
+    case 6:
+        return cpu->iot;
+    default:
+        return cpu->opr;
+    }
+}
+
+
+static int path_time(const struct cpu *cpu, const int *path)
+{
+    int t = 0;
+
+    for (; *path != PATH_END; path++)
+        t += instr_time(cpu, *path);
+    return t;
+}
+
+
+/*
+ * Time from the start of the path until the flag is cleared and the
+ * holding register may be overwritten, KRB or the KCC after a KRS.
+ */
+static int path_release(const struct cpu *cpu, const int *path)
+{
+    int t = 0, release = -1;
+
+    for (; *path != PATH_END; path++) {
+        t += instr_time(cpu, *path);
+        if (*path == KRB || *path == KCC)
+            release = t;
+    }
+    return release < 0 ? t : release;
+}
+
+
+/*
+ * Run the tape with the flags set at PHASE + k * INTERVAL ns. Returns
+ * false when a character is lost. The worst flag to release latency per
+ * frame type is kept in WORST.
+ */
+static bool simulate(const struct loader *ld, const struct cpu *cpu, double interval, double phase, double *worst)
+{
+    int poll = cpu->iot + instr_time(cpu, ld->poll_jmp);
+    double now = 0;
+    int k;
+
+    for (k = 0; k < ld->tape_len; k++) {
+        const int *path = ld->frames[ld->tape[k]].path;
+        double flag = phase + k * interval;
+        double release;
+
+        /* KSF samples the flag at the end of the instruction */
+        if (now + cpu->iot < flag)
+            now += ceil((flag - now - cpu->iot) / poll) * poll;
+        now += cpu->iot;
+
+        release = now + path_release(cpu, path);
+        now += path_time(cpu, path);
+
+        if (worst != NULL && release - flag > worst[ld->tape[k]])
+            worst[ld->tape[k]] = release - flag;
+
+        if (k + 1 < ld->tape_len && phase + (k + 1) * interval <= release)
+            return false;
+    }
+    return true;
+}
+
+
+#define PHASES  64
+
+static bool safe(const struct loader *ld, const struct cpu *cpu, double interval, double *worst)
+{
+    int poll = cpu->iot + instr_time(cpu, ld->poll_jmp);
+    int i;
+
+    for (i = 0; i < PHASES; i++)
+        if (!simulate(ld, cpu, interval, (double)poll * i / PHASES, worst))
+            return false;
+    return true;
+}
+
+
+/* Shortest safe character interval in ns, found by bisection */
+static double min_interval(const struct loader *ld, const struct cpu *cpu)
+{
+    double lo = 0, hi = 1e6;
+
+    while (hi - lo > 1) {
+        double mid = (lo + hi) / 2;
+
+        if (safe(ld, cpu, mid, NULL))
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return hi;
+}
+
+
+static void append(struct loader *ld, int frame, int count)
+{
+    while (count--)
+        ld->tape[ld->tape_len++] = frame;
+}
+
+
+/* Representative tapes, leader, two blocks of words and trailer */
+static int build_tapes(struct loader *rim, struct loader *bin)
+{
+    int i, block;
+
+    rim->tape = malloc(4096 * sizeof(int));
+    bin->tape = malloc(4096 * sizeof(int));
+    if (rim->tape == NULL || bin->tape == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    append(rim, RIM_LEADER, 16);
+    for (i = 0; i < 256; i++) {
+        append(rim, RIM_ORIGIN_H, 1);
+        append(rim, RIM_ORIGIN_L, 1);
+        append(rim, RIM_DATA_H, 1);
+        append(rim, RIM_DATA_L, 1);
+    }
+    append(rim, RIM_LEADER, 16);
+
+    /* The BIN loader halts on the first trailer frame */
+    append(bin, BIN_LEADER, 16);
+    for (block = 0; block < 2; block++) {
+        append(bin, BIN_FIELD, 1);
+        append(bin, BIN_ORIGIN_H, 1);
+        append(bin, BIN_ORIGIN_L, 1);
+        for (i = 0; i < 128; i++) {
+            append(bin, BIN_DATA_H, 1);
+            append(bin, BIN_DATA_L, 1);
+        }
+    }
+    append(bin, BIN_DATA_H, 1);
+    append(bin, BIN_DATA_L, 1);
+    append(bin, BIN_TRAILER, 1);
+    return 0;
+}
+
+
+static void print_path(const struct cpu *cpu, const int *path)
+{
+    printf("             KSF  %4.1fus\n", cpu->iot / 1000.0);
+    for (; *path != PATH_END; path++)
+        printf("             %04o %4.1fus\n", *path, instr_time(cpu, *path) / 1000.0);
+}
+
+
+static void report(const struct loader *ld, const struct cpu *cpu, struct argp_arguments *args)
+{
+    double worst[ld->num_frames];
+    double interval, safe_interval, char_time;
+    int frame_bits, i;
+
+    frame_bits = 1 + args->bits + (args->parity != 'N') + args->stop_bits;
+    char_time = 1e9 * frame_bits / args->speed;
+
+    /* Each frame type on its own, with all the time in the world */
+    for (i = 0; i < ld->num_frames; i++)
+        worst[i] = 0;
+    safe(ld, cpu, 1e9, worst);
+
+    printf("%s loader, %s\n", ld->name, ld->desc);
+    printf("  frame      path      latency   isolated rate\n");
+    for (i = 0; i < ld->num_frames; i++) {
+        printf("  %-9s %6.1fus  %6.1fus  %7.0f char/s\n", ld->frames[i].name,
+               (cpu->iot + path_time(cpu, ld->frames[i].path)) / 1000.0,
+               worst[i] / 1000.0, 1e9 / worst[i]);
+        if (args->verbose)
+            print_path(cpu, ld->frames[i].path);
+    }
+
+    interval = min_interval(ld, cpu);
+    safe_interval = interval * (100 + args->margin) / 100;
+    printf("  tape       shortest interval %.1fus, %.0f char/s\n", interval / 1000.0, 1e9 / interval);
+
+    /* A path length that is only estimated could call an unsafe rate safe */
+    if (!ld->listing) {
+        printf("  no put-tape setting, the paths are an estimate and not the DEC listing\n\n");
+        return;
+    }
+
+    /* put-tape sleeps after every write, the line itself limits to char_time */
+    if (safe_interval <= char_time)
+        printf("  put-tape --transmit-delay=0, %d baud %d%c%d (%.0f char/s) is safe with %d%% margin\n\n",
+               args->speed, args->bits, args->parity, args->stop_bits, 1e9 / char_time, args->margin);
+    else
+        printf("  put-tape --transmit-delay=%d, %d baud %d%c%d (%.0f char/s) is too fast\n\n",
+               (int)ceil(safe_interval / 1e6), args->speed, args->bits, args->parity, args->stop_bits,
+               1e9 / char_time);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct loader rim = { "RIM", "DEC listing at 7756", rim_frames, RIM_FRAMES, 05357, NULL, 0, true };
+    struct loader bin = { "BIN", "approximated paths", bin_frames, BIN_FRAMES, 05264, NULL, 0, false };
+
+    args.cpu = &cpus[2];
+    args.loader = "all";
+    args.speed = 9600;
+    args.bits = 8;
+    args.parity = 'N';
+    args.stop_bits = 1;
+    args.margin = 20;
+    args.verbose = false;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (build_tapes(&rim, &bin) < 0)
+        return -1;
+
+    printf("%s, KL8E at %d baud %d%c%d\n\n", args.cpu->desc, args.speed, args.bits, args.parity, args.stop_bits);
+
+    if (strcmp(args.loader, "bin"))
+        report(&rim, args.cpu, &args);
+    if (strcmp(args.loader, "rim"))
+        report(&bin, args.cpu, &args);
+
+    free(rim.tape);
+    free(bin.tape);
+    return 0;
+}
@@ -0,0 +1,710 @@
+/*
+ * Program for running MAINDEC diagnostics on many PDP-8s at once
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ahocorasick.h"
+
+
+const char *argp_program_version =
+    "maindec-run 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for running lists of MAINDEC diagnostic tapes on many PDP-8s in parallel, watching " \
+    "the console output of each for pass and fail messages.\v" \
+    "The configuration has one keyword per line, # starts a comment line:\n\n" \
+    "  machine NAME DEVICE [BAUD]  A new machine, 9600 8N1 by default\n" \
+    "  tape FILE                   A tape to send, the keywords below are for it\n" \
+    "  delay MS                    Extra delay after each char of the tape\n" \
+    "  after STRING                Sent when the tape is through, e.g. to start it\n" \
+    "  pass STRING                 Console output that means pass, can be repeated\n" \
+    "  fail STRING                 Console output that means fail, can be repeated\n" \
+    "  timeout SECONDS             Hang if neither is seen in this time, default 600\n\n" \
+    "A tape without pass and fail strings passes when it has been sent. " \
+    "Strings can be in double quotes and have \\r, \\n, \\t, \\\\ and \\xHH escapes. The PDP-8 " \
+    "must be waiting in the BIN loader for each tape. The console output of every machine is " \
+    "logged to NAME.log. After a fail or hang the rest of the tapes of that machine are skipped, " \
+    "unless --keep-going. A summary is printed at the end, the exit status is 0 only if all " \
+    "tapes passed.";
+
+static char args_doc[] = "CONFIG";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"log-dir",     'l', "DIR",     0,  "Directory for the console logs, default ."},
+    {"keep-going",  'k', 0,         0,  "Run the next tape after a fail or hang"},
+    { 0 }
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *config;
+    char *log_dir;
+    bool keep_going;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'l':
+        arguments->log_dir = arg;
+        break;
+    case 'k':
+        arguments->keep_going = true;
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num != 0) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->config = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num != 1) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+speed_t map_baudrate(int baud){
+    speed_t speed;
+
+    switch (baud) {
+    case 110:
+        speed = B110;
+        break;
+    case 150:
+        speed = B150;
+        break;
+    case 300:
+        speed = B300;
+        break;
+    case 600:
+        speed = B600;
+        break;
+    case 1200:
+        speed = B1200;
+        break;
+    case 2400:
+        speed = B2400;
+        break;
+    case 4800:
+        speed = B4800;
+        break;
+    case 9600:
+        speed = B9600;
+        break;
+    case 19200:
+        speed = B19200;
+        break;
+    case 38400:
+        speed = B38400;
+        break;
+    case 57600:
+        speed = B57600;
+        break;
+    case 115200:
+        speed = B115200;
+        break;
+    default:
+        speed = -1;
+    }
+    return speed;
+}
+
+
+/* 8N1, reads return at once with what has arrived, poll() does the waiting */
+int set_interface_attribs(int fd, speed_t speed)
+{
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) < 0) {
+        fprintf(stderr, "Error from tcgetattr: %s\n", strerror(errno));
+        return -1;
+    }
+
+    cfsetspeed(&tty, speed);
+    tty.c_cflag |= (CLOCAL | CREAD);    /* ignore modem controls */
+    tty.c_cflag &= ~CSIZE;
+    tty.c_cflag |= CS8;                 /* 8-bit characters */
+    tty.c_cflag &= ~PARENB;             /* no parity */
+    tty.c_cflag &= ~CSTOPB;             /* 1 stop bit */
+    tty.c_cflag &= ~CRTSCTS;            /* no hardware flowcontrol */
+
+    /* setup for non-canonical mode */
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_oflag &= ~OPOST;
+
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        fprintf(stderr, "Error from tcsetattr: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+enum result {
+    R_PENDING,
+    R_PASS,
+    R_FAIL,
+    R_HANG,
+    R_ERROR,
+    R_SKIPPED,
+};
+
+static const char *result_name[] = { "-", "PASS", "FAIL", "HANG", "ERROR", "SKIPPED" };
+
+
+struct tape {
+    char *file;
+    int delay;
+    char *after;
+    int after_len;
+    int timeout;
+    struct ac ac;               /* Pass and fail patterns */
+    bool *fail;                 /* Per pattern */
+    enum result result;
+    char *why;
+    double seconds;             /* Run time after the tape was sent */
+};
+
+
+enum machine_state {
+    MS_SENDING,
+    MS_RUNNING,
+    MS_DONE,
+};
+
+
+struct machine {
+    char *name;
+    char *device;
+    int baud;
+    int fd;
+    FILE *log;
+    struct tape *tape;
+    int num_tapes;
+    int cur;
+    enum machine_state state;
+    unsigned char *data;        /* The tape and after string being sent */
+    size_t len;
+    size_t sent;
+    long long start;            /* Send or run start, us */
+    long long interval;         /* Between chars of the tape, us */
+    long long deadline;
+};
+
+
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+static void *xrealloc(void *p, size_t size)
+{
+    if ((p = realloc(p, size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    return p;
+}
+
+
+/* Value of a string keyword, quotes removed and escapes undone */
+static int config_string(char *value, char **out)
+{
+    size_t len = strlen(value);
+
+    if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+        value[len - 1] = '\0';
+        value++;
+    }
+    *out = strdup(value);
+    return ac_unescape(*out);
+}
+
+
+static int load_config(const char *file, struct machine **machines, int *num_machines)
+{
+    struct machine *m = NULL;
+    struct tape *t = NULL;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int line_num = 0;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    *machines = NULL;
+    *num_machines = 0;
+
+    while ((len = getline(&line, &size, f)) > 0) {
+        char *key, *value;
+
+        line_num++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+            line[--len] = '\0';
+        for (key = line; *key == ' ' || *key == '\t'; key++)
+            ;
+        if (*key == '\0' || *key == '#')
+            continue;
+
+        for (value = key; *value != '\0' && *value != ' ' && *value != '\t'; value++)
+            ;
+        if (*value != '\0')
+            *value++ = '\0';
+        while (*value == ' ' || *value == '\t')
+            value++;
+
+        if (0 == strcmp(key, "machine")) {
+            char name[256], device[256];
+            int baud = 9600;
+
+            if (sscanf(value, "%255s %255s %d", name, device, &baud) < 2 || map_baudrate(baud) == (speed_t)-1) {
+                fprintf(stderr, "%s:%d: Expected machine NAME DEVICE [BAUD]\n", file, line_num);
+                goto error;
+            }
+            *machines = xrealloc(*machines, (*num_machines + 1) * sizeof(struct machine));
+            m = &(*machines)[(*num_machines)++];
+            memset(m, 0, sizeof(*m));
+            m->name = strdup(name);
+            m->device = strdup(device);
+            m->baud = baud;
+            m->fd = -1;
+            t = NULL;
+        } else if (0 == strcmp(key, "tape")) {
+            if (m == NULL || *value == '\0') {
+                fprintf(stderr, "%s:%d: tape needs a FILE and a machine before it\n", file, line_num);
+                goto error;
+            }
+            m->tape = xrealloc(m->tape, (m->num_tapes + 1) * sizeof(struct tape));
+            t = &m->tape[m->num_tapes++];
+            memset(t, 0, sizeof(*t));
+            config_string(value, &t->file);
+            t->timeout = 600;
+            ac_init(&t->ac);
+        } else if (t == NULL) {
+            fprintf(stderr, "%s:%d: %s must follow a tape\n", file, line_num, key);
+            goto error;
+        } else if (0 == strcmp(key, "delay")) {
+            t->delay = atoi(value);
+        } else if (0 == strcmp(key, "after")) {
+            free(t->after);
+            t->after_len = config_string(value, &t->after);
+        } else if (0 == strcmp(key, "pass") || 0 == strcmp(key, "fail")) {
+            char *s;
+            int n = config_string(value, &s);
+            int p;
+
+            if (n == 0) {
+                fprintf(stderr, "%s:%d: Empty pattern\n", file, line_num);
+                free(s);
+                goto error;
+            }
+            p = ac_add(&t->ac, s, n);
+            t->fail = xrealloc(t->fail, (p + 1) * sizeof(bool));
+            t->fail[p] = key[0] == 'f';
+            free(s);
+        } else if (0 == strcmp(key, "timeout")) {
+            t->timeout = atoi(value);
+            if (t->timeout <= 0) {
+                fprintf(stderr, "%s:%d: Invalid timeout\n", file, line_num);
+                goto error;
+            }
+        } else {
+            fprintf(stderr, "%s:%d: Unknown keyword %s\n", file, line_num, key);
+            goto error;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    if (*num_machines == 0) {
+        fprintf(stderr, "%s: No machines\n", file);
+        return -1;
+    }
+    return 0;
+
+error:
+    free(line);
+    fclose(f);
+    return -1;
+}
+
+
+static void report(struct machine *m, const char *fmt, const char *detail)
+{
+    printf("%-12s %s", m->name, m->cur < m->num_tapes ? m->tape[m->cur].file : "");
+    printf(fmt, detail);
+    printf("\n");
+    fflush(stdout);
+}
+
+
+static int start_tape(struct machine *m)
+{
+    struct tape *t = &m->tape[m->cur];
+    size_t size = 0, n;
+    FILE *f;
+
+    free(m->data);
+    m->data = NULL;
+    m->len = 0;
+
+    if ((f = fopen(t->file, "r")) == NULL) {
+        t->result = R_ERROR;
+        t->why = strdup(strerror(errno));
+        return -1;
+    }
+
+    /* Read in a loop, the tape can be a pipe that can't seek */
+    do {
+        if (m->len == size)
+            m->data = xrealloc(m->data, size = size ? 2 * size : 65536);
+        n = fread(m->data + m->len, 1, size - m->len, f);
+        m->len += n;
+    } while (n > 0);
+    if (ferror(f)) {
+        t->result = R_ERROR;
+        t->why = strdup(strerror(errno));
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    /* The after string goes out paced like the rest of the tape */
+    m->data = xrealloc(m->data, m->len + t->after_len + 1);
+    memcpy(m->data + m->len, t->after, t->after_len);
+    m->len += t->after_len;
+
+    m->sent = 0;
+    m->start = now_us();
+    /* Start, eight data and a stop bit per char, plus the extra delay */
+    m->interval = 10 * 1000000LL / m->baud + 1000LL * t->delay;
+    m->state = MS_SENDING;
+    report(m, ": sending", "");
+    return 0;
+}
+
+
+/* Record the result of the current tape and go on with the next */
+static void finish_tape(struct machine *m, enum result result, const char *why, bool keep_going)
+{
+    struct tape *t = &m->tape[m->cur];
+    char detail[300];
+
+    t->result = result;
+    if (why != NULL && t->why == NULL)
+        t->why = strdup(why);
+    if (result != R_ERROR)
+        t->seconds = (now_us() - m->start) / 1e6;
+
+    snprintf(detail, sizeof(detail), "%s%s%s", result_name[result], t->why ? " " : "", t->why ? t->why : "");
+    report(m, ": %s", detail);
+
+    m->cur++;
+    if (result != R_PASS && !keep_going) {
+        for (; m->cur < m->num_tapes; m->cur++)
+            m->tape[m->cur].result = R_SKIPPED;
+    }
+
+    while (m->cur < m->num_tapes) {
+        if (start_tape(m) == 0)
+            return;
+        report(m, ": ERROR %s", m->tape[m->cur].why);
+        if (!keep_going) {
+            for (m->cur++; m->cur < m->num_tapes; m->cur++)
+                m->tape[m->cur].result = R_SKIPPED;
+            break;
+        }
+        m->cur++;
+    }
+    m->state = MS_DONE;
+}
+
+
+static void machine_input(struct machine *m, bool keep_going)
+{
+    unsigned char buf[4096];
+    ssize_t n = read(m->fd, buf, sizeof(buf));
+    ssize_t i;
+
+    if (n <= 0)
+        return;
+    if (m->log != NULL)
+        fwrite(buf, 1, n, m->log);
+
+    /* Output while a tape is sent is only logged */
+    if (m->state != MS_RUNNING)
+        return;
+
+    for (i = 0; i < n && m->state == MS_RUNNING; i++) {
+        struct tape *t = &m->tape[m->cur];
+        int s = ac_step(&t->ac, buf[i] & 0x7f);
+        int p;
+
+        while ((p = ac_match(&t->ac, &s)) != AC_NONE) {
+            char why[300];
+
+            snprintf(why, sizeof(why), "\"%s\"", t->ac.pattern[p]);
+            finish_tape(m, t->fail[p] ? R_FAIL : R_PASS, why, keep_going);
+            break;
+        }
+    }
+}
+
+
+/* Send what the pacing allows by now, the after string last, then start the run */
+static void machine_send(struct machine *m, long long now, bool keep_going)
+{
+    struct tape *t = &m->tape[m->cur];
+    size_t due = (now - m->start) / m->interval + 1;
+    ssize_t n;
+
+    if (due > m->len)
+        due = m->len;
+
+    /*
+     * With an extra delay the loader needs the gap after every char, so a
+     * late wakeup sends one char and paces the rest from now, like put-tape.
+     */
+    if (t->delay > 0 && due > m->sent + 1)
+        due = m->sent + 1;
+    if (due > m->sent) {
+        n = write(m->fd, m->data + m->sent, due - m->sent);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            finish_tape(m, R_ERROR, strerror(errno), keep_going);
+            return;
+        }
+        if (n > 0) {
+            m->sent += n;
+            if (t->delay > 0)
+                m->start = now - (long long)(m->sent - 1) * m->interval;
+        }
+    }
+
+    if (m->sent < m->len)
+        return;
+
+    t->ac.state = AC_ROOT;
+    m->state = MS_RUNNING;
+    m->start = now_us();
+    m->deadline = m->start + t->timeout * 1000000LL;
+
+    /* Without patterns a tape is only loaded, e.g. a loader or a patch */
+    if (t->ac.patterns == 0)
+        finish_tape(m, R_PASS, "loaded", keep_going);
+    else
+        report(m, ": sent, running", "");
+}
+
+
+static int open_machine(struct machine *m, const char *log_dir)
+{
+    char path[4096];
+    int i;
+
+    for (i = 0; i < m->num_tapes; i++)
+        ac_build(&m->tape[i].ac);
+
+    m->fd = open(m->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (m->fd < 0) {
+        fprintf(stderr, "%s: Error opening device %s: %s\n", m->name, m->device, strerror(errno));
+        return -1;
+    }
+    if (set_interface_attribs(m->fd, map_baudrate(m->baud)) < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s/%s.log", log_dir, m->name);
+    if ((m->log = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+static void summary(struct machine *machines, int num_machines)
+{
+    int i, j;
+    int count[R_SKIPPED + 1] = { 0 };
+
+    printf("\n%-12s %-30s %-8s %9s\n", "Machine", "Tape", "Result", "Time");
+    for (i = 0; i < num_machines; i++) {
+        struct machine *m = &machines[i];
+
+        for (j = 0; j < m->num_tapes; j++) {
+            struct tape *t = &m->tape[j];
+
+            count[t->result]++;
+            printf("%-12s %-30s %-8s ", m->name, t->file, result_name[t->result]);
+            if (t->result == R_PASS || t->result == R_FAIL || t->result == R_HANG)
+                printf("%8.1fs", t->seconds);
+            else if (t->why)
+                printf("%9s", "");
+            printf("%s%s\n", t->why ? "  " : "", t->why ? t->why : "");
+        }
+    }
+    printf("\n%d passed, %d failed, %d hung, %d errors, %d skipped\n",
+           count[R_PASS], count[R_FAIL], count[R_HANG], count[R_ERROR], count[R_SKIPPED]);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct machine *machines;
+    struct pollfd *pfd;
+    int num_machines;
+    int i, j;
+    int ret = 0;
+
+    args.config = NULL;
+    args.log_dir = ".";
+    args.keep_going = false;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (load_config(args.config, &machines, &num_machines) < 0)
+        return -1;
+
+    pfd = xrealloc(NULL, num_machines * sizeof(struct pollfd));
+
+    for (i = 0; i < num_machines; i++) {
+        struct machine *m = &machines[i];
+
+        m->state = MS_DONE;
+        if (m->num_tapes == 0)
+            continue;
+        if (open_machine(m, args.log_dir) < 0) {
+            for (j = 0; j < m->num_tapes; j++) {
+                m->tape[j].result = R_ERROR;
+                m->tape[j].why = strdup("could not open the machine");
+            }
+            continue;
+        }
+        m->cur = 0;
+        if (start_tape(m) < 0)
+            finish_tape(m, R_ERROR, NULL, args.keep_going);
+    }
+
+    /* One loop for all machines, sleeping until input, the next char to send or a deadline */
+    for (;;) {
+        long long now = now_us(), next = -1;
+        int active = 0;
+
+        for (i = 0; i < num_machines; i++) {
+            struct machine *m = &machines[i];
+            long long t;
+
+            pfd[i].fd = m->state == MS_DONE ? -1 : m->fd;
+            pfd[i].events = POLLIN;
+            if (m->state == MS_DONE)
+                continue;
+            active++;
+            if (m->state == MS_SENDING)
+                t = m->start + (long long)(m->sent) * m->interval;
+            else
+                t = m->deadline;
+            if (next < 0 || t < next)
+                next = t;
+        }
+        if (active == 0)
+            break;
+
+        if (poll(pfd, num_machines, next > now ? (next - now + 999) / 1000 : 0) < 0 && errno != EINTR) {
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            ret = -1;
+            break;
+        }
+
+        now = now_us();
+        for (i = 0; i < num_machines; i++) {
+            struct machine *m = &machines[i];
+
+            if (m->state == MS_DONE)
+                continue;
+            if (pfd[i].revents & POLLIN)
+                machine_input(m, args.keep_going);
+            /* A hung up device never ends a run by itself, don't wait for the deadline */
+            if (m->state != MS_DONE && (pfd[i].revents & (POLLHUP | POLLERR)))
+                finish_tape(m, R_ERROR, "lost the device", args.keep_going);
+            else if (m->state == MS_SENDING)
+                machine_send(m, now, args.keep_going);
+            else if (m->state == MS_RUNNING && now >= m->deadline)
+                finish_tape(m, R_HANG, "timeout", args.keep_going);
+        }
+    }
+
+    summary(machines, num_machines);
+
+    for (i = 0; i < num_machines; i++) {
+        struct machine *m = &machines[i];
+
+        for (j = 0; j < m->num_tapes; j++)
+            if (m->tape[j].result != R_PASS)
+                ret = -1;
+        if (m->log != NULL)
+            fclose(m->log);
+        if (m->fd >= 0)
+            close(m->fd);
+    }
+    return ret;
+}
@@ -0,0 +1,249 @@
+/*
+ * Prometheus style metrics for the long running PDP-8 tools
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * The hot path only does relaxed atomic adds on counters and histograms.
+ * A server thread answers every connection with a HTTP response in the
+ * Prometheus text format, either on a UNIX socket (ENDPOINT contains a
+ * '/') or on TCP port ENDPOINT on localhost:
+ *
+ *     curl --unix-socket /tmp/serial-dump.sock http://localhost/metrics
+ *     curl http://localhost:9108/metrics
+ *
+ * Build with -pthread.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * A counter or gauge. Metrics of the same family must follow each other
+ * in the list given to metrics_start(), they then share HELP and TYPE.
+ */
+struct metric {
+    const char *family;
+    const char *labels;
+    const char *type;
+    const char *help;
+    atomic_ullong value;
+};
+
+
+/* Histogram with power of two buckets, 1us to 2^(METRICS_BUCKETS-1)us */
+#define METRICS_BUCKETS 20
+
+struct histogram {
+    const char *family;
+    const char *help;
+    atomic_ullong bucket[METRICS_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum;
+};
+
+
+struct metrics_server {
+    int fd;
+    struct metric **metrics;
+    struct histogram **histograms;
+    void (*update)(void *);
+    void *arg;
+};
+
+
+static inline void metric_add(struct metric *m, unsigned long long n)
+{
+    atomic_fetch_add_explicit(&m->value, n, memory_order_relaxed);
+}
+
+
+static inline void metric_set(struct metric *m, unsigned long long n)
+{
+    atomic_store_explicit(&m->value, n, memory_order_relaxed);
+}
+
+
+/* Bucket i counts up to and including 2^i us, an exact power of two is in its own bucket */
+static inline void histogram_observe(struct histogram *h, unsigned long long us)
+{
+    int i = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+
+    if (i >= METRICS_BUCKETS)
+        i = METRICS_BUCKETS - 1;
+
+    atomic_fetch_add_explicit(&h->bucket[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, us, memory_order_relaxed);
+}
+
+
+/* Monotonic time in microseconds, for latency measurements */
+static inline unsigned long long metrics_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static void metrics_write(FILE *f, struct metrics_server *srv)
+{
+    const char *family = NULL;
+    int i, j;
+
+    for (i = 0; srv->metrics && srv->metrics[i]; i++) {
+        struct metric *m = srv->metrics[i];
+
+        if (family == NULL || strcmp(family, m->family)) {
+            fprintf(f, "# HELP %s %s\n", m->family, m->help);
+            fprintf(f, "# TYPE %s %s\n", m->family, m->type);
+            family = m->family;
+        }
+        fprintf(f, "%s%s %llu\n", m->family, m->labels ? m->labels : "",
+                atomic_load_explicit(&m->value, memory_order_relaxed));
+    }
+
+    for (i = 0; srv->histograms && srv->histograms[i]; i++) {
+        struct histogram *h = srv->histograms[i];
+        unsigned long long cumulative = 0;
+
+        fprintf(f, "# HELP %s %s\n", h->family, h->help);
+        fprintf(f, "# TYPE %s histogram\n", h->family);
+        for (j = 0; j < METRICS_BUCKETS - 1; j++) {
+            cumulative += atomic_load_explicit(&h->bucket[j], memory_order_relaxed);
+            fprintf(f, "%s_bucket{le=\"%g\"} %llu\n", h->family, (double)(1ULL << j) / 1e6, cumulative);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", h->family, atomic_load_explicit(&h->count, memory_order_relaxed));
+        fprintf(f, "%s_sum %g\n", h->family, atomic_load_explicit(&h->sum, memory_order_relaxed) / 1e6);
+        fprintf(f, "%s_count %llu\n", h->family, atomic_load_explicit(&h->count, memory_order_relaxed));
+    }
+}
+
+
+static void *metrics_thread(void *arg)
+{
+    struct metrics_server *srv = arg;
+    struct timeval timeout = { .tv_sec = 1 };
+
+    for (;;) {
+        char request[1024];
+        char *body = NULL;
+        size_t len = 0;
+        FILE *f;
+        int fd;
+
+        fd = accept(srv->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error from accept: %s\n", strerror(errno));
+            return NULL;
+        }
+
+        /* Any request gets the metrics, the request itself is not parsed */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        recv(fd, request, sizeof(request), 0);
+
+        if (srv->update)
+            srv->update(srv->arg);
+
+        if ((f = open_memstream(&body, &len)) != NULL) {
+            char header[128];
+            int n;
+
+            metrics_write(f, srv);
+            fclose(f);
+
+            /* MSG_NOSIGNAL, a client going away must not kill the tool */
+            n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+                                                 "Content-Type: text/plain; version=0.0.4\r\n"
+                                                 "Content-Length: %zu\r\n\r\n", len);
+            if (send(fd, header, n, MSG_NOSIGNAL) == n)
+                send(fd, body, len, MSG_NOSIGNAL);
+            free(body);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+
+/*
+ * Start serving the NULL terminated lists of metrics and histograms.
+ * update() is called from the server thread before every response, for
+ * values that are cheaper to fetch on demand than to count.
+ */
+static int metrics_start(const char *endpoint, struct metric **metrics, struct histogram **histograms,
+                         void (*update)(void *), void *arg)
+{
+    static struct metrics_server srv;
+    pthread_t thread;
+
+    srv.metrics = metrics;
+    srv.histograms = histograms;
+    srv.update = update;
+    srv.arg = arg;
+
+    if (strchr(endpoint, '/') != NULL) {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", endpoint);
+        unlink(endpoint);
+
+        srv.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (srv.fd < 0 || bind(srv.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "Error binding metrics socket %s: %s\n", endpoint, strerror(errno));
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        int one = 1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(atoi(endpoint));
+
+        srv.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (srv.fd >= 0)
+            setsockopt(srv.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (srv.fd < 0 || bind(srv.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "Error binding metrics port %s: %s\n", endpoint, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (listen(srv.fd, 4) < 0) {
+        fprintf(stderr, "Error from listen: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, metrics_thread, &srv) != 0) {
+        fprintf(stderr, "Could not start metrics thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,939 @@
+/*
+ * Program for reading and writing files on OS/8 disk images
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+const char *argp_program_version =
+    "os8-image 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for handling files on OS/8 disk images (SIMH/SerialDisk format, one 12-bit word in two bytes). " \
+    "Commands: dir, get NAME..., put FILE..., del NAME...\v" \
+    "A RK05 image holds two OS/8 units, RKA (unit 0) and RKB (unit 1). Images of any other size are " \
+    "handled as one flat OS/8 unit, RX images must be in logical block order. File data is converted " \
+    "by mode: ascii (three 8-bit chars in two words, ^Z terminated, CR/LF <-> LF), packed (three " \
+    "bytes in two words, no conversion, e.g. .BN tapes) or image (one word in two bytes, e.g. .SV). " \
+    "Default mode is guessed from the OS/8 file extension.";
+
+static char args_doc[] = "IMAGE COMMAND [ARG...]";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"unit",            'u', "0,1",                 0, "Unit on a RK05 image, 0 = RKA, 1 = RKB"},
+    {"type",            't', "rk05/flat",           0, "Image type, default is guessed from image size"},
+    {"mode",            'm', "ascii/packed/image",  0, "File data conversion"},
+    {"name",            'n', "NAME.EX",             0, "OS/8 name for put, or host name for get, of a single file"},
+    { 0 }
+};
+
+
+/* OS/8 file system layout */
+#define OS8_BLOCK_WORDS     256
+#define OS8_BLOCK_BYTES     (2 * OS8_BLOCK_WORDS)
+#define OS8_DIR_FIRST       1
+#define OS8_DIR_LAST        6
+#define OS8_DIR_HEADER      5
+#define OS8_MAX_INFO        8
+
+/* RK05, 203 cylinders * 2 surfaces * 16 sectors, split in two OS/8 units */
+#define RK05_BLOCKS         6496
+#define RK05_UNIT_BLOCKS    3248
+
+#define CTRL_Z              032
+
+
+enum image_type {
+    IT_AUTO,
+    IT_RK05,
+    IT_FLAT,
+};
+
+
+enum data_mode {
+    DM_AUTO,
+    DM_ASCII,
+    DM_PACKED,
+    DM_IMAGE,
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *image;
+    char *command;
+    char **files;
+    int num_files;
+    char *name;
+    int unit;
+    enum image_type type;
+    enum data_mode mode;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'u':
+        if (arg[0] == '0' || arg[0] == '1') {
+            arguments->unit = arg[0] - '0';
+        } else {
+            fprintf(stderr, "Error, invalid unit: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 't':
+        if (0 == strcmp(arg, "rk05")) {
+            arguments->type = IT_RK05;
+        } else if (0 == strcmp(arg, "flat")) {
+            arguments->type = IT_FLAT;
+        } else {
+            fprintf(stderr, "Invalid image type: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'm':
+        if (0 == strcmp(arg, "ascii")) {
+            arguments->mode = DM_ASCII;
+        } else if (0 == strcmp(arg, "packed")) {
+            arguments->mode = DM_PACKED;
+        } else if (0 == strcmp(arg, "image")) {
+            arguments->mode = DM_IMAGE;
+        } else {
+            fprintf(stderr, "Invalid mode: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'n':
+        arguments->name = arg;
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num == 0) {
+            arguments->image = arg;
+        } else if (state->arg_num == 1) {
+            arguments->command = arg;
+            arguments->files = &state->argv[state->next];
+            arguments->num_files = state->argc - state->next;
+            state->next = state->argc;
+        }
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 2){
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+/*
+ * The image is mapped as a whole, a 12-bit word is stored little endian
+ * in two bytes. All block numbers below are relative to the selected unit.
+ */
+struct os8_image {
+    unsigned char *map;
+    size_t size;
+    long base;
+    long blocks;
+    bool writable;
+};
+
+
+static inline int get_word(struct os8_image *img, long block, int offset)
+{
+    unsigned char *p = img->map + (img->base + block) * OS8_BLOCK_BYTES + 2 * offset;
+
+    return (p[0] | (p[1] << 8)) & 07777;
+}
+
+
+static inline void put_word(struct os8_image *img, long block, int offset, int word)
+{
+    unsigned char *p = img->map + (img->base + block) * OS8_BLOCK_BYTES + 2 * offset;
+
+    p[0] = word & 0xff;
+    p[1] = (word >> 8) & 0x0f;
+}
+
+
+int open_image(struct os8_image *img, char *file, enum image_type type, int unit, bool writable)
+{
+    struct stat st;
+    long total;
+    int fd;
+
+    fd = open(file, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening image %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error from fstat: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    total = st.st_size / OS8_BLOCK_BYTES;
+
+    if (type == IT_AUTO)
+        type = (total == RK05_BLOCKS) ? IT_RK05 : IT_FLAT;
+
+    if (type == IT_RK05) {
+        if (total < RK05_BLOCKS) {
+            fprintf(stderr, "%s: Too small for a RK05 image.\n", file);
+            close(fd);
+            return -1;
+        }
+        img->base = unit * RK05_UNIT_BLOCKS;
+        img->blocks = RK05_UNIT_BLOCKS;
+    } else {
+        if (unit != 0) {
+            fprintf(stderr, "%s: Flat images only have unit 0.\n", file);
+            close(fd);
+            return -1;
+        }
+        img->base = 0;
+        img->blocks = total > 010000 ? 010000 : total;
+    }
+
+    if (img->blocks <= OS8_DIR_LAST) {
+        fprintf(stderr, "%s: Too small for an OS/8 file system.\n", file);
+        close(fd);
+        return -1;
+    }
+
+    img->size = st.st_size;
+    img->writable = writable;
+    img->map = mmap(NULL, img->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (img->map == MAP_FAILED) {
+        fprintf(stderr, "Error from mmap: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+void close_image(struct os8_image *img)
+{
+    if (img->writable)
+        msync(img->map, img->size, MS_SYNC);
+    munmap(img->map, img->size);
+}
+
+
+/*
+ * The directory is read once into an index of all entries in device order,
+ * empty areas included. Commands work on the index, and the directory
+ * segments are rebuilt from it in one go when done.
+ */
+struct dir_entry {
+    bool empty;
+    int name[4];
+    int info[OS8_MAX_INFO];
+    int start;
+    int length;
+};
+
+
+struct dir_index {
+    struct dir_entry *entry;
+    int count;
+    int alloc;
+    int first_block;
+    int info_words;
+};
+
+
+static inline int negate(int word)
+{
+    return (010000 - word) & 07777;
+}
+
+
+struct dir_entry *index_insert(struct dir_index *idx, int pos)
+{
+    if (idx->count == idx->alloc) {
+        idx->alloc = idx->alloc ? 2 * idx->alloc : 64;
+        idx->entry = realloc(idx->entry, idx->alloc * sizeof(struct dir_entry));
+        if (idx->entry == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+    }
+
+    memmove(&idx->entry[pos + 1], &idx->entry[pos], (idx->count - pos) * sizeof(struct dir_entry));
+    idx->count++;
+    memset(&idx->entry[pos], 0, sizeof(struct dir_entry));
+    return &idx->entry[pos];
+}
+
+
+void index_remove(struct dir_index *idx, int pos)
+{
+    idx->count--;
+    memmove(&idx->entry[pos], &idx->entry[pos + 1], (idx->count - pos) * sizeof(struct dir_entry));
+}
+
+
+/* A copy to change, the original is kept if the change fails */
+void index_copy(struct dir_index *to, struct dir_index *from)
+{
+    *to = *from;
+    to->entry = malloc((from->alloc ? from->alloc : 1) * sizeof(struct dir_entry));
+    if (to->entry == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    memcpy(to->entry, from->entry, from->count * sizeof(struct dir_entry));
+}
+
+
+int read_directory(struct os8_image *img, struct dir_index *idx)
+{
+    int segment = OS8_DIR_FIRST;
+    int visited = 0;
+    int block = 0;
+
+    memset(idx, 0, sizeof(*idx));
+
+    while (segment != 0) {
+        int entries, start, offset, i;
+
+        if (segment < OS8_DIR_FIRST || segment > OS8_DIR_LAST || (visited & (1 << segment))) {
+            fprintf(stderr, "Invalid directory segment link: %o\n", segment);
+            return -1;
+        }
+        visited |= 1 << segment;
+
+        entries = negate(get_word(img, segment, 0));
+        start = get_word(img, segment, 1);
+
+        if (segment == OS8_DIR_FIRST) {
+            idx->first_block = block = start;
+            idx->info_words = negate(get_word(img, segment, 4));
+            if (idx->info_words > OS8_MAX_INFO) {
+                fprintf(stderr, "Invalid number of additional information words: %d\n", idx->info_words);
+                return -1;
+            }
+        } else if (start != block) {
+            fprintf(stderr, "Directory segment %d starts at block %o, expected %o\n", segment, start, block);
+            return -1;
+        }
+
+        offset = OS8_DIR_HEADER;
+        for (i = 0; i < entries; i++) {
+            struct dir_entry *e = index_insert(idx, idx->count);
+
+            if (offset + 2 > OS8_BLOCK_WORDS) {
+                fprintf(stderr, "Directory segment %d overflows\n", segment);
+                return -1;
+            }
+
+            if (get_word(img, segment, offset) == 0) {
+                e->empty = true;
+                e->length = negate(get_word(img, segment, offset + 1));
+                offset += 2;
+            } else {
+                int j;
+
+                if (offset + 5 + idx->info_words > OS8_BLOCK_WORDS) {
+                    fprintf(stderr, "Directory segment %d overflows\n", segment);
+                    return -1;
+                }
+                for (j = 0; j < 4; j++)
+                    e->name[j] = get_word(img, segment, offset++);
+                for (j = 0; j < idx->info_words; j++)
+                    e->info[j] = get_word(img, segment, offset++);
+                e->length = negate(get_word(img, segment, offset++));
+            }
+            e->start = block;
+            block += e->length;
+        }
+
+        segment = get_word(img, segment, 2);
+    }
+
+    if (block > img->blocks) {
+        fprintf(stderr, "Directory describes %d blocks, unit only has %ld\n", block, img->blocks);
+        return -1;
+    }
+    return 0;
+}
+
+
+static inline int entry_words(struct dir_index *idx, struct dir_entry *e)
+{
+    return e->empty ? 2 : 5 + idx->info_words;
+}
+
+
+bool directory_fits(struct dir_index *idx)
+{
+    int segment = OS8_DIR_FIRST;
+    int pos = OS8_DIR_HEADER;
+    int i;
+
+    for (i = 0; i < idx->count; i++) {
+        if (pos + entry_words(idx, &idx->entry[i]) > OS8_BLOCK_WORDS) {
+            segment++;
+            pos = OS8_DIR_HEADER;
+        }
+        pos += entry_words(idx, &idx->entry[i]);
+    }
+    return segment <= OS8_DIR_LAST;
+}
+
+
+int write_directory(struct os8_image *img, struct dir_index *idx)
+{
+    int segment, i, pos, n;
+
+    /* Check that everything fits before touching the image */
+    if (!directory_fits(idx)) {
+        fprintf(stderr, "Directory full\n");
+        return -1;
+    }
+
+    i = 0;
+    for (segment = OS8_DIR_FIRST; ; segment++) {
+        int header = 0;
+        int start = i < idx->count ? idx->entry[i].start : idx->first_block;
+
+        for (pos = 0; pos < OS8_BLOCK_WORDS; pos++)
+            put_word(img, segment, pos, 0);
+
+        pos = OS8_DIR_HEADER;
+        for (n = 0; i < idx->count; i++, n++) {
+            struct dir_entry *e = &idx->entry[i];
+            int j;
+
+            if (pos + entry_words(idx, e) > OS8_BLOCK_WORDS)
+                break;
+
+            if (e->empty) {
+                put_word(img, segment, pos++, 0);
+            } else {
+                for (j = 0; j < 4; j++)
+                    put_word(img, segment, pos++, e->name[j]);
+                for (j = 0; j < idx->info_words; j++)
+                    put_word(img, segment, pos++, e->info[j]);
+            }
+            put_word(img, segment, pos++, negate(e->length));
+        }
+
+        put_word(img, segment, header++, negate(n));
+        put_word(img, segment, header++, start);
+        put_word(img, segment, header++, i < idx->count ? segment + 1 : 0);
+        put_word(img, segment, header++, 0);
+        put_word(img, segment, header++, negate(idx->info_words));
+
+        if (i == idx->count)
+            break;
+    }
+    return 0;
+}
+
+
+/* SIXBIT, as used for OS/8 file names */
+static inline int to_sixbit(char c)
+{
+    return toupper((unsigned char)c) & 077;
+}
+
+
+static inline char from_sixbit(int c)
+{
+    c &= 077;
+    return c == 0 ? '\0' : (c < 040 ? c + 0100 : c);
+}
+
+
+void entry_name(struct dir_entry *e, char *buff)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        *buff = from_sixbit(e->name[i] >> 6);
+        if (*buff)
+            buff++;
+        *buff = from_sixbit(e->name[i]);
+        if (*buff)
+            buff++;
+    }
+    *buff++ = '.';
+    *buff = from_sixbit(e->name[3] >> 6);
+    if (*buff)
+        buff++;
+    *buff = from_sixbit(e->name[3]);
+    if (*buff)
+        buff++;
+    *buff = '\0';
+}
+
+
+int parse_name(char *name, int *words)
+{
+    char chars[8];
+    char *p;
+    int i;
+
+    /* Use the last path component only */
+    if ((p = strrchr(name, '/')) != NULL)
+        name = p + 1;
+
+    memset(chars, 0, sizeof(chars));
+    for (i = 0, p = name; *p && *p != '.'; p++) {
+        if (!isalnum((unsigned char)*p) || i == 6)
+            return -1;
+        chars[i++] = *p;
+    }
+    if (i == 0)
+        return -1;
+
+    if (*p == '.') {
+        for (i = 6, p++; *p; p++) {
+            if (!isalnum((unsigned char)*p) || i == 8)
+                return -1;
+            chars[i++] = *p;
+        }
+    }
+
+    for (i = 0; i < 4; i++)
+        words[i] = to_sixbit(chars[2 * i]) << 6 | to_sixbit(chars[2 * i + 1]);
+    return 0;
+}
+
+
+int find_entry(struct dir_index *idx, int *name)
+{
+    int i;
+
+    for (i = 0; i < idx->count; i++) {
+        struct dir_entry *e = &idx->entry[i];
+
+        if (!e->empty && 0 == memcmp(e->name, name, sizeof(e->name)))
+            return i;
+    }
+    return -1;
+}
+
+
+enum data_mode guess_mode(int *name)
+{
+    static const char *ascii[] = {"PA", "FC", "BA", "TX", "LS", "MA", "HL", "BI", NULL};
+    char ext[3];
+    int i;
+
+    ext[0] = from_sixbit(name[3] >> 6);
+    ext[1] = from_sixbit(name[3]);
+    ext[2] = '\0';
+
+    for (i = 0; ascii[i] != NULL; i++) {
+        if (0 == strcmp(ext, ascii[i]))
+            return DM_ASCII;
+    }
+    if (0 == strcmp(ext, "BN"))
+        return DM_PACKED;
+    return DM_IMAGE;
+}
+
+
+void list_directory(struct dir_index *idx)
+{
+    int i, files = 0, used_blocks = 0, free_blocks = 0;
+
+    for (i = 0; i < idx->count; i++) {
+        struct dir_entry *e = &idx->entry[i];
+        char name[12];
+
+        if (e->empty) {
+            free_blocks += e->length;
+            continue;
+        }
+
+        entry_name(e, name);
+        printf("%-10s %4d  %5.4o", name, e->length, e->start);
+
+        /* First additional word is the creation date, MMMM DDDD DYYY */
+        if (idx->info_words > 0 && (e->info[0] >> 8) != 0)
+            printf("  %2.2d-%2.2d-%4d", (e->info[0] >> 3) & 037, e->info[0] >> 8, 1970 + (e->info[0] & 7));
+        printf("\n");
+        files++;
+        used_blocks += e->length;
+    }
+    printf("\n%4d FILES IN %4d BLOCKS - %4d FREE BLOCKS\n", files, used_blocks, free_blocks);
+}
+
+
+int get_file(struct os8_image *img, struct dir_index *idx, char *name, char *host, enum data_mode mode)
+{
+    int words[4];
+    struct dir_entry *e;
+    FILE *f;
+    long block;
+    int pos, i;
+
+    if (parse_name(name, words) < 0 || (pos = find_entry(idx, words)) < 0) {
+        fprintf(stderr, "File not found: %s\n", name);
+        return -1;
+    }
+    e = &idx->entry[pos];
+
+    if (mode == DM_AUTO)
+        mode = guess_mode(e->name);
+
+    if ((f = fopen(host, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", host, strerror(errno));
+        return -1;
+    }
+
+    for (block = e->start; block < e->start + e->length; block++) {
+        for (i = 0; i < OS8_BLOCK_WORDS; i += 2) {
+            int w1 = get_word(img, block, i);
+            int w2 = get_word(img, block, i + 1);
+            int c[3], j;
+
+            if (mode == DM_IMAGE) {
+                fputc(w1 & 0xff, f);
+                fputc(w1 >> 8, f);
+                fputc(w2 & 0xff, f);
+                fputc(w2 >> 8, f);
+                continue;
+            }
+
+            c[0] = w1 & 0377;
+            c[1] = w2 & 0377;
+            c[2] = (w1 >> 8) << 4 | (w2 >> 8);
+
+            for (j = 0; j < 3; j++) {
+                if (mode == DM_PACKED) {
+                    fputc(c[j], f);
+                    continue;
+                }
+                c[j] &= 0177;
+                if (c[j] == CTRL_Z)
+                    goto done;
+                if (c[j] != '\0' && c[j] != '\r')
+                    fputc(c[j], f);
+            }
+        }
+    }
+done:
+    fclose(f);
+    return 0;
+}
+
+
+/*
+ * Read a host file and convert it to OS/8 words, the result is
+ * padded to a whole number of blocks.
+ */
+int *load_host_file(char *host, enum data_mode mode, int *num_blocks)
+{
+    unsigned char *data = NULL;
+    int *words;
+    size_t len = 0, alloc = 0, n, i;
+    int num_words = 0;
+    FILE *f;
+    int ch, prev = 0;
+
+    if ((f = fopen(host, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", host, strerror(errno));
+        return NULL;
+    }
+
+    while ((ch = fgetc(f)) != EOF) {
+        /* LF -> CR LF, and room for the final ^Z */
+        if (len + 3 > alloc) {
+            alloc = alloc ? 2 * alloc : 4096;
+            if ((data = realloc(data, alloc)) == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(-1);
+            }
+        }
+        if (mode == DM_ASCII) {
+            if (ch == '\n' && prev != '\r')
+                data[len++] = '\r' | 0200;
+            data[len++] = ch | 0200;
+        } else {
+            data[len++] = ch;
+        }
+        prev = ch;
+    }
+    fclose(f);
+
+    if (mode == DM_ASCII) {
+        if (data == NULL && (data = malloc(1)) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        data[len++] = CTRL_Z | 0200;
+    }
+
+    n = (mode == DM_IMAGE) ? (len + 1) / 2 : 2 * ((len + 2) / 3);
+    *num_blocks = (n + OS8_BLOCK_WORDS - 1) / OS8_BLOCK_WORDS;
+    if (*num_blocks == 0)
+        *num_blocks = 1;
+
+    if ((words = calloc(*num_blocks * OS8_BLOCK_WORDS, sizeof(int))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+
+    if (mode == DM_IMAGE) {
+        for (i = 0; i < len; i += 2)
+            words[num_words++] = (data[i] | (i + 1 < len ? data[i + 1] << 8 : 0)) & 07777;
+    } else {
+        for (i = 0; i < len; i += 3) {
+            int c1 = data[i];
+            int c2 = i + 1 < len ? data[i + 1] : 0;
+            int c3 = i + 2 < len ? data[i + 2] : 0;
+
+            words[num_words++] = (c3 & 0360) << 4 | c1;
+            words[num_words++] = (c3 & 0017) << 8 | c2;
+        }
+    }
+
+    free(data);
+    return words;
+}
+
+
+void delete_entry(struct dir_index *idx, int pos)
+{
+    idx->entry[pos].empty = true;
+
+    /* Merge with empty neighbours */
+    if (pos + 1 < idx->count && idx->entry[pos + 1].empty) {
+        idx->entry[pos].length += idx->entry[pos + 1].length;
+        index_remove(idx, pos + 1);
+    }
+    if (pos > 0 && idx->entry[pos - 1].empty) {
+        idx->entry[pos - 1].length += idx->entry[pos].length;
+        index_remove(idx, pos);
+    }
+}
+
+
+int put_file(struct os8_image *img, struct dir_index *idx, char *host, char *name, enum data_mode mode)
+{
+    struct dir_index new;
+    int words[4];
+    int *data;
+    int num_blocks, pos, i;
+    struct dir_entry *e;
+    long block;
+
+    if (parse_name(name, words) < 0) {
+        fprintf(stderr, "Invalid OS/8 file name: %s\n", name);
+        return -1;
+    }
+
+    if (mode == DM_AUTO)
+        mode = guess_mode(words);
+
+    if ((data = load_host_file(host, mode, &num_blocks)) == NULL)
+        return -1;
+
+    /*
+     * The new directory is made and checked first, so the data can't be
+     * written over blocks that the old directory still gives to a file.
+     * A new file replaces an old one with the same name.
+     */
+    index_copy(&new, idx);
+    if ((pos = find_entry(&new, words)) >= 0)
+        delete_entry(&new, pos);
+
+    for (pos = 0; pos < new.count; pos++) {
+        if (new.entry[pos].empty && new.entry[pos].length >= num_blocks)
+            break;
+    }
+    if (pos == new.count) {
+        fprintf(stderr, "No room for %s, %d blocks needed\n", name, num_blocks);
+        free(new.entry);
+        free(data);
+        return -1;
+    }
+
+    e = index_insert(&new, pos);
+    memcpy(e->name, words, sizeof(e->name));
+    e->start = new.entry[pos + 1].start;
+    e->length = num_blocks;
+
+    if (new.info_words > 0) {
+        time_t now = time(NULL);
+        struct tm *tm = localtime(&now);
+
+        e->info[0] = (tm->tm_mon + 1) << 8 | tm->tm_mday << 3 | ((tm->tm_year - 70) & 7);
+    }
+
+    new.entry[pos + 1].start += num_blocks;
+    new.entry[pos + 1].length -= num_blocks;
+    if (new.entry[pos + 1].length == 0)
+        index_remove(&new, pos + 1);
+
+    if (!directory_fits(&new)) {
+        fprintf(stderr, "Directory full, %s not written\n", name);
+        free(new.entry);
+        free(data);
+        return -1;
+    }
+
+    for (block = 0; block < num_blocks; block++) {
+        for (i = 0; i < OS8_BLOCK_WORDS; i++)
+            put_word(img, e->start + block, i, data[block * OS8_BLOCK_WORDS + i]);
+    }
+
+    free(idx->entry);
+    *idx = new;
+    free(data);
+    return 0;
+}
+
+
+/* Host file name for an OS/8 name, in lower case */
+void host_name(char *name, char *buff, size_t size)
+{
+    char *p;
+
+    if ((p = strrchr(name, '/')) != NULL)
+        name = p + 1;
+
+    snprintf(buff, size, "%s", name);
+    for (p = buff; *p; p++)
+        *p = tolower((unsigned char)*p);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct os8_image img;
+    struct dir_index idx;
+    bool modify;
+    int ret = 0;
+    int i;
+
+    args.image = NULL;
+    args.command = NULL;
+    args.files = NULL;
+    args.num_files = 0;
+    args.name = NULL;
+    args.unit = 0;
+    args.type = IT_AUTO;
+    args.mode = DM_AUTO;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (0 == strcmp(args.command, "dir")) {
+        modify = false;
+    } else if (0 == strcmp(args.command, "get")) {
+        modify = false;
+    } else if (0 == strcmp(args.command, "put") || 0 == strcmp(args.command, "del")) {
+        modify = true;
+    } else {
+        fprintf(stderr, "Unknown command: %s\n", args.command);
+        return -1;
+    }
+
+    if (args.name != NULL && args.num_files != 1) {
+        fprintf(stderr, "--name can only be used with a single file\n");
+        return -1;
+    }
+
+    if (open_image(&img, args.image, args.type, args.unit, modify) < 0)
+        return -1;
+
+    if (read_directory(&img, &idx) < 0) {
+        close_image(&img);
+        return -1;
+    }
+
+    if (0 == strcmp(args.command, "dir")) {
+        list_directory(&idx);
+    } else if (0 == strcmp(args.command, "get")) {
+        for (i = 0; i < args.num_files; i++) {
+            char host[4096];
+
+            /* A name given with -n is used as it is */
+            if (args.name != NULL)
+                snprintf(host, sizeof(host), "%s", args.name);
+            else
+                host_name(args.files[i], host, sizeof(host));
+            if (get_file(&img, &idx, args.files[i], host, args.mode) < 0)
+                ret = -1;
+        }
+    } else if (0 == strcmp(args.command, "put")) {
+        for (i = 0; i < args.num_files; i++) {
+            if (put_file(&img, &idx, args.files[i], args.name ? args.name : args.files[i], args.mode) < 0)
+                ret = -1;
+        }
+    } else if (0 == strcmp(args.command, "del")) {
+        for (i = 0; i < args.num_files; i++) {
+            int words[4];
+            int pos;
+
+            if (parse_name(args.files[i], words) < 0 || (pos = find_entry(&idx, words)) < 0) {
+                fprintf(stderr, "File not found: %s\n", args.files[i]);
+                ret = -1;
+                continue;
+            }
+            delete_entry(&idx, pos);
+        }
+    }
+
+    if (modify && write_directory(&img, &idx) < 0)
+        ret = -1;
+
+    close_image(&img);
+    free(idx.entry);
+    return ret;
+}
@@ -0,0 +1,584 @@
+/*
+ * Program for keeping OS/8 disk images in a deduplicated store
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "os8store.h"
+
+
+const char *argp_program_version =
+    "os8-store 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for keeping many OS/8 disk images (SIMH/SerialDisk format) in a store where every " \
+    "distinct 256-word block is kept only once. " \
+    "Commands: import IMAGE [NAME], export NAME FILE, clone NAME NEW, rm NAME..., list, stats, gc\v" \
+    "import adds an image file under NAME, default is the file name without extension. export " \
+    "writes it back as a normal image file. clone makes a new image with the same contents, it " \
+    "only copies the block map. Blocks that are no longer used by any image after rm are " \
+    "removed by gc. list shows for every image how many of its blocks are zero, shared with " \
+    "other images, or only used by it.";
+
+static char args_doc[] = "COMMAND [ARG...]";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"store",   's', "DIR",     0,  "Store directory, default os8.store"},
+    { 0 }
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *store;
+    char *command;
+    char **args;
+    int num_args;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 's':
+        arguments->store = arg;
+        break;
+
+    case ARGP_KEY_ARG:
+        arguments->command = arg;
+        arguments->args = &state->argv[state->next];
+        arguments->num_args = state->argc - state->next;
+        state->next = state->argc;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 1){
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* Sorted names of all images in the store, NULL terminated */
+char **image_names(struct store *st)
+{
+    char path[4096];
+    char **names = NULL;
+    int num = 0;
+    struct dirent *de;
+    DIR *d;
+
+    snprintf(path, sizeof(path), "%s/images", st->dir);
+    if ((d = opendir(path)) == NULL) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+
+        if (de->d_name[0] == '.' || len <= 4 || strcmp(de->d_name + len - 4, ".map") != 0)
+            continue;
+        names = realloc(names, (num + 2) * sizeof(char *));
+        names[num] = strndup(de->d_name, len - 4);
+        num++;
+    }
+    closedir(d);
+
+    if (names == NULL)
+        names = calloc(1, sizeof(char *));
+    else
+        qsort(names, num, sizeof(char *), compare_names);
+    names[num] = NULL;
+    return names;
+}
+
+
+void free_names(char **names)
+{
+    int i;
+
+    for (i = 0; names[i] != NULL; i++)
+        free(names[i]);
+    free(names);
+}
+
+
+bool image_exists(struct store *st, char *name)
+{
+    char path[4096];
+
+    return store_map_path(st, name, path, sizeof(path)) == 0 && access(path, F_OK) == 0;
+}
+
+
+/* Number of images using each block of the store */
+uint32_t *reference_counts(struct store *st, char **names)
+{
+    uint32_t *refs = calloc(st->blocks, sizeof(uint32_t));
+    int i;
+
+    if (refs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+
+    for (i = 0; names[i] != NULL; i++) {
+        struct store_map map;
+        uint32_t b;
+
+        if (store_map_load(st, names[i], &map) < 0) {
+            free(refs);
+            return NULL;
+        }
+        for (b = 0; b < map.blocks; b++)
+            refs[map.block[b]]++;
+        free(map.block);
+    }
+    return refs;
+}
+
+
+int import_image(struct store *st, char *file, char *name)
+{
+    unsigned char data[STORE_BLOCK_BYTES];
+    struct store_map map;
+    uint32_t before = st->blocks;
+    uint32_t b;
+    struct stat sb;
+    FILE *f;
+
+    if (image_exists(st, name)) {
+        fprintf(stderr, "There is already an image %s in the store\n", name);
+        return -1;
+    }
+
+    if ((f = fopen(file, "r")) == NULL || fstat(fileno(f), &sb) < 0) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        if (f != NULL)
+            fclose(f);
+        return -1;
+    }
+    if (store_map_new(&map, sb.st_size) < 0) {
+        fclose(f);
+        return -1;
+    }
+
+    /* A last partial block is padded with zeros, export cuts it again */
+    for (b = 0; b < map.blocks; b++) {
+        size_t n = fread(data, 1, STORE_BLOCK_BYTES, f);
+
+        if (n == 0) {
+            fprintf(stderr, "%s: Could not read block %u\n", file, b);
+            goto error;
+        }
+        memset(data + n, 0, STORE_BLOCK_BYTES - n);
+        if (store_map_write(st, &map, b, data) < 0)
+            goto error;
+    }
+    fclose(f);
+
+    if (store_map_save(st, name, &map) < 0) {
+        free(map.block);
+        return -1;
+    }
+    printf("%s: %u blocks, %u new\n", name, map.blocks, st->blocks - before);
+    free(map.block);
+    return 0;
+
+error:
+    fclose(f);
+    free(map.block);
+    return -1;
+}
+
+
+int export_image(struct store *st, char *name, char *file)
+{
+    unsigned char data[STORE_BLOCK_BYTES];
+    struct store_map map;
+    uint64_t left;
+    uint32_t b;
+    FILE *f;
+
+    if (store_map_load(st, name, &map) < 0)
+        return -1;
+
+    if ((f = fopen(file, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        free(map.block);
+        return -1;
+    }
+
+    left = map.size;
+    for (b = 0; b < map.blocks; b++) {
+        size_t n = left < STORE_BLOCK_BYTES ? left : STORE_BLOCK_BYTES;
+
+        if (store_map_read(st, &map, b, data) < 0) {
+            fclose(f);
+            free(map.block);
+            return -1;
+        }
+        fwrite(data, 1, n, f);
+        left -= n;
+    }
+    free(map.block);
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int clone_image(struct store *st, char *name, char *new_name)
+{
+    struct store_map map;
+    int ret;
+
+    if (image_exists(st, new_name)) {
+        fprintf(stderr, "There is already an image %s in the store\n", new_name);
+        return -1;
+    }
+    if (store_map_load(st, name, &map) < 0)
+        return -1;
+    ret = store_map_save(st, new_name, &map);
+    free(map.block);
+    return ret;
+}
+
+
+int remove_image(struct store *st, char *name)
+{
+    char path[4096];
+
+    if (store_map_path(st, name, path, sizeof(path)) < 0)
+        return -1;
+    if (unlink(path) < 0) {
+        fprintf(stderr, "No image %s in the store\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+
+int list_images(struct store *st)
+{
+    char **names = image_names(st);
+    uint32_t *refs;
+    int i;
+
+    if (names == NULL)
+        return -1;
+    if ((refs = reference_counts(st, names)) == NULL) {
+        free_names(names);
+        return -1;
+    }
+
+    printf("%-24s %10s %7s %7s %7s %7s\n", "Image", "Bytes", "Blocks", "Zero", "Shared", "Own");
+    for (i = 0; names[i] != NULL; i++) {
+        struct store_map map;
+        uint32_t b, zero = 0, shared = 0, own = 0;
+
+        if (store_map_load(st, names[i], &map) < 0)
+            continue;
+        for (b = 0; b < map.blocks; b++) {
+            if (map.block[b] == STORE_ZERO_BLOCK)
+                zero++;
+            else if (refs[map.block[b]] > 1)
+                shared++;
+            else
+                own++;
+        }
+        printf("%-24s %10llu %7u %7u %7u %7u\n", names[i], (unsigned long long)map.size,
+               map.blocks, zero, shared, own);
+        free(map.block);
+    }
+
+    free(refs);
+    free_names(names);
+    return 0;
+}
+
+
+int store_stats(struct store *st)
+{
+    char **names = image_names(st);
+    unsigned long long logical = 0, used = 0, unused = 0;
+    uint32_t *refs;
+    uint32_t b;
+    int i;
+
+    if (names == NULL)
+        return -1;
+    if ((refs = reference_counts(st, names)) == NULL) {
+        free_names(names);
+        return -1;
+    }
+
+    for (b = 0; b < st->blocks; b++) {
+        logical += refs[b];
+        if (b == STORE_ZERO_BLOCK)
+            continue;
+        if (refs[b] > 0)
+            used++;
+        else
+            unused++;
+    }
+    for (i = 0; names[i] != NULL; i++)
+        ;
+
+    printf("Images:          %d\n", i);
+    printf("Image blocks:    %llu (%llu bytes)\n", logical, logical * STORE_BLOCK_BYTES);
+    printf("Stored blocks:   %llu (%llu bytes)\n", used, used * STORE_BLOCK_BYTES);
+    printf("Unused blocks:   %llu, removed by gc\n", unused);
+    printf("Index:           %llu of %llu slots, %zu bytes\n",
+           (unsigned long long)st->index->used, (unsigned long long)st->index->slots, st->index_size);
+    if (used > 0)
+        printf("Deduplication:   %.1f:1\n", (double)logical / used);
+
+    free(refs);
+    free_names(names);
+    return 0;
+}
+
+
+/*
+ * The used blocks are copied in order to a new blocks.dat, the maps are
+ * renumbered and the index is rebuilt. The new maps are written as
+ * NAME.map.gc and synced before blocks.tmp is renamed to blocks.dat, and
+ * only renamed over the maps after that, so a crash at any point leaves
+ * either the old store or what store_recover() can finish.
+ */
+int collect_garbage(struct store *st)
+{
+    unsigned char data[STORE_BLOCK_BYTES];
+    char path[4096], tmp[4096], images[4096], map[4096], map_gc[4096 + 4];
+    char **names = image_names(st);
+    struct store_map *maps;
+    uint32_t *refs = NULL, b, kept = 1;
+    int num, fd = -1, written = 0, i;
+    int ret = 0;
+
+    if (names == NULL)
+        return -1;
+    for (num = 0; names[num] != NULL; num++)
+        ;
+
+    /* All maps are read first, their block numbers are only valid in the old blocks.dat */
+    maps = calloc(num + 1, sizeof(struct store_map));
+    refs = calloc(st->blocks, sizeof(uint32_t));
+    if (maps == NULL || refs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        ret = -1;
+        goto out;
+    }
+    for (i = 0; i < num; i++) {
+        if (store_map_load(st, names[i], &maps[i]) < 0) {
+            num = i;
+            ret = -1;
+            goto out;
+        }
+        for (b = 0; b < maps[i].blocks; b++)
+            refs[maps[i].block[b]]++;
+    }
+
+    store_path(st, "blocks.dat", path, sizeof(path));
+    store_path(st, "blocks.tmp", tmp, sizeof(tmp));
+    store_path(st, "images", images, sizeof(images));
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, store_zero, STORE_BLOCK_BYTES) != STORE_BLOCK_BYTES)
+        goto write_error;
+
+    /* refs becomes the new block number */
+    refs[STORE_ZERO_BLOCK] = STORE_ZERO_BLOCK;
+    for (b = 1; b < st->blocks; b++) {
+        if (refs[b] == 0)
+            continue;
+        if (store_read(st, b, data) < 0) {
+            ret = -1;
+            goto out;
+        }
+        if (write(fd, data, STORE_BLOCK_BYTES) != STORE_BLOCK_BYTES)
+            goto write_error;
+        refs[b] = kept++;
+    }
+    if (fsync(fd) < 0)
+        goto write_error;
+
+    for (written = 0; written < num; written++) {
+        for (b = 0; b < maps[written].blocks; b++)
+            maps[written].block[b] = refs[maps[written].block[b]];
+        store_map_path(st, names[written], map, sizeof(map));
+        snprintf(map_gc, sizeof(map_gc), "%s.gc", map);
+        if (store_map_file(map_gc, &maps[written], true) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+    store_sync_dir(images);
+
+    /* The commit, from here on the new maps are the valid ones */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0 || rename(tmp, path) < 0)
+        goto write_error;
+    store_sync_dir(st->dir);
+    written = 0;
+    printf("%u of %u blocks removed\n", st->blocks - kept, st->blocks);
+
+    close(st->data_fd);
+    st->data_fd = fd;
+    st->blocks = kept;
+    memset(st->cache, 0, STORE_CACHE_BLOCKS * sizeof(struct store_cache));
+    fd = -1;
+
+    for (i = 0; i < num; i++) {
+        store_map_path(st, names[i], map, sizeof(map));
+        snprintf(map_gc, sizeof(map_gc), "%s.gc", map);
+        if (rename(map_gc, map) < 0) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", map, strerror(errno));
+            ret = -1;
+        }
+    }
+    store_sync_dir(images);
+    if (store_reindex(st) < 0)
+        ret = -1;
+    goto out;
+
+write_error:
+    fprintf(stderr, "Could not write to file \"%s\": %s\n", tmp, strerror(errno));
+    ret = -1;
+out:
+    /* Not committed, the old blocks.dat and maps are kept */
+    for (i = 0; i < written; i++) {
+        store_map_path(st, names[i], map, sizeof(map));
+        snprintf(map_gc, sizeof(map_gc), "%s.gc", map);
+        unlink(map_gc);
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(tmp);
+    }
+    for (i = 0; maps != NULL && i < num; i++)
+        free(maps[i].block);
+    free(maps);
+    free(refs);
+    free_names(names);
+    return ret;
+}
+
+
+/* File name without directory and extension */
+void default_name(char *file, char *buff, size_t size)
+{
+    char *base = strrchr(file, '/');
+    char *dot;
+
+    snprintf(buff, size, "%s", base ? base + 1 : file);
+    if ((dot = strrchr(buff, '.')) != NULL && dot != buff)
+        *dot = '\0';
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct store st;
+    char *cmd;
+    int num_args;
+    int ret = 0;
+    int i;
+
+    args.store = "os8.store";
+    args.command = NULL;
+    args.args = NULL;
+    args.num_args = 0;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    cmd = args.command;
+    num_args = args.num_args;
+
+    if (!((0 == strcmp(cmd, "import") && (num_args == 1 || num_args == 2)) ||
+          (0 == strcmp(cmd, "export") && num_args == 2) ||
+          (0 == strcmp(cmd, "clone") && num_args == 2) ||
+          (0 == strcmp(cmd, "rm") && num_args >= 1) ||
+          ((0 == strcmp(cmd, "list") || 0 == strcmp(cmd, "stats") || 0 == strcmp(cmd, "gc")) && num_args == 0))) {
+        fprintf(stderr, "Unknown command or wrong number of arguments: %s\n", cmd);
+        return -1;
+    }
+
+    if (store_open(&st, args.store, 0 == strcmp(cmd, "import")) < 0)
+        return -1;
+
+    if (0 == strcmp(cmd, "import")) {
+        char name[256];
+
+        if (num_args == 2)
+            snprintf(name, sizeof(name), "%s", args.args[1]);
+        else
+            default_name(args.args[0], name, sizeof(name));
+        ret = import_image(&st, args.args[0], name);
+    } else if (0 == strcmp(cmd, "export")) {
+        ret = export_image(&st, args.args[0], args.args[1]);
+    } else if (0 == strcmp(cmd, "clone")) {
+        ret = clone_image(&st, args.args[0], args.args[1]);
+    } else if (0 == strcmp(cmd, "rm")) {
+        for (i = 0; i < num_args; i++)
+            if (remove_image(&st, args.args[i]) < 0)
+                ret = -1;
+    } else if (0 == strcmp(cmd, "list")) {
+        ret = list_images(&st);
+    } else if (0 == strcmp(cmd, "stats")) {
+        ret = store_stats(&st);
+    } else if (0 == strcmp(cmd, "gc")) {
+        ret = collect_garbage(&st);
+    }
+
+    store_close(&st);
+    return ret;
+}
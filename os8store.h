@@ -0,0 +1,579 @@
+/*
+ * Deduplicated store of OS/8 disk images
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * A store is a directory. Every distinct 256-word block (512 bytes in the
+ * SIMH/SerialDisk format) is kept once in blocks.dat, block 0 there is
+ * always the all zero block. index.dat is an open addressing hash table
+ * from block content to block number, used through mmap. It is only a
+ * cache, it is rebuilt from blocks.dat if it is missing or out of date.
+ *
+ * An image is images/NAME.map: its size and one block number per image
+ * block. Blocks are never changed once stored, a write to an image block
+ * stores the new content and changes the map, so a clone is just a copy
+ * of the map. Reads go through a small direct mapped block cache.
+ *
+ * A SerialDisk service can serve an image from the store with
+ * store_map_load(), store_map_read() and store_map_write().
+ */
+
+#ifndef OS8STORE_H
+#define OS8STORE_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define STORE_BLOCK_BYTES   512
+#define STORE_ZERO_BLOCK    0
+#define STORE_INDEX_SLOTS   4096
+#define STORE_CACHE_BLOCKS  256
+
+#define STORE_INDEX_MAGIC   "OS8IDX1"
+#define STORE_MAP_MAGIC     "OS8MAP1"
+
+
+struct store_slot {
+    uint64_t hash;
+    uint32_t block;         /* STORE_ZERO_BLOCK for a free slot */
+    uint32_t pad;
+};
+
+
+struct store_index {
+    char magic[8];
+    uint64_t slots;         /* Power of two */
+    uint64_t used;
+    uint64_t blocks;        /* Blocks in blocks.dat when the index was written */
+    struct store_slot slot[];
+};
+
+
+struct store_cache {
+    uint32_t block;
+    bool valid;
+    unsigned char data[STORE_BLOCK_BYTES];
+};
+
+
+struct store {
+    char *dir;
+    int data_fd;
+    uint32_t blocks;
+    int index_fd;
+    struct store_index *index;
+    size_t index_size;
+    struct store_cache *cache;
+};
+
+
+struct store_map {
+    uint64_t size;          /* Image size in bytes */
+    uint32_t blocks;
+    uint32_t *block;
+};
+
+
+struct store_map_header {
+    char magic[8];
+    uint64_t size;
+};
+
+
+static const unsigned char store_zero[STORE_BLOCK_BYTES];
+
+
+static void store_path(struct store *st, const char *name, char *buff, size_t size)
+{
+    snprintf(buff, size, "%s/%s", st->dir, name);
+}
+
+
+/* 64-bit multiply and rotate hash over the block, eight bytes at a time */
+static inline uint64_t store_hash(const unsigned char *data)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    int i;
+
+    for (i = 0; i < STORE_BLOCK_BYTES; i += 8) {
+        uint64_t w;
+
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h = (h << 29) | (h >> 35);
+    }
+    return h ^ (h >> 32);
+}
+
+
+static int store_read(struct store *st, uint32_t block, unsigned char *data)
+{
+    struct store_cache *c = &st->cache[block % STORE_CACHE_BLOCKS];
+
+    if (block == STORE_ZERO_BLOCK) {
+        memset(data, 0, STORE_BLOCK_BYTES);
+        return 0;
+    }
+    if (block >= st->blocks) {
+        fprintf(stderr, "%s: Block %u is not in the store\n", st->dir, block);
+        return -1;
+    }
+
+    if (!c->valid || c->block != block) {
+        if (pread(st->data_fd, c->data, STORE_BLOCK_BYTES, (off_t)block * STORE_BLOCK_BYTES) != STORE_BLOCK_BYTES) {
+            fprintf(stderr, "%s: Could not read block %u: %s\n", st->dir, block, strerror(errno));
+            c->valid = false;
+            return -1;
+        }
+        c->block = block;
+        c->valid = true;
+    }
+    memcpy(data, c->data, STORE_BLOCK_BYTES);
+    return 0;
+}
+
+
+static void store_index_insert(struct store_index *idx, uint64_t hash, uint32_t block)
+{
+    uint64_t i = hash & (idx->slots - 1);
+
+    while (idx->slot[i].block != STORE_ZERO_BLOCK)
+        i = (i + 1) & (idx->slots - 1);
+    idx->slot[i].hash = hash;
+    idx->slot[i].block = block;
+    idx->used++;
+}
+
+
+/* Map a new, empty index of SLOTS slots in place of the current one */
+static int store_index_create(struct store *st, uint64_t slots)
+{
+    char path[4096], tmp[4096];
+    size_t size = sizeof(struct store_index) + slots * sizeof(struct store_slot);
+    struct store_index *idx;
+    int fd;
+
+    store_path(st, "index.dat", path, sizeof(path));
+    store_path(st, "index.tmp", tmp, sizeof(tmp));
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", tmp, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    idx = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (idx == MAP_FAILED) {
+        fprintf(stderr, "Error from mmap: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    memcpy(idx->magic, STORE_INDEX_MAGIC, sizeof(idx->magic));
+    idx->slots = slots;
+
+    /* Move the entries over before the old index goes */
+    if (st->index != NULL) {
+        uint64_t i;
+
+        for (i = 0; i < st->index->slots; i++)
+            if (st->index->slot[i].block != STORE_ZERO_BLOCK)
+                store_index_insert(idx, st->index->slot[i].hash, st->index->slot[i].block);
+        idx->blocks = st->index->blocks;
+        munmap(st->index, st->index_size);
+        close(st->index_fd);
+    }
+
+    if (rename(tmp, path) < 0) {
+        fprintf(stderr, "Could not rename \"%s\": %s\n", tmp, strerror(errno));
+        munmap(idx, size);
+        close(fd);
+        st->index = NULL;
+        return -1;
+    }
+    st->index = idx;
+    st->index_size = size;
+    st->index_fd = fd;
+    return 0;
+}
+
+
+/* Hash all of blocks.dat again */
+static int store_reindex(struct store *st)
+{
+    unsigned char data[STORE_BLOCK_BYTES];
+    uint64_t slots = STORE_INDEX_SLOTS;
+    uint32_t b;
+
+    while (slots < 2 * (uint64_t)st->blocks)
+        slots *= 2;
+
+    if (st->index != NULL) {
+        munmap(st->index, st->index_size);
+        close(st->index_fd);
+        st->index = NULL;
+    }
+    if (store_index_create(st, slots) < 0)
+        return -1;
+
+    for (b = 1; b < st->blocks; b++) {
+        if (store_read(st, b, data) < 0)
+            return -1;
+        store_index_insert(st->index, store_hash(data), b);
+    }
+    st->index->blocks = st->blocks;
+    return 0;
+}
+
+
+static void store_sync_dir(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+
+/*
+ * Finish or undo a garbage collection that was stopped half way. It writes
+ * the renumbered maps as images/NAME.map.gc and renames blocks.tmp to
+ * blocks.dat when all of them are on disk. With blocks.tmp still there the
+ * old blocks.dat and maps are valid and the .gc maps are removed, without
+ * it the new blocks.dat is in place and the .gc maps replace the old ones.
+ */
+static int store_recover(struct store *st)
+{
+    char images[4096], from[4096 + 256], to[4096 + 256];
+    bool commit;
+    int found, total = 0, ret = 0;
+
+    store_path(st, "blocks.tmp", from, sizeof(from));
+    commit = access(from, F_OK) < 0;
+    if (!commit)
+        unlink(from);
+
+    /* Again until nothing is left, renames while reading may hide names */
+    store_path(st, "images", images, sizeof(images));
+    do {
+        struct dirent *de;
+        DIR *d;
+
+        if ((d = opendir(images)) == NULL)
+            return 0;
+        found = 0;
+        while ((de = readdir(d)) != NULL) {
+            size_t len = strlen(de->d_name);
+
+            if (len <= 7 || strcmp(de->d_name + len - 7, ".map.gc") != 0)
+                continue;
+            snprintf(from, sizeof(from), "%s/%s", images, de->d_name);
+            snprintf(to, sizeof(to), "%s/%.*s", images, (int)(len - 3), de->d_name);
+            if (commit ? rename(from, to) : unlink(from)) {
+                fprintf(stderr, "Could not recover \"%s\": %s\n", from, strerror(errno));
+                ret = -1;
+                continue;
+            }
+            found++;
+        }
+        closedir(d);
+        total += found;
+    } while (found > 0);
+
+    if (total > 0) {
+        store_sync_dir(images);
+        fprintf(stderr, "%s: %s an interrupted garbage collection\n", st->dir, commit ? "Finished" : "Undid");
+    }
+    return ret;
+}
+
+
+static int store_open(struct store *st, char *dir, bool create)
+{
+    char path[4096];
+    struct stat sb;
+
+    memset(st, 0, sizeof(*st));
+    st->dir = dir;
+    st->data_fd = -1;
+    st->index_fd = -1;
+
+    if (create && mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create store \"%s\": %s\n", dir, strerror(errno));
+        return -1;
+    }
+    store_path(st, "images", path, sizeof(path));
+    if (create && mkdir(path, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    store_path(st, "blocks.dat", path, sizeof(path));
+    st->data_fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (st->data_fd < 0) {
+        fprintf(stderr, "Could not open store \"%s\": %s\n", dir, strerror(errno));
+        return -1;
+    }
+    /* One user of a store at a time */
+    if (flock(st->data_fd, LOCK_EX | LOCK_NB) < 0) {
+        fprintf(stderr, "Store \"%s\" is in use\n", dir);
+        close(st->data_fd);
+        return -1;
+    }
+    if (store_recover(st) < 0) {
+        close(st->data_fd);
+        return -1;
+    }
+
+    fstat(st->data_fd, &sb);
+    if (sb.st_size == 0 &&
+        pwrite(st->data_fd, store_zero, STORE_BLOCK_BYTES, 0) != STORE_BLOCK_BYTES) {
+        fprintf(stderr, "Could not write \"%s\": %s\n", path, strerror(errno));
+        close(st->data_fd);
+        return -1;
+    }
+    /* A partly written last block is dropped */
+    st->blocks = sb.st_size ? sb.st_size / STORE_BLOCK_BYTES : 1;
+
+    st->cache = calloc(STORE_CACHE_BLOCKS, sizeof(struct store_cache));
+    if (st->cache == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        close(st->data_fd);
+        return -1;
+    }
+
+    store_path(st, "index.dat", path, sizeof(path));
+    st->index_fd = open(path, O_RDWR);
+    if (st->index_fd >= 0 && fstat(st->index_fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(struct store_index)) {
+        st->index_size = sb.st_size;
+        st->index = mmap(NULL, st->index_size, PROT_READ | PROT_WRITE, MAP_SHARED, st->index_fd, 0);
+        if (st->index == MAP_FAILED)
+            st->index = NULL;
+    }
+
+    if (st->index == NULL || memcmp(st->index->magic, STORE_INDEX_MAGIC, sizeof(st->index->magic)) != 0 ||
+        st->index_size != sizeof(struct store_index) + st->index->slots * sizeof(struct store_slot) ||
+        st->index->blocks != st->blocks) {
+        if (st->index_fd >= 0 && st->index == NULL)
+            close(st->index_fd);
+        if (st->blocks > 1)
+            fprintf(stderr, "%s: Rebuilding the index\n", dir);
+        if (store_reindex(st) < 0) {
+            close(st->data_fd);
+            free(st->cache);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static void store_close(struct store *st)
+{
+    if (st->index != NULL) {
+        msync(st->index, st->index_size, MS_SYNC);
+        munmap(st->index, st->index_size);
+        close(st->index_fd);
+    }
+    fsync(st->data_fd);
+    close(st->data_fd);
+    free(st->cache);
+}
+
+
+/* Block number of DATA, stored if it is new. Returns -1 on errors. */
+static int64_t store_put(struct store *st, const unsigned char *data)
+{
+    unsigned char old[STORE_BLOCK_BYTES];
+    struct store_index *idx = st->index;
+    uint64_t hash, i;
+    uint32_t block;
+
+    if (memcmp(data, store_zero, STORE_BLOCK_BYTES) == 0)
+        return STORE_ZERO_BLOCK;
+
+    hash = store_hash(data);
+    for (i = hash & (idx->slots - 1); idx->slot[i].block != STORE_ZERO_BLOCK; i = (i + 1) & (idx->slots - 1)) {
+        if (idx->slot[i].hash != hash)
+            continue;
+        if (store_read(st, idx->slot[i].block, old) < 0)
+            return -1;
+        if (memcmp(old, data, STORE_BLOCK_BYTES) == 0)
+            return idx->slot[i].block;
+    }
+
+    block = st->blocks;
+    if (pwrite(st->data_fd, data, STORE_BLOCK_BYTES, (off_t)block * STORE_BLOCK_BYTES) != STORE_BLOCK_BYTES) {
+        fprintf(stderr, "%s: Could not write block %u: %s\n", st->dir, block, strerror(errno));
+        return -1;
+    }
+    st->blocks++;
+
+    /* Keep the table at most half full */
+    if (2 * (idx->used + 1) > idx->slots) {
+        if (store_index_create(st, 2 * idx->slots) < 0)
+            return -1;
+        idx = st->index;
+    }
+    store_index_insert(idx, hash, block);
+    idx->blocks = st->blocks;
+    return block;
+}
+
+
+static int store_map_path(struct store *st, const char *name, char *buff, size_t size)
+{
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL) {
+        fprintf(stderr, "Invalid image name: %s\n", name);
+        return -1;
+    }
+    snprintf(buff, size, "%s/images/%s.map", st->dir, name);
+    return 0;
+}
+
+
+/* An empty image of SIZE bytes, all blocks zero */
+static int store_map_new(struct store_map *map, uint64_t size)
+{
+    map->size = size;
+    map->blocks = (size + STORE_BLOCK_BYTES - 1) / STORE_BLOCK_BYTES;
+    map->block = calloc(map->blocks ? map->blocks : 1, sizeof(uint32_t));
+    if (map->block == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+static int store_map_load(struct store *st, const char *name, struct store_map *map)
+{
+    struct store_map_header h;
+    char path[4096];
+    uint32_t i;
+    FILE *f;
+
+    if (store_map_path(st, name, path, sizeof(path)) < 0)
+        return -1;
+    if ((f = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "No image %s in the store\n", name);
+        return -1;
+    }
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, STORE_MAP_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "%s: Not an image map\n", path);
+        fclose(f);
+        return -1;
+    }
+    if (store_map_new(map, h.size) < 0) {
+        fclose(f);
+        return -1;
+    }
+    if (fread(map->block, sizeof(uint32_t), map->blocks, f) != map->blocks) {
+        fprintf(stderr, "%s: Map is too short\n", path);
+        goto error;
+    }
+    fclose(f);
+
+    for (i = 0; i < map->blocks; i++) {
+        if (map->block[i] >= st->blocks) {
+            fprintf(stderr, "%s: Block %u is not in the store\n", path, map->block[i]);
+            free(map->block);
+            return -1;
+        }
+    }
+    return 0;
+
+error:
+    fclose(f);
+    free(map->block);
+    return -1;
+}
+
+
+/* MAP as a file at PATH, on disk before it returns if SYNC */
+static int store_map_file(const char *path, struct store_map *map, bool sync)
+{
+    struct store_map_header h;
+    bool bad;
+    FILE *f;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STORE_MAP_MAGIC, sizeof(h.magic));
+    h.size = map->size;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(map->block, sizeof(uint32_t), map->blocks, f);
+    bad = fflush(f) != 0 || (sync && fsync(fileno(f)) < 0);
+    if (fclose(f) != 0 || bad) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Written to a temporary file and renamed, a map is always complete */
+static int store_map_save(struct store *st, const char *name, struct store_map *map)
+{
+    char path[4096], tmp[4096 + 4];
+
+    if (store_map_path(st, name, path, sizeof(path)) < 0)
+        return -1;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    if (store_map_file(tmp, map, false) < 0)
+        return -1;
+    if (rename(tmp, path) < 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int store_map_read(struct store *st, struct store_map *map, uint32_t n, unsigned char *data)
+{
+    if (n >= map->blocks) {
+        fprintf(stderr, "Block %u is past the end of the image\n", n);
+        return -1;
+    }
+    return store_read(st, map->block[n], data);
+}
+
+
+static int store_map_write(struct store *st, struct store_map *map, uint32_t n, const unsigned char *data)
+{
+    int64_t block;
+
+    if (n >= map->blocks) {
+        fprintf(stderr, "Block %u is past the end of the image\n", n);
+        return -1;
+    }
+    if ((block = store_put(st, data)) < 0)
+        return -1;
+    map->block[n] = block;
+    return 0;
+}
+
+#endif
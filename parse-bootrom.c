@@ -5,7 +5,12 @@
  *
  */
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bintape.h"
 
 int read_rom_file (char *filename, int *buff)
 {
@@ -31,6 +36,67 @@ int read_rom_file (char *filename, int *buff)
 }
 
 
+/*
+ * Export of the deposited programs. The deposits up to a start command
+ * make one program, it gets its own tape PREFIXn.bin (or .rim).
+ */
+struct export {
+	char *prefix;
+	bool rim;
+	int num;
+	int words;
+	int first;
+	int last;
+	FILE *f;
+	struct bintape tape;
+};
+
+
+int export_word(struct export *e, int field, int addr, int data)
+{
+	if (e->f == NULL) {
+		char file[4096];
+
+		snprintf(file, sizeof(file), "%s%d.%s", e->prefix, e->num + 1, e->rim ? "rim" : "bin");
+		e->f = fopen(file, "w");
+		if (e->f == NULL) {
+			fprintf(stderr, "Could not write to file: %s\n", file);
+			return -1;
+		}
+		bintape_begin(&e->tape, e->f, e->rim, 16);
+		e->words = 0;
+		e->first = field << 12 | addr;
+	}
+	e->last = field << 12 | addr;
+	e->words++;
+	return bintape_word(&e->tape, field, addr, data);
+}
+
+
+/* Close the tape of the current program, START is -1 if it has none */
+int export_end(struct export *e, int start)
+{
+	if (e->f == NULL)
+		return 0;
+
+	bintape_end(&e->tape);
+	if (fclose(e->f) != 0) {
+		fprintf(stderr, "Could not write tape %d\n", e->num + 1);
+		return -1;
+	}
+	e->f = NULL;
+	e->num++;
+
+	fprintf(stderr, "%s%d.%s: %d words %5.5o-%5.5o, ", e->prefix, e->num, e->rim ? "rim" : "bin",
+		e->words, e->first, e->last);
+	if (start < 0)
+		fprintf(stderr, "no start\n");
+	else
+		fprintf(stderr, "start %5.5o\n", start);
+	return 0;
+}
+
+
 int main(int argc, char *argv[])
 {
 	int i=0;
@@ -38,18 +104,36 @@ int main(int argc, char *argv[])
 	int buff_prom2[256];
 	int addr = 0;
 	int ext_addr = 0;
+	int ext_data = 0;
+	struct export export = { NULL };
+	int opt;
 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s [boot ROM #1 filename] [boot ROM #2 filename]\n", argv[0]);
+	while ((opt = getopt(argc, argv, "o:r")) != -1) {
+		switch (opt) {
+		case 'o':
+			export.prefix = optarg;
+			break;
+		case 'r':
+			export.rim = true;
+			break;
+		default:
+			argc = 0;
+		}
+	}
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "Usage: %s [-o prefix [-r]] [boot ROM #1 filename] [boot ROM #2 filename]\n", argv[0]);
 		fprintf(stderr, "Takes two PDP-8A M8317 boot ROM files, parse them and dump the content\n");
+		fprintf(stderr, "With -o every program deposited before a start is written as a BIN tape\n");
+		fprintf(stderr, "prefixN.bin, or a RIM tape prefixN.rim with -r\n");
 		return -1;
 	}
 
-	if (read_rom_file(argv[1], buff_prom1) < 0) {
+	if (read_rom_file(argv[optind], buff_prom1) < 0) {
 		return -1;
 	}
 
-	if (read_rom_file(argv[2], buff_prom2) < 0) {
+	if (read_rom_file(argv[optind + 1], buff_prom2) < 0) {
 		return -1;
 	}
 
@@ -66,12 +150,27 @@ int main(int argc, char *argv[])
 							 opr & 1 ? 'S': ' ');
 
 		if (opr & 8) addr = data;
-		if (opr & 4) ext_addr = data & 7;
+		if (opr & 4) {
+			ext_addr = data & 7;
+			ext_data = data;
+		}
 		if (opr & 2 ) {
-			printf("%1.1o%4.4o ", ext_addr, addr++);
+			printf("%1.1o%4.4o ", ext_addr, addr);
+			if (export.prefix != NULL && export_word(&export, ext_addr, addr, data) < 0)
+				return -1;
+			addr = (addr + 1) & 07777;
 		} else {
 			printf("      ");
 		}
 		printf(": %4.4o\n", data);
+
+		/* The start field is the instruction field, the high bits of E */
+		if ((opr & 1) && export.prefix != NULL &&
+		    export_end(&export, (ext_data >> 3 & 7) << 12 | addr) < 0)
+			return -1;
 	}
+
+	if (export.prefix != NULL && export_end(&export, -1) < 0)
+		return -1;
+	return 0;
 }
@@ -0,0 +1,540 @@
+/*
+ * Streaming pipeline core for the PDP-8 papertape tools
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * A pipeline is a source, any number of stages and a sink. Every element
+ * runs in a thread of its own and they are connected by bounded single
+ * producer, single consumer queues of fixed size batches. Batches are
+ * filled and drained in place, the queue only moves two indexes.
+ *
+ * The papertape decoders are kept here as plain state machines on a
+ * struct, so they can be used outside a pipeline too. capture-papertape
+ * uses them that way.
+ *
+ * Build with -pthread, and define _GNU_SOURCE before any include for
+ * pthread_setaffinity_np().
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+#define PL_BATCH_SIZE   4096
+#define PL_QUEUE_SLOTS  64
+
+
+struct pl_batch {
+    size_t len;
+    bool eof;
+    unsigned char data[PL_BATCH_SIZE];
+};
+
+
+struct pl_queue {
+    struct pl_batch slot[PL_QUEUE_SLOTS];
+    atomic_size_t head;         /* next slot to fill, only moved by the producer */
+    atomic_size_t tail;         /* next slot to drain, only moved by the consumer */
+    atomic_int waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+
+static inline void pl_queue_init(struct pl_queue *q)
+{
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->waiting, 0);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+
+static inline bool pl_queue_full(struct pl_queue *q)
+{
+    return atomic_load_explicit(&q->head, memory_order_relaxed) -
+           atomic_load_explicit(&q->tail, memory_order_acquire) == PL_QUEUE_SLOTS;
+}
+
+
+static inline bool pl_queue_empty(struct pl_queue *q)
+{
+    return atomic_load_explicit(&q->head, memory_order_acquire) ==
+           atomic_load_explicit(&q->tail, memory_order_relaxed);
+}
+
+
+/*
+ * Block on a full or an empty queue. The waiting count tells the other
+ * side that it has to signal, the wait is bounded so a wakeup that slips
+ * between the check and the wait only costs a few milliseconds.
+ */
+static inline void pl_queue_wait(struct pl_queue *q, bool (*blocked)(struct pl_queue *))
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    atomic_fetch_add(&q->waiting, 1);
+    if (blocked(q))
+        pthread_cond_timedwait(&q->cond, &q->lock, &ts);
+    atomic_fetch_sub(&q->waiting, 1);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static inline void pl_queue_wake(struct pl_queue *q)
+{
+    if (atomic_load(&q->waiting)) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+
+/* Producer side, get the next free batch and hand it over when filled */
+static inline struct pl_batch *pl_queue_reserve(struct pl_queue *q)
+{
+    while (pl_queue_full(q))
+        pl_queue_wait(q, pl_queue_full);
+
+    return &q->slot[atomic_load_explicit(&q->head, memory_order_relaxed) % PL_QUEUE_SLOTS];
+}
+
+
+static inline void pl_queue_commit(struct pl_queue *q)
+{
+    atomic_fetch_add_explicit(&q->head, 1, memory_order_release);
+    pl_queue_wake(q);
+}
+
+
+/* Consumer side, get the oldest batch and give it back when done */
+static inline struct pl_batch *pl_queue_peek(struct pl_queue *q)
+{
+    while (pl_queue_empty(q))
+        pl_queue_wait(q, pl_queue_empty);
+
+    return &q->slot[atomic_load_explicit(&q->tail, memory_order_relaxed) % PL_QUEUE_SLOTS];
+}
+
+
+static inline void pl_queue_release(struct pl_queue *q)
+{
+    atomic_fetch_add_explicit(&q->tail, 1, memory_order_release);
+    pl_queue_wake(q);
+}
+
+
+/*
+ * Output buffer for stages and decoders, flush() is called when it is full
+ * and must leave room for more.
+ */
+struct pl_out {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+    void (*flush)(struct pl_out *out);
+    void *ctx;
+};
+
+
+static inline void pl_put(struct pl_out *out, unsigned char c)
+{
+    out->data[out->len++] = c;
+    if (out->len == out->size)
+        out->flush(out);
+}
+
+
+static inline void pl_write(struct pl_out *out, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len--)
+        pl_put(out, *p++);
+}
+
+
+/* Define control codes and bit masks */
+#define TAPE_LEAD           0x80
+#define TAPE_TRAIL          0x80
+#define TAPE_ORIGIN         0x40
+#define TAPE_FIELD          0xC0
+#define TAPE_CONTROL_MASK   0xC0
+
+
+enum tape_state {
+    TS_START = 0,
+    TS_LEAD_IN,
+    TS_DATA_H,
+    TS_DATA_L,
+    TS_TRAIL,
+    TS_DONE
+};
+
+
+/*
+ * Decoder state, for the raw, rim and bin decoders that capture-papertape
+ * and tape-pipe both use. verdict is set to 1 or -1 when a bin checksum
+ * has been verified.
+ */
+struct tape_decoder {
+    enum tape_state state;
+    int leadin_count;
+    int csum;
+    int c1;
+    int c2;
+    int strip_char;
+    int verdict;
+    int calc;
+    int recv;
+};
+
+
+static inline void tape_decoder_init(struct tape_decoder *d, int strip_char)
+{
+    memset(d, 0, sizeof(*d));
+    d->state = TS_START;
+    d->strip_char = strip_char;
+}
+
+
+/* Everything, but the first char that differs from strip_char is replaced by 16 of it */
+static inline void tape_raw(struct tape_decoder *d, struct pl_out *out, unsigned char c)
+{
+    int i = 16;
+
+    if (d->state == TS_START) {
+        if (d->strip_char != c) {
+            if (d->strip_char != -1) {
+                while (i--)
+                    pl_put(out, d->strip_char);
+            } else {
+                pl_put(out, c);
+            }
+            d->state = TS_LEAD_IN;
+        }
+    } else {
+        pl_put(out, c);
+    }
+}
+
+
+static inline void tape_rim(struct tape_decoder *d, struct pl_out *out, unsigned char c)
+{
+    switch (d->state) {
+    case TS_START:
+        if (c == TAPE_LEAD)
+            d->leadin_count++;
+        d->state = TS_LEAD_IN;
+        break;
+
+    case TS_LEAD_IN:
+        if (c == TAPE_LEAD) {
+            d->leadin_count++;
+        } else if ((c & TAPE_CONTROL_MASK) == TAPE_ORIGIN && d->leadin_count > 7) {
+            while (d->leadin_count--)
+                pl_put(out, TAPE_LEAD);
+            pl_put(out, c);
+            d->state = TS_DATA_H;
+        } else {
+            d->leadin_count = 0;
+        }
+        break;
+
+    case TS_DATA_H:
+        if (c == TAPE_TRAIL)
+            d->state = TS_TRAIL;
+        pl_put(out, c);
+        break;
+
+    case TS_TRAIL:
+        if (c != TAPE_TRAIL)
+            d->state = TS_DONE;
+        else
+            pl_put(out, c);
+        break;
+
+    case TS_DATA_L:
+    case TS_DONE:
+        break;
+    }
+}
+
+
+static inline void tape_bin(struct tape_decoder *d, struct pl_out *out, unsigned char c)
+{
+    switch (d->state) {
+    case TS_START:
+        if (c == TAPE_LEAD)
+            d->leadin_count++;
+        d->state = TS_LEAD_IN;
+        break;
+
+    case TS_LEAD_IN:
+        if (c == TAPE_LEAD) {
+            d->leadin_count++;
+        } else if (((c & TAPE_CONTROL_MASK) == TAPE_ORIGIN || (c & TAPE_CONTROL_MASK) == TAPE_FIELD) &&
+                   d->leadin_count > 7) {
+            while (d->leadin_count--)
+                pl_put(out, TAPE_LEAD);
+
+            /* Field settings are not part of the checksum */
+            if ((c & TAPE_CONTROL_MASK) == TAPE_ORIGIN)
+                d->csum += c;
+
+            pl_put(out, c);
+            d->state = TS_DATA_L;
+        } else {
+            d->leadin_count = 0;
+        }
+        break;
+
+    case TS_DATA_L:
+        pl_put(out, c);
+
+        if (!(c & 0x80)) {
+            d->csum += c;
+            d->c2 = d->c1;
+            d->c1 = c;
+        }
+
+        if (c == TAPE_TRAIL) {
+            d->recv = (d->c2 & 0x3f) << 6 | (d->c1 & 0x3f);
+            d->csum = (d->csum - d->c1 - d->c2) & 0xfff;
+            d->calc = d->csum;
+            d->verdict = d->calc == d->recv ? 1 : -1;
+            d->state = TS_TRAIL;
+        }
+        break;
+
+    case TS_TRAIL:
+        if (c != TAPE_TRAIL)
+            d->state = TS_DONE;
+        else
+            pl_put(out, c);
+        break;
+
+    case TS_DATA_H:
+    case TS_DONE:
+        break;
+    }
+}
+
+
+/*
+ * A pipeline element. Sources implement read(), stages and sinks
+ * implement process() and write their result to out, which is connected
+ * to the next queue. close() is called at end of data and may still
+ * write to out. priv is freed after close().
+ */
+struct pl_stage {
+    const char *name;
+    char *arg;
+    int cpu;
+    void *priv;
+    int (*open)(struct pl_stage *st);
+    ssize_t (*read)(struct pl_stage *st, unsigned char *buff, size_t size);
+    void (*process)(struct pl_stage *st, const unsigned char *data, size_t len);
+    void (*close)(struct pl_stage *st);
+
+    struct pl_queue *in;
+    struct pl_queue *next;
+    struct pl_batch *batch;
+    struct pl_out out;
+    pthread_t thread;
+    atomic_bool *stop;          /* Shared by all stages, see pl_stop() */
+};
+
+
+/*
+ * Any stage can end the pipeline, e.g. at the end of a tape. The source
+ * stops reading, and what it has read still goes through to the sink.
+ */
+static inline void pl_stop(struct pl_stage *st)
+{
+    atomic_store(st->stop, true);
+}
+
+
+static inline void pl_stage_flush(struct pl_out *out)
+{
+    struct pl_stage *st = out->ctx;
+
+    if (out->len == 0)
+        return;
+
+    st->batch->len = out->len;
+    st->batch->eof = false;
+    pl_queue_commit(st->next);
+
+    st->batch = pl_queue_reserve(st->next);
+    out->data = st->batch->data;
+    out->len = 0;
+}
+
+
+static inline void *pl_stage_run(void *arg)
+{
+    struct pl_stage *st = arg;
+
+    if (st->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(st->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(stderr, "%s: Could not run on cpu %d\n", st->name, st->cpu);
+    }
+
+    if (st->read) {
+        ssize_t n;
+
+        /* Sources read straight into the batch */
+        while (!atomic_load(st->stop) && (n = st->read(st, st->batch->data, PL_BATCH_SIZE)) > 0) {
+            st->out.len = n;
+            pl_stage_flush(&st->out);
+        }
+    } else {
+        for (;;) {
+            struct pl_batch *b = pl_queue_peek(st->in);
+
+            if (b->eof) {
+                pl_queue_release(st->in);
+                break;
+            }
+            st->process(st, b->data, b->len);
+            pl_queue_release(st->in);
+
+            if (st->next)
+                pl_stage_flush(&st->out);
+        }
+    }
+
+    if (st->close)
+        st->close(st);
+    free(st->priv);
+    st->priv = NULL;
+
+    if (st->next) {
+        pl_stage_flush(&st->out);
+        st->batch->len = 0;
+        st->batch->eof = true;
+        pl_queue_commit(st->next);
+    }
+    return NULL;
+}
+
+
+/* Close the first NUM stages, that never ran, and end the data for those after them */
+static inline void pl_abort(struct pl_stage *stages, int num)
+{
+    int i;
+
+    if (num == 0)
+        return;
+
+    atomic_store(stages[0].stop, true);
+    for (i = 0; i < num; i++) {
+        if (stages[i].close)
+            stages[i].close(&stages[i]);
+        free(stages[i].priv);
+        stages[i].priv = NULL;
+    }
+
+    if (stages[num - 1].next) {
+        stages[num - 1].batch->len = 0;
+        stages[num - 1].batch->eof = true;
+        pl_queue_commit(stages[num - 1].next);
+    }
+}
+
+
+/*
+ * Open, connect and run all stages, returns when the sink has seen end of
+ * data. The threads are started from the sink back to the source, so if
+ * one can't be started only the ones after it run, and they get an end of
+ * data to finish on.
+ */
+static inline int pl_run(struct pl_stage *stages, int num)
+{
+    struct pl_queue *queues;
+    atomic_bool stop;
+    int i, started;
+
+    if (num < 2) {
+        fprintf(stderr, "A pipeline needs a source and a sink\n");
+        return -1;
+    }
+
+    if ((queues = calloc(num - 1, sizeof(struct pl_queue))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    /* Connected before open, so close() can write to out on an abort too */
+    atomic_init(&stop, false);
+    for (i = 0; i < num; i++) {
+        struct pl_stage *st = &stages[i];
+
+        st->stop = &stop;
+        st->in = i > 0 ? &queues[i - 1] : NULL;
+        st->next = i < num - 1 ? &queues[i] : NULL;
+        if (st->next) {
+            pl_queue_init(st->next);
+            st->batch = pl_queue_reserve(st->next);
+            st->out.data = st->batch->data;
+            st->out.len = 0;
+            st->out.size = PL_BATCH_SIZE;
+            st->out.flush = pl_stage_flush;
+            st->out.ctx = st;
+        }
+    }
+
+    for (i = 0; i < num; i++) {
+        if (stages[i].open && stages[i].open(&stages[i]) < 0) {
+            free(stages[i].priv);
+            stages[i].priv = NULL;
+            pl_abort(stages, i);
+            free(queues);
+            return -1;
+        }
+    }
+
+    for (started = num; started > 0; started--) {
+        if (pthread_create(&stages[started - 1].thread, NULL, pl_stage_run, &stages[started - 1]) != 0) {
+            fprintf(stderr, "Could not start thread for %s\n", stages[started - 1].name);
+            pl_abort(stages, started);
+            break;
+        }
+    }
+
+    for (i = started; i < num; i++)
+        pthread_join(stages[i].thread, NULL);
+
+    free(queues);
+    return started > 0 ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Static user level tracepoints for the PDP-8 tools
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * The probes use the sys/sdt.h (systemtap/USDT) macros when the header
+ * is available, a probe is then a single nop in the code and costs
+ * nothing until a tracer attaches. Without sys/sdt.h, or when built with
+ * -DNO_PROBES, the probes compile to nothing.
+ *
+ * All probes use the provider "pdp8", list them with:
+ *
+ *     bpftrace -l 'usdt:./capture-papertape:*'
+ *
+ * and trace e.g. the size of every read with:
+ *
+ *     bpftrace -e 'usdt:./capture-papertape:pdp8:rx_read { @[arg1] = count(); }'
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#define PROBE1(name, a)             DTRACE_PROBE1(pdp8, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(pdp8, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(pdp8, name, a, b, c)
+#define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(pdp8, name, a, b, c, d)
+#else
+#define PROBE1(name, a)             do { (void)(a); } while (0)
+#define PROBE2(name, a, b)          do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c)       do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d)    do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
+#endif
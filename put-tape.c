@@ -10,13 +10,18 @@
 #include <argp.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 #include <stdbool.h>
 
+#include "flightrec.h"
+#include "probes.h"
+
 
 const char *argp_program_version =
     "put-tape 0.99";
@@ -28,7 +33,10 @@ const char *argp_program_bug_address =
 /* Program documentation. */
 static char doc[] =
     "Program for sending papertapes, takes input from stdin or file and sends it on a serial port." \
-    "Default is 9600 8N1 on device /dev/ttyUSB0.";
+    "Default is 9600 8N1 on device /dev/ttyUSB0.\v" \
+    "A gzip, zstd or zip file is recognised by its first bytes and sent uncompressed, gzip, zstd " \
+    "or unzip is run to stream it through a pipe. A zip with more than one file needs --member, " \
+    "the name in the zip or just the last part of it.";
 
 
 /* Options to be parsed. */
@@ -41,6 +49,7 @@ static struct argp_option options[] = {
     {"speed",           's', "BAUD",        OPTION_ARG_OPTIONAL, "Serial com speed"},
     {"handshake",       'h', 0,             OPTION_ARG_OPTIONAL, "Use RTS/CTS handshake"},
     {"filename",        'f', "FILE",        OPTION_ARG_OPTIONAL, "Input data file"},
+    {"member",          'm', "NAME",        0,                   "File to send from a zip archive"},
     { 0 }
 };
 
@@ -128,6 +137,7 @@ struct argp_arguments
 {
     char *device;
     char *file;
+    char *member;
     int bits;
     char parity;
     int stop_bits;
@@ -152,6 +162,9 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'f':
         arguments->file = arg;
         break;
+    case 'm':
+        arguments->member = arg;
+        break;
     case 'b':
         if (arg != NULL) {
             switch (arg[0]){
@@ -283,9 +296,9 @@ int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop
 
     if (bits == 5)
         tty.c_cflag |= CS5;         /* 5-bit characters */
-    if (bits == 6)
+    else if (bits == 6)
         tty.c_cflag |= CS6;         /* 6-bit characters */
-    if (bits == 7)
+    else if (bits == 7)
         tty.c_cflag |= CS7;         /* 7-bit characters */
     else if (bits == 8)
         tty.c_cflag |= CS8;         /* 8-bit characters */
@@ -329,20 +342,221 @@ int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop
     return 0;
 }
 
+/* Run ARGV with its stdout to a pipe, returns the read end */
+FILE *spawn_reader(char *const argv[], pid_t *pid)
+{
+    posix_spawn_file_actions_t fa;
+    extern char **environ;
+    int p[2];
+    int ret;
+
+    if (pipe(p) < 0) {
+        fprintf(stderr, "Could not make a pipe: %s\n", strerror(errno));
+        return NULL;
+    }
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, p[1], 1);
+    posix_spawn_file_actions_addclose(&fa, p[0]);
+    posix_spawn_file_actions_addclose(&fa, p[1]);
+    ret = posix_spawnp(pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(p[1]);
+    if (ret != 0) {
+        fprintf(stderr, "Could not run %s: %s\n", argv[0], strerror(ret));
+        close(p[0]);
+        return NULL;
+    }
+    return fdopen(p[0], "r");
+}
+
+
+/* Returns -1 if the helper failed */
+int spawn_wait(FILE *f, pid_t pid, const char *name)
+{
+    int status;
+
+    fclose(f);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed, the tape is not complete\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * unzip takes the zip and member names as wildcards, so [, * and ? are
+ * put in brackets, and in a member a \ is doubled. A zip path starting
+ * with - would be an option.
+ */
+char *unzip_escape(const char *name, bool member)
+{
+    char *out = malloc(3 * strlen(name) + 3), *p = out;
+
+    if (out == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    if (!member && name[0] == '-') {
+        *p++ = '.';
+        *p++ = '/';
+    }
+    for (; *name; name++) {
+        if (*name == '[' || *name == '*' || *name == '?') {
+            *p++ = '[';
+            *p++ = *name;
+            *p++ = ']';
+        } else if (member && *name == '\\') {
+            *p++ = '\\';
+            *p++ = '\\';
+        } else {
+            *p++ = *name;
+        }
+    }
+    *p = '\0';
+    return out;
+}
+
+
+/*
+ * The member of a zip to send: MEMBER matched on the whole name or the
+ * last part of it, or the only file if MEMBER is NULL.
+ */
+char *zip_member(char *file, const char *member)
+{
+    char *argv[] = { "unzip", "-Z1", unzip_escape(file, false), NULL };
+    char *line = NULL, *found = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int num = 0, matches = 0;
+    pid_t pid;
+    FILE *f;
+
+    f = spawn_reader(argv, &pid);
+    free(argv[2]);
+    if (f == NULL)
+        return NULL;
+
+    while ((len = getline(&line, &size, f)) > 0) {
+        const char *base;
+
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[len - 1] == '/')
+            continue;
+        num++;
+        base = strrchr(line, '/') ? strrchr(line, '/') + 1 : line;
+
+        if (member == NULL || strcmp(line, member) == 0 || strcmp(base, member) == 0) {
+            /* An exact match wins over one on the last part */
+            if (found == NULL || (member != NULL && strcmp(line, member) == 0)) {
+                free(found);
+                found = strdup(line);
+            }
+            matches++;
+        }
+    }
+    free(line);
+    if (spawn_wait(f, pid, "unzip") < 0) {
+        free(found);
+        return NULL;
+    }
+
+    if (member == NULL && num != 1) {
+        fprintf(stderr, "%s has %d files, choose one with --member, unzip -l lists them\n", file, num);
+        free(found);
+        return NULL;
+    }
+    if (found == NULL) {
+        fprintf(stderr, "%s has no file %s\n", file, member);
+        return NULL;
+    }
+    if (matches > 1 && strcmp(found, member) != 0) {
+        fprintf(stderr, "%s has more than one %s, give the whole name\n", file, member);
+        free(found);
+        return NULL;
+    }
+    return found;
+}
+
+
+/*
+ * Open the input, through a decompressor if the file starts like gzip,
+ * zstd or zip. *PID is the helper, or 0 for a plain file.
+ */
+FILE *open_input(char *file, const char *member, pid_t *pid, const char **helper)
+{
+    unsigned char magic[4] = { 0 };
+    FILE *f;
+
+    *pid = 0;
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic))
+        magic[0] = 0;
+    rewind(f);
+
+    if (magic[0] == 0x1f && magic[1] == 0x8b) {
+        char *argv[] = { "gzip", "-dc", "--", file, NULL };
+
+        fclose(f);
+        *helper = "gzip";
+        return spawn_reader(argv, pid);
+    }
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        char *argv[] = { "zstd", "-dcq", "--", file, NULL };
+
+        fclose(f);
+        *helper = "zstd";
+        return spawn_reader(argv, pid);
+    }
+    if (magic[0] == 'P' && magic[1] == 'K' && magic[2] == 3 && magic[3] == 4) {
+        char *argv[] = { "unzip", "-p", NULL, NULL, NULL };
+        char *found;
+
+        fclose(f);
+        if ((found = zip_member(file, member)) == NULL)
+            return NULL;
+        argv[2] = unzip_escape(file, false);
+        argv[3] = unzip_escape(found, true);
+        *helper = "unzip";
+        f = spawn_reader(argv, pid);
+        free(argv[2]);
+        free(argv[3]);
+        free(found);
+        return f;
+    }
+
+    if (member != NULL) {
+        fprintf(stderr, "%s is not a zip, --member is only for zips\n", file);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+
 int main(int argc, char **argv)
 {
 
     struct argp_arguments args;
     int buff[1];
     int ch;
+    long offset = 0;
+    int write_err = 0;
     int fd;
     FILE *f;
+    pid_t pid = 0;
+    const char *helper = NULL;
 
     args.bits = 8;
     args.parity = 'N';
     args.stop_bits = 1;
     args.device = "/dev/ttyUSB0";
     args.file = NULL;
+    args.member = NULL;
     args.transmit_delay = 0;
     args.speed = B9600;
     args.handshake = false;
@@ -350,26 +564,35 @@ int main(int argc, char **argv)
     if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
         return -1;
 
+    fr_init("put-tape");
+
     fd = open(args.device, O_RDWR | O_NOCTTY | O_SYNC);
     if (fd < 0) {
+        fr_error("open", 0, errno);
         fprintf(stderr, "Error opening device %s: %s\n", args.device, strerror(errno));
         return -1;
     }
+    fr_record(FR_NOTE, "open", fd, 0);
 
     if (set_interface_attribs(fd, args.speed, args.parity, args.bits, args.stop_bits, args.handshake) < 0) {
+        fr_error("termios", 0, errno);
         close(fd);
         return -1;
     }
+    fr_termios(fd, "set");
+    fr_modem(fd);
 
     /*
      * Use stdin if no filename is given.
      */
     if (args.file != NULL) {
-        if ((f = fopen(args.file, "r")) == NULL) {
-            fprintf(stderr, "Could not open file \"%s\": %s\n", args.file, strerror(errno));
+        if ((f = open_input(args.file, args.member, &pid, &helper)) == NULL) {
+            fr_error("input", 0, errno);
             close(fd);
             return -1;
         }
+        if (pid != 0)
+            fr_record(FR_NOTE, helper, pid, 0);
     } else {
         f = stdin;
     }
@@ -378,10 +601,37 @@ int main(int argc, char **argv)
      * Get every char from f and put them on the serial port until EOF.
      */
     while (EOF != (ch = fgetc(f))) {
+        int ret;
+
         buff[0] = ch;
-        write(fd, buff, 1);
+        ret = write(fd, buff, 1);
+        PROBE3(tx_write, offset, ch, ret);
+        fr_record(FR_WRITE, "tx", offset, ret);
+
+        /* Dump once per new error, not for every char that fails the same way */
+        if (ret < 0 && errno != write_err) {
+            write_err = errno;
+            fr_error("write", offset, write_err);
+        } else if (ret < 0) {
+            fr_record(FR_ERROR, "write", offset, errno);
+        } else {
+            write_err = 0;
+        }
+
+        /* A stall on handshake shows as CTS going away */
+        if ((offset & 077) == 0)
+            fr_modem(fd);
+
         usleep(1000 * args.transmit_delay);
+        PROBE2(tx_delay, offset, args.transmit_delay);
+        offset++;
     }
+    fr_record(FR_NOTE, "eof", offset, 0);
 
     close(fd);
+
+    if (pid != 0 && spawn_wait(f, pid, helper) < 0) {
+        fr_error(helper, offset, 0);
+        return -1;
+    }
 }
@@ -0,0 +1,204 @@
+/*
+ * Reconnect to a USB serial adapter after it has been unplugged or reset
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ * The adapter is identified by its USB vendor, product and serial number
+ * from sysfs, or by its USB port when it has no serial number, so it is
+ * found again even if it comes back under another /dev/ttyUSBn name.
+ * Gaps are noted on stderr and in a "<output>.gaps" file next to the
+ * output, the output itself is continued as is.
+ */
+
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+
+struct reconnect {
+    char id[256];
+    char device[PATH_MAX];
+    const char *output;
+    time_t lost;
+};
+
+
+static int read_sysfs(const char *dir, const char *file, char *buff, size_t size)
+{
+    char path[PATH_MAX];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+
+    if (fgets(buff, size, f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    buff[strcspn(buff, "\n")] = '\0';
+    fclose(f);
+    return 0;
+}
+
+
+/* Identity of the USB device behind the tty NAME (e.g. "ttyUSB0") */
+static int usb_serial_id(const char *name, char *id, size_t size)
+{
+    char path[PATH_MAX];
+    char dev[PATH_MAX];
+    char *p;
+
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device", name);
+    if (realpath(path, dev) == NULL)
+        return -1;
+
+    /* Walk up to the USB device, the directory with idVendor */
+    while ((p = strrchr(dev, '/')) != NULL && p != dev) {
+        char vendor[16], product[16], serial[128];
+
+        if (read_sysfs(dev, "idVendor", vendor, sizeof(vendor)) == 0 &&
+            read_sysfs(dev, "idProduct", product, sizeof(product)) == 0) {
+            if (read_sysfs(dev, "serial", serial, sizeof(serial)) == 0)
+                snprintf(id, size, "%s:%s:%s", vendor, product, serial);
+            else
+                snprintf(id, size, "%s:%s@%s", vendor, product, strrchr(dev, '/') + 1);
+            return 0;
+        }
+        *p = '\0';
+    }
+    return -1;
+}
+
+
+/* Remember which adapter DEVICE is, so it can be found again */
+static int reconnect_init(struct reconnect *rc, const char *device, const char *output)
+{
+    char path[PATH_MAX];
+    char *name;
+
+    if (realpath(device, path) == NULL) {
+        fprintf(stderr, "Error resolving %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    name = strrchr(path, '/') + 1;
+
+    if (usb_serial_id(name, rc->id, sizeof(rc->id)) < 0) {
+        fprintf(stderr, "%s is not a USB serial adapter, can't reconnect\n", device);
+        return -1;
+    }
+
+    snprintf(rc->device, sizeof(rc->device), "%s", device);
+    rc->output = output;
+    return 0;
+}
+
+
+/* A hung up tty fails modem line ioctls, a pty or a live port does not */
+static bool serial_gone(int fd)
+{
+    int lines;
+
+    return ioctl(fd, TIOCMGET, &lines) < 0 && (errno == EIO || errno == ENODEV || errno == ENXIO);
+}
+
+
+/* Look for the adapter among the current ttys */
+static int find_usb_serial(struct reconnect *rc, char *device, size_t size)
+{
+    struct dirent *d;
+    DIR *dir;
+
+    if ((dir = opendir("/sys/class/tty")) == NULL)
+        return -1;
+
+    while ((d = readdir(dir)) != NULL) {
+        char id[256];
+
+        if (d->d_name[0] == '.')
+            continue;
+        if (usb_serial_id(d->d_name, id, sizeof(id)) == 0 && 0 == strcmp(id, rc->id)) {
+            snprintf(device, size, "/dev/%s", d->d_name);
+            closedir(dir);
+            return 0;
+        }
+    }
+    closedir(dir);
+    return -1;
+}
+
+
+/*
+ * Close the lost port and wait until the adapter is back, returns the new
+ * file descriptor. The caller must set up termios again. Returns -1 if
+ * STOP is set while waiting, STOP may be NULL.
+ */
+static int reconnect_wait(struct reconnect *rc, int fd, long offset, atomic_bool *stop)
+{
+    char device[PATH_MAX];
+
+    close(fd);
+    rc->lost = time(NULL);
+    fprintf(stderr, "\nDevice %s lost at offset %ld, waiting for %s\n", rc->device, offset, rc->id);
+
+    for (;;) {
+        usleep(500000);
+
+        if (stop != NULL && atomic_load(stop)) {
+            fprintf(stderr, "Stopped waiting for %s\n", rc->id);
+            return -1;
+        }
+
+        if (find_usb_serial(rc, device, sizeof(device)) < 0)
+            continue;
+
+        /* udev may not have set the permissions yet, just try again */
+        fd = open(device, O_RDWR | O_NOCTTY | O_SYNC);
+        if (fd >= 0)
+            break;
+    }
+
+    fprintf(stderr, "Device %s back as %s after %lds\n", rc->id, device, (long)(time(NULL) - rc->lost));
+    snprintf(rc->device, sizeof(rc->device), "%s", device);
+    return fd;
+}
+
+
+/* Note the gap at OFFSET in the output, after a successful reconnect */
+static void reconnect_note_gap(struct reconnect *rc, long offset)
+{
+    char path[PATH_MAX];
+    char lost[32], back[32];
+    time_t now = time(NULL);
+    FILE *f;
+
+    if (rc->output == NULL)
+        return;
+
+    strftime(lost, sizeof(lost), "%Y-%m-%d %H:%M:%S", localtime(&rc->lost));
+    strftime(back, sizeof(back), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+    snprintf(path, sizeof(path), "%s.gaps", rc->output);
+    if ((f = fopen(path, "a")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        return;
+    }
+    fprintf(f, "%ld %s %s %s\n", offset, lost, back, rc->device);
+    fclose(f);
+}
+
+#endif
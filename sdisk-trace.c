@@ -0,0 +1,829 @@
+/*
+ * Program for recording and replaying SerialDisk traffic
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#define _GNU_SOURCE
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+
+const char *argp_program_version =
+    "sdisk-trace 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for recording SerialDisk traffic between a PDP-8 and the host service, and replaying " \
+    "it against a service under test.\v" \
+    "record: The PDP-8 is on DEV and the host service is started on the pty that is printed. All " \
+    "data is passed on both ways and written to the trace with a timestamp and direction, > from the " \
+    "PDP-8 and < from the host. Quit with q.\n\n" \
+    "replay: Plays the PDP-8 side of a trace on a new pty. Start the service under test on the pty " \
+    "that is printed, replay begins when it opens it. A request is the data from the PDP-8 up to " \
+    "the next data from the host, its response everything from the host up to the next request. " \
+    "The service latency is the time from the last byte of a request to the last byte of its " \
+    "response. Requests are sent as soon as the previous response is complete, or with the gaps " \
+    "of the trace with --timing=original. Latency percentiles of the replay and of the trace, and " \
+    "the throughput, are printed at the end.";
+
+static char args_doc[] = "record|replay";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"file",    'f', "FILE",          0,  "Trace file, default sdisk.trace"},
+    {"device",  'd', "DEV",           0,  "Serial device of the PDP-8 when recording, default /dev/ttyUSB0"},
+    {"speed",   's', "BAUD",          0,  "Serial com speed, default 9600"},
+    {"bits",    'b', "5,6,7,8",       0,  "Number of data bits, default 8"},
+    {"parity",  'p', "N,E,O",         0,  "Parity, default N"},
+    {"stop",    'S', "1,2",           0,  "Number of stop bits, default 1"},
+    {"timing",  't', "full/original", 0,  "Replay at full speed or with the gaps of the trace, default full"},
+    {"timeout", 'T', "MS",            0,  "Time to wait for a response when replaying, default 5000"},
+    { 0 }
+};
+
+
+enum command {
+    CMD_NONE,
+    CMD_RECORD,
+    CMD_REPLAY,
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    enum command command;
+    char *file;
+    char *device;
+    speed_t speed;
+    int bits;
+    char parity;
+    int stop_bits;
+    bool original;
+    int timeout;
+};
+
+
+speed_t map_baudrate(int baud){
+    speed_t speed;
+
+    switch (baud) {
+    case 110:
+        speed = B110;
+        break;
+    case 150:
+        speed = B150;
+        break;
+    case 200:
+        speed = B200;
+        break;
+    case 300:
+        speed = B300;
+        break;
+    case 600:
+        speed = B600;
+        break;
+    case 1200:
+        speed = B1200;
+        break;
+    case 1800:
+        speed = B1800;
+        break;
+    case 2400:
+        speed = B2400;
+        break;
+    case 4800:
+        speed = B4800;
+        break;
+    case 9600:
+        speed = B9600;
+        break;
+    case 19200:
+        speed = B19200;
+        break;
+    case 38400:
+        speed = B38400;
+        break;
+    case 57600:
+        speed = B57600;
+        break;
+    case 115200:
+        speed = B115200;
+        break;
+    case 230400:
+        speed = B230400;
+        break;
+    case 460800:
+        speed = B460800;
+        break;
+    case 500000:
+        speed = B500000;
+        break;
+    case 576000:
+        speed = B576000;
+        break;
+    case 921600:
+        speed = B921600;
+        break;
+    case 1000000:
+        speed = B1000000;
+        break;
+    default:
+        speed = -1;
+    }
+    return speed;
+}
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'f':
+        arguments->file = arg;
+        break;
+    case 'd':
+        arguments->device = arg;
+        break;
+    case 's':
+        arguments->speed = map_baudrate(atoi(arg));
+        if (arguments->speed == (speed_t)-1) {
+            fprintf(stderr, "Invalid baudrate: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'b':
+        arguments->bits = atoi(arg);
+        if (arguments->bits < 5 || arguments->bits > 8) {
+            fprintf(stderr, "Error, invalid number of bits: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'p':
+        if (arg[0] != 'N' && arg[0] != 'E' && arg[0] != 'O') {
+            fprintf(stderr, "Error, invalid parity (N/O/E): %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->parity = arg[0];
+        break;
+    case 'S':
+        arguments->stop_bits = atoi(arg);
+        if (arguments->stop_bits != 1 && arguments->stop_bits != 2) {
+            fprintf(stderr, "Error, invalid number of stop bits: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 't':
+        if (0 == strcmp(arg, "full")) {
+            arguments->original = false;
+        } else if (0 == strcmp(arg, "original")) {
+            arguments->original = true;
+        } else {
+            fprintf(stderr, "Invalid timing (full/original): %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'T':
+        arguments->timeout = atoi(arg);
+        if (arguments->timeout <= 0) {
+            fprintf(stderr, "Invalid timeout: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num != 0) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        if (0 == strcmp(arg, "record")) {
+            arguments->command = CMD_RECORD;
+        } else if (0 == strcmp(arg, "replay")) {
+            arguments->command = CMD_REPLAY;
+        } else {
+            fprintf(stderr, "Unknown command: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num != 1) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop_bits)
+{
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) < 0) {
+        fprintf(stderr, "Error from tcgetattr: %s\n", strerror(errno));
+        return -1;
+    }
+
+    cfsetspeed(&tty, speed);
+    tty.c_cflag |= (CLOCAL | CREAD);    /* ignore modem controls */
+    tty.c_cflag &= ~CSIZE;
+
+    if (bits == 5)
+        tty.c_cflag |= CS5;         /* 5-bit characters */
+    else if (bits == 6)
+        tty.c_cflag |= CS6;         /* 6-bit characters */
+    else if (bits == 7)
+        tty.c_cflag |= CS7;         /* 7-bit characters */
+    else
+        tty.c_cflag |= CS8;         /* 8-bit characters */
+
+    if (parity == 'N') {
+        tty.c_cflag &= ~PARENB;     /* no parity */
+    } else if (parity == 'E') {
+        tty.c_cflag |= PARENB;      /* parity */
+        tty.c_cflag &= ~PARODD;     /* even parity */
+    } else {
+        tty.c_cflag |= PARENB;      /* parity */
+        tty.c_cflag |= PARODD;      /* odd parity */
+    }
+
+    if (stop_bits == 1)
+        tty.c_cflag &= ~CSTOPB;     /* 1 stop bit */
+    else
+        tty.c_cflag |= CSTOPB;      /* 2 stop bits */
+
+    tty.c_cflag &= ~CRTSCTS;        /* no hardware flowcontrol */
+
+    /* setup for non-canonical mode */
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_oflag &= ~OPOST;
+
+    /* poll() tells when there is data, reads return what has arrived */
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        fprintf(stderr, "Error from tcsetattr: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+static int open_pty(void)
+{
+    struct termios tty;
+    int fd;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        fprintf(stderr, "Could not create pty: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Raw, the data is binary */
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(fd, TCSANOW, &tty);
+    return fd;
+}
+
+
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+/*
+ * Trace file, one line per read:
+ *   SECONDS.MICROSECONDS DIR HEXBYTES
+ * where DIR is > for data from the PDP-8 and < for data from the host.
+ */
+static void trace_record(FILE *f, long long t, char dir, const unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    fprintf(f, "%lld.%06lld %c ", t / 1000000, t % 1000000, dir);
+    for (i = 0; i < len; i++)
+        fprintf(f, "%02x", buf[i]);
+    fputc('\n', f);
+}
+
+
+static int record(struct argp_arguments *args)
+{
+    unsigned char buf[4096];
+    struct pollfd pfd[3];
+    struct termios tc;
+    long long start;
+    long long from_pdp8 = 0, from_host = 0;
+    int fd, pty, slave;
+    FILE *f;
+    int ret = 0;
+
+    fd = open(args->device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening device %s: %s\n", args->device, strerror(errno));
+        return -1;
+    }
+    if (set_interface_attribs(fd, args->speed, args->parity, args->bits, args->stop_bits) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if ((pty = open_pty()) < 0) {
+        close(fd);
+        return -1;
+    }
+    /* Keep the slave open, so the service can be restarted without hangups on the master */
+    slave = open(ptsname(pty), O_RDWR | O_NOCTTY);
+
+    if ((f = fopen(args->file, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", args->file, strerror(errno));
+        close(slave);
+        close(pty);
+        close(fd);
+        return -1;
+    }
+    fprintf(f, "# sdisk-trace %s\n", args->device);
+
+    fprintf(stderr, "Start the SerialDisk service on %s, q to quit\n", ptsname(pty));
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    tcgetattr(0, &tc);
+    if (isatty(0)) {
+        struct termios quiet = tc;
+
+        quiet.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(0, TCSANOW, &quiet);
+    }
+
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = pty;
+    pfd[1].events = POLLIN;
+    pfd[2].fd = 0;
+    pfd[2].events = POLLIN;
+
+    start = now_us();
+    while (!stop) {
+        ssize_t n;
+
+        if (poll(pfd, 3, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            ret = -1;
+            break;
+        }
+
+        /* Timestamp right after the read, before passing it on */
+        if (pfd[0].revents & POLLIN) {
+            n = read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                trace_record(f, now_us() - start, '>', buf, n);
+                write_all(pty, buf, n);
+                from_pdp8 += n;
+            }
+        }
+        if (pfd[1].revents & POLLIN) {
+            n = read(pty, buf, sizeof(buf));
+            if (n > 0) {
+                trace_record(f, now_us() - start, '<', buf, n);
+                write_all(fd, buf, n);
+                from_host += n;
+            }
+        }
+        if (pfd[0].revents & (POLLERR | POLLHUP)) {
+            fprintf(stderr, "Lost %s\n", args->device);
+            ret = -1;
+            break;
+        }
+        if (pfd[2].revents & POLLIN) {
+            char c;
+
+            if (read(0, &c, 1) <= 0)
+                pfd[2].fd = -1;
+            else if (c == 'q')
+                break;
+        }
+    }
+
+    tcsetattr(0, TCSANOW, &tc);
+    fprintf(stderr, "%lld bytes from the PDP-8, %lld bytes from the host\n", from_pdp8, from_host);
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", args->file, strerror(errno));
+        ret = -1;
+    }
+    close(slave);
+    close(pty);
+    close(fd);
+    return ret;
+}
+
+
+/* One request from the PDP-8 and the response from the host */
+struct exchange {
+    unsigned char *req;
+    size_t req_len;
+    unsigned char *resp;
+    size_t resp_len;
+    long long gap;          /* From the end of the previous response to the request */
+    long long latency;      /* Recorded service latency */
+    /* Offsets in the request of the reads in the trace, for original timing */
+    long long *chunk_t;
+    size_t *chunk_end;
+    int chunks;
+};
+
+
+struct trace {
+    struct exchange *ex;
+    int num;
+    int size;
+};
+
+
+static void *xrealloc(void *p, size_t size)
+{
+    if ((p = realloc(p, size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    return p;
+}
+
+
+static int hex_value(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+
+static void append(unsigned char **buf, size_t *len, const unsigned char *data, size_t n)
+{
+    *buf = xrealloc(*buf, *len + n);
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+
+static int load_trace(const char *file, struct trace *tr)
+{
+    struct exchange *ex = NULL;
+    unsigned char *data = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    long long req_end = 0, resp_end = 0;
+    int line_num = 0;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    tr->ex = NULL;
+    tr->num = 0;
+    tr->size = 0;
+
+    while (getline(&line, &line_size, f) > 0) {
+        long long sec, usec, t;
+        char dir;
+        int pos = 0;
+        size_t n = 0;
+        char *p;
+
+        line_num++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "%lld.%lld %c %n", &sec, &usec, &dir, &pos) != 3 || pos == 0 ||
+            (dir != '>' && dir != '<')) {
+            fprintf(stderr, "%s:%d: Bad trace line\n", file, line_num);
+            goto error;
+        }
+        t = sec * 1000000 + usec;
+
+        data = xrealloc(data, strlen(line) / 2 + 1);
+        for (p = line + pos; hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0; p += 2)
+            data[n++] = hex_value(p[0]) << 4 | hex_value(p[1]);
+
+        if (dir == '>') {
+            /* Data from the PDP-8 after a response starts the next request */
+            if (ex == NULL || ex->resp_len > 0) {
+                if (tr->num == tr->size) {
+                    tr->size = tr->size ? tr->size * 2 : 256;
+                    tr->ex = xrealloc(tr->ex, tr->size * sizeof(struct exchange));
+                }
+                ex = &tr->ex[tr->num++];
+                memset(ex, 0, sizeof(*ex));
+                ex->gap = tr->num > 1 ? t - resp_end : 0;
+            }
+            ex->chunk_t = xrealloc(ex->chunk_t, (ex->chunks + 1) * sizeof(long long));
+            ex->chunk_end = xrealloc(ex->chunk_end, (ex->chunks + 1) * sizeof(size_t));
+            append(&ex->req, &ex->req_len, data, n);
+            ex->chunk_t[ex->chunks] = ex->chunks ? t - req_end + ex->chunk_t[ex->chunks - 1] : 0;
+            ex->chunk_end[ex->chunks] = ex->req_len;
+            ex->chunks++;
+            req_end = t;
+        } else if (ex != NULL) {
+            append(&ex->resp, &ex->resp_len, data, n);
+            ex->latency = t - req_end;
+            resp_end = t;
+        }
+        /* Host data before the first request is not part of any exchange */
+    }
+
+    free(data);
+    free(line);
+    fclose(f);
+
+    if (tr->num == 0) {
+        fprintf(stderr, "%s: No requests in the trace\n", file);
+        return -1;
+    }
+    return 0;
+
+error:
+    free(data);
+    free(line);
+    fclose(f);
+    return -1;
+}
+
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* Nearest rank percentile of sorted values */
+static long long percentile(const long long *v, int n, double p)
+{
+    int i = (int)(p / 100.0 * n + 0.999999) - 1;
+
+    if (i < 0)
+        i = 0;
+    if (i >= n)
+        i = n - 1;
+    return v[i];
+}
+
+
+static void print_latency(const char *name, long long *v, int n)
+{
+    if (n == 0) {
+        printf("%-10s %9s\n", name, "-");
+        return;
+    }
+    qsort(v, n, sizeof(long long), compare_ll);
+    printf("%-10s %9.3f %9.3f %9.3f %9.3f %9.3f\n", name,
+           percentile(v, n, 50) / 1000.0, percentile(v, n, 90) / 1000.0,
+           percentile(v, n, 99) / 1000.0, percentile(v, n, 99.9) / 1000.0,
+           v[n - 1] / 1000.0);
+}
+
+
+static void sleep_until(long long t)
+{
+    long long d = t - now_us();
+
+    if (d > 0) {
+        struct timespec ts = { d / 1000000, d % 1000000 * 1000 };
+
+        nanosleep(&ts, NULL);
+    }
+}
+
+
+static int replay(struct argp_arguments *args)
+{
+    struct trace tr;
+    unsigned char *buf = NULL;
+    size_t buf_size = 0;
+    long long *latency, *recorded;
+    long long start, elapsed, prev_end;
+    long long bytes = 0;
+    int num_latency = 0, num_recorded = 0;
+    int timeouts = 0, differ = 0;
+    struct pollfd pfd;
+    int pty, i;
+
+    if (load_trace(args->file, &tr) < 0)
+        return -1;
+
+    latency = xrealloc(NULL, tr.num * sizeof(long long));
+    recorded = xrealloc(NULL, tr.num * sizeof(long long));
+
+    if ((pty = open_pty()) < 0)
+        return -1;
+
+    fprintf(stderr, "%d requests, start the SerialDisk service on %s\n", tr.num, ptsname(pty));
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    /* After the slave has been closed once the master hangs up until the service opens it */
+    close(open(ptsname(pty), O_RDWR | O_NOCTTY));
+    pfd.fd = pty;
+    pfd.events = POLLIN;
+    while (!stop && poll(&pfd, 1, 0) >= 0 && (pfd.revents & POLLHUP))
+        usleep(100000);
+    /* Let it set up the line before the first request */
+    usleep(100000);
+
+    start = prev_end = now_us();
+    for (i = 0; i < tr.num && !stop; i++) {
+        struct exchange *ex = &tr.ex[i];
+        long long sent, last = 0;
+        size_t got = 0;
+        int c;
+
+        if (ex->resp_len > buf_size) {
+            buf_size = ex->resp_len;
+            buf = xrealloc(buf, buf_size);
+        }
+
+        if (args->original) {
+            long long t0 = prev_end + ex->gap;
+            size_t from = 0;
+
+            for (c = 0; c < ex->chunks; c++) {
+                sleep_until(t0 + ex->chunk_t[c]);
+                if (write_all(pty, ex->req + from, ex->chunk_end[c] - from) < 0)
+                    break;
+                from = ex->chunk_end[c];
+            }
+            if (c < ex->chunks)
+                goto write_error;
+        } else if (write_all(pty, ex->req, ex->req_len) < 0) {
+            goto write_error;
+        }
+        sent = now_us();
+        bytes += ex->req_len;
+
+        while (got < ex->resp_len && !stop) {
+            int wait = args->timeout - (int)((now_us() - sent) / 1000);
+            ssize_t n;
+
+            if (wait <= 0 || poll(&pfd, 1, wait) == 0)
+                break;
+            if (pfd.revents & POLLHUP) {
+                fprintf(stderr, "The service closed the pty\n");
+                stop = 1;
+                break;
+            }
+            n = read(pty, buf + got, ex->resp_len - got);
+            if (n < 0 && errno != EINTR && errno != EAGAIN)
+                break;
+            if (n > 0) {
+                got += n;
+                last = now_us();
+            }
+        }
+        bytes += got;
+
+        if (got < ex->resp_len) {
+            if (!stop)
+                timeouts++;
+            prev_end = now_us();
+            continue;
+        }
+
+        if (memcmp(buf, ex->resp, ex->resp_len) != 0)
+            differ++;
+
+        /* Requests without a response, like the tail of a trace, have no latency */
+        if (ex->resp_len > 0) {
+            latency[num_latency++] = last - sent;
+            recorded[num_recorded++] = ex->latency;
+            prev_end = last;
+        } else {
+            prev_end = sent;
+        }
+    }
+    elapsed = now_us() - start;
+
+    printf("%d of %d requests replayed, %d timeouts, %d responses differ from the trace\n",
+           i, tr.num, timeouts, differ);
+    printf("%-10s %9s %9s %9s %9s %9s\n", "Latency ms", "p50", "p90", "p99", "p99.9", "max");
+    print_latency("replay", latency, num_latency);
+    print_latency("trace", recorded, num_recorded);
+    if (elapsed > 0)
+        printf("Throughput %.0f bytes/s, %.1f requests/s\n",
+               bytes * 1e6 / elapsed, i * 1e6 / elapsed);
+
+    close(pty);
+    return timeouts > 0 ? -1 : 0;
+
+write_error:
+    fprintf(stderr, "Could not write to the pty: %s\n", strerror(errno));
+    close(pty);
+    return -1;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+
+    args.command = CMD_NONE;
+    args.file = "sdisk.trace";
+    args.device = "/dev/ttyUSB0";
+    args.speed = B9600;
+    args.bits = 8;
+    args.parity = 'N';
+    args.stop_bits = 1;
+    args.original = false;
+    args.timeout = 5000;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (args.command == CMD_RECORD)
+        return record(&args);
+    return replay(&args);
+}
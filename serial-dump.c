@@ -11,13 +11,28 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/poll.h>
 #include <termios.h>
 #include <unistd.h>
+#include <linux/serial.h>
+
+#include "ahocorasick.h"
+#include "baudot.h"
+#include "metrics.h"
+#include "probes.h"
+#include "reconnect.h"
 
 
 const char *argp_program_version =
@@ -29,7 +44,18 @@ const char *argp_program_bug_address =
 
 /* Program documentation. */
 static char doc[] =
-    "serial-dump program, takes input from serial port and prints in a hexdump style. Default is 9600 8N1 on device /dev/ttyUSB0.";
+    "serial-dump program, takes input from serial port and prints in a hexdump style, or as text for " \
+    "5-level Baudot/ITA2 tapes. Default is 9600 8N1 on device /dev/ttyUSB0, 5N1 for baudot.\v" \
+    "The port is read and logged by a thread of its own, so a slow terminal never holds up the " \
+    "reading. If the display falls more than 1 MB behind it skips to the newest data and prints " \
+    "how many bytes it skipped, the log always has everything.\n\n" \
+    "--console makes it a terminal on the port instead. Keys are sent as typed, Ctrl-] gives a " \
+    "menu to send a file, paced to the line rate, or to quit.\n\n" \
+    "--watch matches all patterns at once on the received data, with the eighth bit cleared. " \
+    "Patterns can have \\r, \\n, \\t, \\\\ and \\xHH escapes. A match is printed on stderr " \
+    "and added to LOG.matches with a timestamp and the offset after its last byte. The hook gets " \
+    "MATCH_PATTERN, MATCH_OFFSET and MATCH_TIME in its environment and is not waited for. Matches " \
+    "are reported by the display thread, if more than 4096 are waiting the rest are dropped and counted.";
 
 
 /* Options to be parsed. */
@@ -41,6 +67,14 @@ static struct argp_option options[] = {
     {"stop",   'S', "1,2",     OPTION_ARG_OPTIONAL,  "Number of stop bits"},
     {"speed",  's', "BAUD",    OPTION_ARG_OPTIONAL,  "Serial com speed"},
     {"quiet",  'q', 0,         OPTION_ARG_OPTIONAL,  "Don't print on stdout"},
+    {"metrics",'M', "ENDPOINT",0,                    "Serve metrics on a UNIX socket path or a localhost TCP port"},
+    {"reconnect",'r', 0,       0,                    "Wait for an unplugged USB adapter to come back and continue"},
+    {"baudot", 'B', "ita2,us", OPTION_ARG_OPTIONAL,  "Print Baudot/ITA2 text instead of a hexdump, the log is still raw"},
+    {"console",'c', 0,         0,                    "Interactive terminal on the port, Ctrl-] for menu"},
+    {"transmit-delay",'t', "NUMBER", 0,              "Extra delay after each char of a file sent from the console, 0-1000ms"},
+    {"watch",  'w', "FILE",    0,                    "Watch for the patterns in FILE, one per line, and report matches"},
+    {"hook",   'H', "CMD",     0,                    "Run CMD with sh -c on every match, see below"},
+    {"fifo",   'F', "PATH",    0,                    "Write a line for every match to the FIFO PATH, if anyone reads it"},
     { 0 }
 };
 
@@ -134,6 +168,16 @@ struct argp_arguments
     int stop_bits;
     speed_t speed;
     bool quiet;
+    char *metrics;
+    bool reconnect;
+    bool baudot;
+    enum baudot_variant baudot_variant;
+    bool console;
+    int baud;
+    int transmit_delay;
+    char *watch;
+    char *hook;
+    char *fifo;
 };
 
 
@@ -216,6 +260,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
             int baud = atoi(arg);
 
             arguments->speed = map_baudrate(baud);
+            arguments->baud = baud;
 
             if (arguments->speed == -1) {
                 fprintf(stderr, "Invalid baudrate: %d\n", baud);
@@ -230,6 +275,44 @@ parse_opt (int key, char *arg, struct argp_state *state)
         case 'q':
         arguments->quiet = true;
     break;
+    case 'M':
+        arguments->metrics = arg;
+        break;
+    case 'r':
+        arguments->reconnect = true;
+        break;
+    case 'c':
+        arguments->console = true;
+        break;
+    case 't':
+        arguments->transmit_delay = atoi(arg);
+        if (arguments->transmit_delay > 1000 || arguments->transmit_delay < 0) {
+            fprintf(stderr, "Invalid delay: %sms\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'w':
+        arguments->watch = arg;
+        break;
+    case 'H':
+        arguments->hook = arg;
+        break;
+    case 'F':
+        arguments->fifo = arg;
+        break;
+    case 'B':
+        arguments->baudot = true;
+        if (arg == NULL || 0 == strcmp(arg, "ita2")) {
+            arguments->baudot_variant = BAUDOT_ITA2;
+        } else if (0 == strcmp(arg, "us")) {
+            arguments->baudot_variant = BAUDOT_US;
+        } else {
+            fprintf(stderr, "Invalid Baudot variant (ita2/us): %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
 
     case ARGP_KEY_ARG:
         if (state->arg_num != 0){
@@ -272,9 +355,9 @@ int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop
 
     if (bits == 5)
         tty.c_cflag |= CS5;         /* 5-bit characters */
-    if (bits == 6)
+    else if (bits == 6)
         tty.c_cflag |= CS6;         /* 6-bit characters */
-    if (bits == 7)
+    else if (bits == 7)
         tty.c_cflag |= CS7;         /* 7-bit characters */
     else if (bits == 8)
         tty.c_cflag |= CS8;         /* 8-bit characters */
@@ -315,19 +398,22 @@ int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop
 }
 
 
+/* Chars of the current hexdump line */
+static char line_buff[17];
+
+
 void printchar(char data, int num_recived)
 {
     int i;
-    static char buff[17];
 
 /*
 Printed format:
 00000000  71 71 71 71 71 71 71 71  71 71 71 71 71 71 71 71  |qqqqqqqqqqqqqqqq|
 */
-    buff[16] = '\0';
+    line_buff[16] = '\0';
 
     i = num_recived & 0xf;
-    buff[i] = isprint(data) ? data : '.';
+    line_buff[i] = isprint(data) ? data : '.';
 
     if ((num_recived & 0xf) == 0)
         printf("%8.8x  ", num_recived);
@@ -335,7 +421,7 @@ Printed format:
     printf("%2.2x ", data & 0xff);
 
     if (i == 15) {
-        printf(" |%s|\n", buff);
+        printf(" |%s|\n", line_buff);
     }
 
     if (i == 7)
@@ -343,6 +429,62 @@ Printed format:
 }
 
 
+/* Start a new line at NUM_RECIVED, with blanks up to it, after a jump in the dump */
+void printresync(int num_recived)
+{
+    int i;
+
+    if ((num_recived & 0xf) == 0)
+        return;
+
+    printf("%8.8x  ", num_recived & ~0xf);
+    for (i = 0; i < (num_recived & 0xf); i++) {
+        line_buff[i] = ' ';
+        printf("   ");
+        if (i == 7)
+            printf(" ");
+    }
+}
+
+
+static struct metric m_rx_bytes = {"pdp8_rx_bytes_total", NULL, "counter", "Bytes received from the serial port"};
+static struct metric m_log_bytes = {"pdp8_log_bytes_total", NULL, "counter", "Bytes written to the log file"};
+static struct metric m_read_errors = {"pdp8_read_errors_total", NULL, "counter", "Failed reads from the serial port"};
+static struct metric m_overrun = {"pdp8_line_errors_total", "{type=\"overrun\"}", "counter", "Serial line errors reported by the driver"};
+static struct metric m_buf_overrun = {"pdp8_line_errors_total", "{type=\"buffer_overrun\"}", "counter", ""};
+static struct metric m_frame = {"pdp8_line_errors_total", "{type=\"frame\"}", "counter", ""};
+static struct metric m_parity = {"pdp8_line_errors_total", "{type=\"parity\"}", "counter", ""};
+static struct metric m_brk = {"pdp8_line_errors_total", "{type=\"break\"}", "counter", ""};
+static struct metric m_matches = {"pdp8_watch_matches_total", NULL, "counter", "Watch patterns found in the received data"};
+static struct metric m_matches_dropped = {"pdp8_watch_matches_dropped_total", NULL, "counter", "Watch matches not reported, the display was too far behind"};
+static struct metric m_last_rx = {"pdp8_last_rx_timestamp_seconds", NULL, "gauge", "Time of the last received byte"};
+static struct histogram h_log_write = {"pdp8_log_write_latency_seconds", "Time for one write to the log file"};
+
+static struct metric *metrics[] = {
+    &m_rx_bytes, &m_log_bytes, &m_read_errors,
+    &m_overrun, &m_buf_overrun, &m_frame, &m_parity, &m_brk,
+    &m_last_rx, &m_matches, &m_matches_dropped, NULL
+};
+
+static struct histogram *histograms[] = { &h_log_write, NULL };
+
+
+/* Line error counters are fetched from the driver when metrics are read */
+void update_metrics(void *arg)
+{
+    struct serial_icounter_struct icount;
+    int fd = atomic_load((_Atomic int *)arg);
+
+    if (fd >= 0 && ioctl(fd, TIOCGICOUNT, &icount) == 0) {
+        metric_set(&m_overrun, icount.overrun);
+        metric_set(&m_buf_overrun, icount.buf_overrun);
+        metric_set(&m_frame, icount.frame);
+        metric_set(&m_parity, icount.parity);
+        metric_set(&m_brk, icount.brk);
+    }
+}
+
+
 void set_term_quiet_input()
 {
     struct termios tc;
@@ -354,80 +496,809 @@ void set_term_quiet_input()
 }
 
 
+/*
+ * The port is read by a thread of its own, which also writes the log, and
+ * the display follows in a ring buffer. The reader never waits for the
+ * display: it overwrites the oldest data, and a display that has fallen
+ * more than the ring behind skips to the newest data and says so.
+ *
+ * Watch matches are found by the reader and reported by the display, the
+ * reader only puts them in a queue. A match that doesn't fit is dropped
+ * and counted, the same way.
+ */
+#define RING_SIZE   (1 << 20)
+#define READ_SIZE   4096
+#define MATCH_SLOTS 4096        /* Power of two */
+
+struct match {
+    unsigned long long offset;
+    struct timespec ts;
+    int pattern;
+};
+
+struct acquisition {
+    _Atomic int fd;             /* -1 while the reader reconnects */
+    int fd_log;
+    struct argp_arguments *args;
+    struct reconnect *rc;
+    unsigned char ring[RING_SIZE];
+    atomic_ullong head;         /* Bytes received, only moved by the reader */
+    atomic_llong gap;           /* Offset of the latest reconnect, -1 for none */
+    atomic_bool stop;           /* Set by the display */
+    atomic_bool done;           /* Set by the reader */
+    int wake;                   /* eventfd, written when there is new data */
+    struct ac *watch;
+    struct match match[MATCH_SLOTS];
+    atomic_ulong match_head;    /* Only moved by the reader */
+    atomic_ulong match_tail;    /* Only moved by the display */
+    atomic_ullong match_dropped;
+    int fifo_fd;
+};
+
+
+static void acquisition_wake(struct acquisition *acq)
+{
+    uint64_t one = 1;
+
+    if (write(acq->wake, &one, sizeof(one)) < 0)
+        return;
+}
+
+
+extern char **environ;
+
+/* Pattern with control chars escaped, for the reports */
+static void watch_pattern(const char *pattern, int len, char *buff, size_t size)
+{
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < len && n + 5 < size; i++) {
+        unsigned char c = pattern[i];
+
+        if (c == '\\')
+            n += snprintf(buff + n, size - n, "\\\\");
+        else if (c == '\r')
+            n += snprintf(buff + n, size - n, "\\r");
+        else if (c == '\n')
+            n += snprintf(buff + n, size - n, "\\n");
+        else if (isprint(c))
+            buff[n++] = c;
+        else
+            n += snprintf(buff + n, size - n, "\\x%02x", c);
+    }
+    buff[n] = '\0';
+}
+
+
+/* Display side, the terminal, files and the hook may all be slow */
+void watch_report(struct acquisition *acq, const struct match *m)
+{
+    struct argp_arguments *args = acq->args;
+    unsigned long long offset = m->offset;
+    char pattern[256], stamp[64], line[512];
+    struct tm tm;
+    FILE *f;
+
+    localtime_r(&m->ts.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(stamp + strlen(stamp), sizeof(stamp) - strlen(stamp), ".%03ld", m->ts.tv_nsec / 1000000);
+
+    watch_pattern(acq->watch->pattern[m->pattern], acq->watch->len[m->pattern], pattern, sizeof(pattern));
+    snprintf(line, sizeof(line), "%s %8.8llx %s", stamp, offset, pattern);
+
+    /* The console has the terminal in raw mode */
+    fprintf(stderr, "%s[match %s]%s", args->console ? "\r\n" : "\n", line, args->console ? "\r\n" : "\n");
+
+    if (args->log_file) {
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s.matches", args->log_file);
+        if ((f = fopen(path, "a")) != NULL) {
+            fprintf(f, "%s\n", line);
+            fclose(f);
+        }
+    }
+
+    /* Opened when someone reads it and kept until they go, never waited for */
+    if (args->fifo) {
+        if (acq->fifo_fd < 0)
+            acq->fifo_fd = open(args->fifo, O_WRONLY | O_NONBLOCK);
+        if (acq->fifo_fd >= 0) {
+            size_t len = strlen(line);
+
+            line[len] = '\n';
+            if (write(acq->fifo_fd, line, len + 1) < 0 && errno != EAGAIN) {
+                close(acq->fifo_fd);
+                acq->fifo_fd = -1;
+            }
+            line[len] = '\0';
+        }
+    }
+
+    if (args->hook) {
+        char env_pattern[300], env_offset[64], env_time[80];
+        char *argv[] = { "sh", "-c", args->hook, NULL };
+        char **envp;
+        pid_t pid;
+        int n, i;
+
+        for (n = 0; environ[n] != NULL; n++)
+            ;
+        envp = malloc((n + 4) * sizeof(char *));
+        if (envp == NULL)
+            return;
+        for (i = 0; i < n; i++)
+            envp[i] = environ[i];
+        snprintf(env_pattern, sizeof(env_pattern), "MATCH_PATTERN=%s", pattern);
+        snprintf(env_offset, sizeof(env_offset), "MATCH_OFFSET=%llu", offset);
+        snprintf(env_time, sizeof(env_time), "MATCH_TIME=%s", stamp);
+        envp[n++] = env_pattern;
+        envp[n++] = env_offset;
+        envp[n++] = env_time;
+        envp[n] = NULL;
+
+        if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, envp) != 0)
+            fprintf(stderr, "Could not run the hook\n");
+        free(envp);
+    }
+}
+
+
+/* Reader side, a match is queued for the display or dropped, never waited for */
+static void watch_queue(struct acquisition *acq, int p, unsigned long long offset)
+{
+    unsigned long head = atomic_load_explicit(&acq->match_head, memory_order_relaxed);
+    struct match *m;
+
+    metric_add(&m_matches, 1);
+    PROBE2(watch_match, offset, p);
+
+    if (head - atomic_load_explicit(&acq->match_tail, memory_order_acquire) == MATCH_SLOTS) {
+        atomic_fetch_add_explicit(&acq->match_dropped, 1, memory_order_relaxed);
+        metric_add(&m_matches_dropped, 1);
+        return;
+    }
+
+    m = &acq->match[head % MATCH_SLOTS];
+    m->offset = offset;
+    m->pattern = p;
+    clock_gettime(CLOCK_REALTIME, &m->ts);
+    atomic_store_explicit(&acq->match_head, head + 1, memory_order_release);
+}
+
+
+/* Constant work per byte, a table lookup, plus the matches */
+static inline void watch_feed(struct acquisition *acq, const unsigned char *buf, int num, unsigned long long offset)
+{
+    int i;
+
+    for (i = 0; i < num; i++) {
+        int s = ac_step(acq->watch, buf[i] & 0x7f);
+        int p;
+
+        while ((p = ac_match(acq->watch, &s)) != AC_NONE)
+            watch_queue(acq, p, offset + i + 1);
+    }
+}
+
+
+/* Report the queued matches, and how many were dropped since the last time */
+void watch_drain(struct acquisition *acq)
+{
+    unsigned long head = atomic_load_explicit(&acq->match_head, memory_order_acquire);
+    unsigned long tail = atomic_load_explicit(&acq->match_tail, memory_order_relaxed);
+    unsigned long long dropped;
+    bool raw = acq->args->console;
+
+    for (; tail != head; tail++) {
+        watch_report(acq, &acq->match[tail % MATCH_SLOTS]);
+        atomic_store_explicit(&acq->match_tail, tail + 1, memory_order_release);
+    }
+
+    if ((dropped = atomic_exchange(&acq->match_dropped, 0)) > 0)
+        fprintf(stderr, "%s[%llu matches dropped]%s", raw ? "\r\n" : "\n", dropped, raw ? "\r\n" : "\n");
+}
+
+
+void *acquisition_thread(void *arg)
+{
+    struct acquisition *acq = arg;
+    struct argp_arguments *args = acq->args;
+    unsigned char buf[READ_SIZE];
+    unsigned long long head = 0;
+    int num;
+
+    do {
+        size_t pos;
+        int i;
+
+        num = read(acq->fd, buf, sizeof(buf));
+        PROBE2(rx_read, head, num);
+
+        /* A lost adapter gives errors or end of file, not timeouts */
+        if (num <= 0 && args->reconnect && serial_gone(acq->fd)) {
+            int fd = atomic_exchange(&acq->fd, -1);
+
+            /* The console holds its output until the new fd is stored */
+            fd = reconnect_wait(acq->rc, fd, head, &acq->stop);
+            if (fd < 0)
+                break;
+            if (set_interface_attribs(fd, args->speed, args->parity, args->bits, args->stop_bits) < 0) {
+                atomic_store(&acq->fd, fd);
+                break;
+            }
+            atomic_store(&acq->fd, fd);
+            reconnect_note_gap(acq->rc, head);
+            atomic_store(&acq->gap, head);
+            if (acq->watch)
+                acq->watch->state = AC_ROOT;
+            acquisition_wake(acq);
+            num = 0;
+            continue;
+        }
+
+        if (num < 0)
+            metric_add(&m_read_errors, 1);
+
+        if (num < 1)
+            continue;
+
+        metric_add(&m_rx_bytes, num);
+        metric_set(&m_last_rx, time(NULL));
+
+        if (acq->fd_log >= 0) {
+            unsigned long long start = metrics_now_us();
+            int ret = write(acq->fd_log, buf, num);
+
+            histogram_observe(&h_log_write, metrics_now_us() - start);
+            if (ret > 0)
+                metric_add(&m_log_bytes, ret);
+            PROBE2(log_write, head, ret);
+        }
+
+        if (acq->watch)
+            watch_feed(acq, buf, num, head);
+
+        pos = head % RING_SIZE;
+        for (i = 0; i < num; i++) {
+            acq->ring[pos] = buf[i];
+            pos = (pos + 1) % RING_SIZE;
+        }
+        head += num;
+        atomic_store_explicit(&acq->head, head, memory_order_release);
+        acquisition_wake(acq);
+    } while (num != -1 && !atomic_load(&acq->stop));
+
+    atomic_store(&acq->done, true);
+    acquisition_wake(acq);
+    return NULL;
+}
+
+
+/*
+ * Copy up to MAX bytes from TAIL out of the ring and move TAIL past them.
+ * Data that the reader overwrote before it was copied is skipped, the
+ * number of such bytes is returned in SKIPPED.
+ */
+size_t ring_read(struct acquisition *acq, unsigned long long *tail, unsigned char *buf, size_t max,
+                 unsigned long long *skipped)
+{
+    unsigned long long head = atomic_load_explicit(&acq->head, memory_order_acquire);
+    size_t n = head - *tail < max ? head - *tail : max;
+    size_t i;
+
+    *skipped = 0;
+
+    /*
+     * Copied out first, then checked that the reader hasn't overwritten it
+     * meanwhile. The reader fills up to READ_SIZE bytes past head before
+     * it moves head, so those count as overwritten already.
+     */
+    if (head - *tail <= RING_SIZE - READ_SIZE) {
+        for (i = 0; i < n; i++)
+            buf[i] = acq->ring[(*tail + i) % RING_SIZE];
+    }
+    atomic_thread_fence(memory_order_acquire);
+    head = atomic_load_explicit(&acq->head, memory_order_relaxed);
+    if (head - *tail > RING_SIZE - READ_SIZE) {
+        *skipped = head - *tail;
+        *tail = head;
+        return 0;
+    }
+    *tail += n;
+    return n;
+}
+
+
+/* The reconnect gap in the N bytes before TAIL, or -1 */
+long long ring_gap(struct acquisition *acq, unsigned long long tail, size_t n)
+{
+    long long gap = atomic_load(&acq->gap);
+
+    if (gap < 0 || (unsigned long long)gap >= tail)
+        return -1;
+    atomic_store(&acq->gap, -1);
+    return (unsigned long long)gap > tail - n ? gap : (long long)(tail - n);
+}
+
+
+void show(struct argp_arguments *args, struct baudot *baudot, unsigned char *buf, size_t n,
+          unsigned long long offset)
+{
+    size_t i;
+
+    if (args->quiet) {
+        return;
+    } else if (args->baudot) {
+        char text[READ_SIZE];
+        size_t len = baudot_decode_buf(baudot, buf, n, text);
+
+        fwrite(text, 1, len, stdout);
+    } else {
+        for (i = 0; i < n; i++)
+            printchar(buf[i], offset + i);
+    }
+}
+
+
+void display(struct acquisition *acq, struct baudot *baudot)
+{
+    struct argp_arguments *args = acq->args;
+    unsigned char buf[READ_SIZE];
+    unsigned long long tail = 0;
+    struct pollfd pfd[2] = {
+        { .fd = 0, .events = POLLIN },
+        { .fd = acq->wake, .events = POLLIN },
+    };
+    bool done = false;
+
+    while (!done) {
+        unsigned long long skipped;
+        uint64_t count;
+        size_t n;
+
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+            break;
+
+        if (pfd[0].revents & (POLLIN | POLLHUP)) {
+            int c = getchar();
+
+            /* Stdin at end of file or /dev/null, only the port is left to wait for */
+            if (c == EOF)
+                pfd[0].fd = -1;
+            if (c == 'q') {
+                atomic_store(&acq->stop, true);
+                break;
+            }
+        }
+        if ((pfd[1].revents & POLLIN) && read(acq->wake, &count, sizeof(count)) < 0)
+            continue;
+
+        done = atomic_load(&acq->done);
+
+        do {
+            long long gap;
+
+            n = ring_read(acq, &tail, buf, sizeof(buf), &skipped);
+            if (skipped > 0 && args->quiet == false) {
+                printf("\n--- skipped %llu bytes ---\n", skipped);
+                if (!args->baudot)
+                    printresync(tail);
+            }
+
+            if ((gap = ring_gap(acq, tail, n)) >= 0) {
+                size_t before = gap - (tail - n);
+
+                show(args, baudot, buf, before, tail - n);
+                if (args->quiet == false) {
+                    printf("\n--- gap at %8.8llx ---\n", gap);
+                    if (!args->baudot)
+                        printresync(gap);
+                }
+                show(args, baudot, buf + before, n - before, gap);
+            } else {
+                show(args, baudot, buf, n, tail - n);
+            }
+        } while (n > 0 || skipped > 0);
+        fflush(stdout);
+
+        if (acq->watch)
+            watch_drain(acq);
+    }
+}
+
+
+/*
+ * Console mode, a terminal on the port. Keys go straight to the port and
+ * the output is written as it comes, with the eighth bit cleared as the
+ * PDP-8 usually sends it set. Ctrl-] gives a menu for sending a file,
+ * which is paced to the line rate (plus --transmit-delay) from the same
+ * poll loop, so the terminal keeps working during a send.
+ */
+#define CONSOLE_ESCAPE  0x1d
+
+enum console_state {
+    CS_TERMINAL,
+    CS_ESCAPE,
+    CS_FILENAME,
+};
+
+
+static void console_puts(const char *s)
+{
+    if (write(1, s, strlen(s)) < 0)
+        return;
+}
+
+
+/*
+ * One char to the port, 1 when written. The reader thread replaces the fd
+ * on a reconnect, so it is loaded for every write, and 0 means the port is
+ * being reconnected and the char should be written again later.
+ */
+static int port_write(struct acquisition *acq, unsigned char c)
+{
+    int fd = atomic_load(&acq->fd);
+    ssize_t ret = -1;
+
+    if (fd >= 0 && (ret = write(fd, &c, 1)) == 1)
+        return 1;
+    if (acq->args->reconnect && (fd < 0 || ret == 0 || errno == EBADF || errno == EIO))
+        return 0;
+    return -1;
+}
+
+
+void console(struct acquisition *acq)
+{
+    struct argp_arguments *args = acq->args;
+    enum console_state state = CS_TERMINAL;
+    unsigned char buf[READ_SIZE];
+    unsigned long long tail = 0;
+    struct pollfd pfd[2] = {
+        { .fd = 0, .events = POLLIN },
+        { .fd = acq->wake, .events = POLLIN },
+    };
+    char name[256], msg[128];
+    size_t name_len = 0;
+    unsigned char keys_held[256];
+    size_t held = 0;
+    bool waiting = false;
+    FILE *send = NULL;
+    long send_size = 0, sent = 0;
+    long long next_send = 0;
+    long long interval;
+    bool done = false;
+
+    /* Start, data, parity and stop bits of one char, plus the extra delay */
+    interval = 1000000LL * (1 + args->bits + (args->parity != 'N') + args->stop_bits) / args->baud +
+               1000LL * args->transmit_delay;
+
+    console_puts("Console, Ctrl-] for menu\r\n");
+
+    while (!done) {
+        unsigned long long skipped;
+        uint64_t count;
+        int timeout = -1;
+        size_t n, i;
+
+        if (send != NULL) {
+            long long wait = next_send - metrics_now_us();
+
+            timeout = wait > 0 ? (wait + 999) / 1000 : 0;
+        }
+        if (held > 0 && (timeout < 0 || timeout > 50))
+            timeout = 50;
+
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR)
+            break;
+
+        if (pfd[0].revents & POLLIN) {
+            unsigned char keys[64];
+            ssize_t num = read(0, keys, sizeof(keys));
+
+            if (num <= 0)
+                pfd[0].fd = -1;
+
+            for (i = 0; i < (size_t)(num > 0 ? num : 0) && !done; i++) {
+                unsigned char c = keys[i];
+
+                switch (state) {
+                case CS_TERMINAL:
+                    if (c == CONSOLE_ESCAPE) {
+                        console_puts(send ? "\r\n[s]end file, [a]bort send, [q]uit, ^] sends ^]: "
+                                          : "\r\n[s]end file, [q]uit, ^] sends ^]: ");
+                        state = CS_ESCAPE;
+                    } else if (held < sizeof(keys_held)) {
+                        keys_held[held++] = c;
+                    }
+                    break;
+                case CS_ESCAPE:
+                    state = CS_TERMINAL;
+                    if (c == 'q') {
+                        console_puts("quit\r\n");
+                        done = true;
+                    } else if (c == 's' && send == NULL) {
+                        console_puts("send\r\nFile: ");
+                        name_len = 0;
+                        state = CS_FILENAME;
+                    } else if (c == 'a' && send != NULL) {
+                        fclose(send);
+                        send = NULL;
+                        snprintf(msg, sizeof(msg), "aborted\r\n[sent %ld of %ld bytes]\r\n", sent, send_size);
+                        console_puts(msg);
+                    } else if (c == CONSOLE_ESCAPE) {
+                        console_puts("\r\n");
+                        if (held < sizeof(keys_held))
+                            keys_held[held++] = c;
+                    } else {
+                        console_puts("\r\n");
+                    }
+                    break;
+                case CS_FILENAME:
+                    if (c == '\r' || c == '\n') {
+                        name[name_len] = '\0';
+                        console_puts("\r\n");
+                        state = CS_TERMINAL;
+                        if (name_len == 0)
+                            break;
+                        if ((send = fopen(name, "r")) == NULL) {
+                            console_puts("[could not open the file]\r\n");
+                            break;
+                        }
+                        fseek(send, 0, SEEK_END);
+                        send_size = ftell(send);
+                        rewind(send);
+                        sent = 0;
+                        next_send = metrics_now_us();
+                    } else if ((c == 0x7f || c == '\b') && name_len > 0) {
+                        name_len--;
+                        console_puts("\b \b");
+                    } else if (c == 0x1b || c == 0x03) {
+                        console_puts("\r\n");
+                        state = CS_TERMINAL;
+                    } else if (c >= ' ' && name_len < sizeof(name) - 1) {
+                        name[name_len++] = c;
+                        if (write(1, &c, 1) < 0)
+                            break;
+                    }
+                    break;
+                }
+            }
+        }
+
+        /* Keys wait here while the port is reconnected */
+        while (held > 0) {
+            int ret = port_write(acq, keys_held[0]);
+
+            if (ret == 0) {
+                if (!waiting)
+                    console_puts("\r\n[port lost, keys held until it is back]\r\n");
+                waiting = true;
+                break;
+            }
+            if (ret < 0) {
+                console_puts("\r\n[write to the port failed]\r\n");
+                held = 0;
+                break;
+            }
+            waiting = false;
+            memmove(keys_held, keys_held + 1, --held);
+        }
+
+        /* One char per interval, a late loop catches up without bursting */
+        if (send != NULL && metrics_now_us() >= next_send) {
+            int c = getc(send);
+
+            if (c == EOF) {
+                fclose(send);
+                send = NULL;
+                snprintf(msg, sizeof(msg), "\r\n[sent %ld bytes]\r\n", sent);
+                console_puts(msg);
+            } else {
+                int ret = port_write(acq, c);
+
+                if (ret == 1)
+                    sent++;
+                else if (ret == 0)
+                    ungetc(c, send);
+                next_send += interval;
+                if (next_send < metrics_now_us() - interval)
+                    next_send = metrics_now_us();
+            }
+        }
+
+        if ((pfd[1].revents & POLLIN) && read(acq->wake, &count, sizeof(count)) < 0)
+            continue;
+        if (atomic_load(&acq->done))
+            done = true;
+
+        do {
+            n = ring_read(acq, &tail, buf, sizeof(buf), &skipped);
+            if (skipped > 0) {
+                snprintf(msg, sizeof(msg), "\r\n[skipped %llu bytes]\r\n", skipped);
+                console_puts(msg);
+            }
+            if (ring_gap(acq, tail, n) >= 0)
+                console_puts("\r\n[reconnected]\r\n");
+            for (i = 0; i < n; i++)
+                buf[i] &= 0x7f;
+            if (n > 0 && write(1, buf, n) < 0)
+                break;
+        } while (n > 0 || skipped > 0);
+
+        if (acq->watch)
+            watch_drain(acq);
+    }
+
+    if (send != NULL)
+        fclose(send);
+    atomic_store(&acq->stop, true);
+}
+
+
 int main(int argc, char **argv)
 {
-    int fd, fd_log;
+    struct acquisition *acq;
     struct argp_arguments args;
-    int num_recived = 0;
-    int num;
+    struct reconnect rc;
+    pthread_t thread;
     int ret = 0;
-    struct pollfd pfd = { .fd = 0, .events = POLLIN };
     struct termios tc;
-    bool exit = false;
+    struct baudot baudot;
 
-    args.bits = 8;
+    args.bits = 0;
     args.parity = 'N';
     args.stop_bits = 1;
     args.device = "/dev/ttyUSB0";
     args.log_file = NULL;
     args.quiet = false;
     args.speed = B9600;
+    args.metrics = NULL;
+    args.reconnect = false;
+    args.baudot = false;
+    args.baudot_variant = BAUDOT_ITA2;
+    args.console = false;
+    args.baud = 9600;
+    args.transmit_delay = 0;
+    args.watch = NULL;
+    args.hook = NULL;
+    args.fifo = NULL;
 
     if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
         return -1;
 
-    fd = open(args.device, O_RDWR | O_NOCTTY | O_SYNC);
-    if (fd < 0) {
+    /* 5-level tapes, unless the adapter can only do more bits */
+    if (args.bits == 0)
+        args.bits = args.baudot ? 5 : 8;
+    baudot_init(&baudot, args.baudot_variant, false);
+
+    if (args.reconnect && reconnect_init(&rc, args.device, args.log_file) < 0)
+        return -1;
+
+    acq = calloc(1, sizeof(struct acquisition));
+    if (acq == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    acq->args = &args;
+    acq->rc = &rc;
+    acq->fd_log = -1;
+    acq->fifo_fd = -1;
+    atomic_init(&acq->head, 0);
+    atomic_init(&acq->gap, -1);
+    atomic_init(&acq->stop, false);
+    atomic_init(&acq->done, false);
+    atomic_init(&acq->match_head, 0);
+    atomic_init(&acq->match_tail, 0);
+    atomic_init(&acq->match_dropped, 0);
+
+    acq->fd = open(args.device, O_RDWR | O_NOCTTY | O_SYNC);
+    if (acq->fd < 0) {
         fprintf(stderr, "Error opening device %s: %s\n", args.device, strerror(errno));
+        free(acq);
         return -1;
     }
 
     /* Set communication parameters */
-    if (set_interface_attribs(fd, args.speed, args.parity, args.bits, args.stop_bits) < 0) {
+    if (set_interface_attribs(acq->fd, args.speed, args.parity, args.bits, args.stop_bits) < 0) {
         ret = -1;
         goto exit;
     }
 
     if (args.log_file) {
-        fd_log = open(args.log_file, O_WRONLY | O_CREAT | O_SYNC, 0644);
-        if (fd_log < 0) {
+        acq->fd_log = open(args.log_file, O_WRONLY | O_CREAT | O_SYNC, 0644);
+        if (acq->fd_log < 0) {
             fprintf(stderr, "Error opening log file %s: %s\n", args.log_file, strerror(errno));
             ret = -1;
             goto exit;
         }
     }
 
-    tcgetattr(0, &tc);
-    set_term_quiet_input();
+    if (args.metrics && metrics_start(args.metrics, metrics, histograms, update_metrics, &acq->fd) < 0) {
+        ret = -1;
+        goto exit;
+    }
 
-    do {
-        unsigned char ch;
-        num = read(fd, &ch, 1);
+    if (args.watch) {
+        int num = 0;
 
-        if (poll(&pfd, 1, 0)>0) {
-            int c = getchar();
-            if (c == 'q')
-                exit = true;
+        acq->watch = malloc(sizeof(struct ac));
+        if (acq->watch == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            ret = -1;
+            goto exit;
+        }
+        ac_init(acq->watch);
+        if ((num = ac_load(acq->watch, args.watch)) <= 0) {
+            if (num == 0)
+                fprintf(stderr, "No patterns in %s\n", args.watch);
+            ret = -1;
+            goto exit;
         }
+        ac_build(acq->watch);
+        fprintf(stderr, "Watching for %d patterns, %d states\n", num, acq->watch->states);
 
-        if (num < 1)
-            continue;
+        /* Hooks are not waited for */
+        if (args.hook)
+            signal(SIGCHLD, SIG_IGN);
+        /* A FIFO reader that goes away gives EPIPE */
+        signal(SIGPIPE, SIG_IGN);
+        if (args.fifo && mkfifo(args.fifo, 0644) < 0 && errno != EEXIST) {
+            fprintf(stderr, "Could not create FIFO %s: %s\n", args.fifo, strerror(errno));
+            ret = -1;
+            goto exit;
+        }
+    } else if (args.hook || args.fifo) {
+        fprintf(stderr, "--hook and --fifo need --watch\n");
+        ret = -1;
+        goto exit;
+    }
+
+    if ((acq->wake = eventfd(0, 0)) < 0) {
+        fprintf(stderr, "Error from eventfd: %s\n", strerror(errno));
+        ret = -1;
+        goto exit;
+    }
+
+    if (pthread_create(&thread, NULL, acquisition_thread, acq) != 0) {
+        fprintf(stderr, "Could not start the reader thread\n");
+        close(acq->wake);
+        ret = -1;
+        goto exit;
+    }
 
-        if (args.log_file)
-            write(fd_log, &ch, 1);
+    tcgetattr(0, &tc);
+    if (args.console) {
+        struct termios raw = tc;
 
-        if (args.quiet == false)
-            printchar(ch, num_recived);
+        cfmakeraw(&raw);
+        tcsetattr(0, TCSANOW, &raw);
+        console(acq);
+    } else {
+        set_term_quiet_input();
+        display(acq, &baudot);
+    }
+    pthread_join(thread, NULL);
 
-        num_recived++;
-    } while (num != -1 && !exit);
+    /* What the reader found after the display quit */
+    if (acq->watch)
+        watch_drain(acq);
 
     tcsetattr(0, TCSANOW, &tc);
     printf("\n");
+    close(acq->wake);
 
 exit:
-    if (fd_log > 0)
-        close(fd_log);
-    close(fd);
+    if (acq->fd_log > 0)
+        close(acq->fd_log);
+    if (acq->fd >= 0)
+        close(acq->fd);
+    if (acq->watch) {
+        ac_free(acq->watch);
+        free(acq->watch);
+    }
+    free(acq);
     return ret;
 }
@@ -0,0 +1,541 @@
+/*
+ * Program for splitting long raw captures into separate papertapes
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+const char *argp_program_version =
+    "split-tapes 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for splitting raw captures with many papertapes back to back into one file per tape. " \
+    "Tapes are separated by runs of leader/trailer, every tape is classified as bin, rim or ascii, bin " \
+    "checksums are verified and an index is written to PREFIX.tsv.\v" \
+    "Every tape is written as PREFIX-NNN.bin/.rim/.txt/.raw with a new leader and trailer of the gap " \
+    "char. Segments with only blank tape and leader between the gaps are skipped. The input is memory mapped and scanned 64 bytes at a time with SSE2 where available.";
+
+static char args_doc[] = "FILE";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"output-dir",      'o', "DIR",         0, "Directory for the tapes and the index, default ."},
+    {"prefix",          'p', "NAME",        0, "File name prefix, default tape"},
+    {"min-run",         'n', "NUMBER",      0, "Shortest run of gap chars that separates two tapes, default 8"},
+    {"gap-char",        'c', "0xXX",        0, "Leader/trailer char, default 0x80, 0x00 for blank tape"},
+    {"leader",          'L', "NUMBER",      0, "Leader and trailer written around every tape, default 16"},
+    {"min-size",        'm', "BYTES",       0, "Skip tapes shorter than this, default 4"},
+    {"list",            'l', 0,             0, "Only print the index, don't write any files"},
+    { 0 }
+};
+
+
+/* Define control codes and bit masks */
+#define CC_ORIGIN       0x40
+#define CC_FIELD        0xC0
+#define CC_FIELD_MASK   0xC7
+#define CC_CONTROL_MASK 0xC0
+
+
+enum tape_type {
+    TT_RAW,
+    TT_BIN,
+    TT_RIM,
+    TT_ASCII,
+};
+
+static const char *type_name[] = { "raw", "bin", "rim", "ascii" };
+static const char *type_ext[] = { "raw", "bin", "rim", "txt" };
+
+
+/* A run of gap chars, [start, end) */
+struct gap {
+    size_t start;
+    size_t end;
+};
+
+struct gaps {
+    struct gap *gap;
+    size_t num;
+    size_t size;
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *file;
+    char *dir;
+    char *prefix;
+    size_t min_run;
+    int gap_char;
+    int leader;
+    size_t min_size;
+    bool list;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'o':
+        arguments->dir = arg;
+        break;
+    case 'p':
+        arguments->prefix = arg;
+        break;
+    case 'n':
+        arguments->min_run = strtoul(arg, NULL, 0);
+        if (arguments->min_run < 1) {
+            fprintf(stderr, "Invalid run length: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'c':
+        if (sscanf(arg, "0x%x", &arguments->gap_char) != 1 ||
+            arguments->gap_char < 0x00 || arguments->gap_char > 0xff) {
+            fprintf(stderr, "Invalid gap char, must be 0x00 - 0xff: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'L':
+        arguments->leader = atoi(arg);
+        if (arguments->leader < 0 || arguments->leader > 1000) {
+            fprintf(stderr, "Invalid leader length: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'm':
+        arguments->min_size = strtoul(arg, NULL, 0);
+        break;
+    case 'l':
+        arguments->list = true;
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num != 0) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->file = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num != 1) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+/* A run of RUN gap chars ends at END, keep it if it is long enough */
+static int end_run(struct gaps *g, size_t end, size_t run, size_t min_run)
+{
+    if (run < min_run)
+        return 0;
+
+    if (g->num == g->size) {
+        struct gap *p;
+
+        g->size = g->size ? 2 * g->size : 1024;
+        if ((p = realloc(g->gap, g->size * sizeof(*p))) == NULL) {
+            fprintf(stderr, "Out of memory, %zu gaps found\n", g->num);
+            return -1;
+        }
+        g->gap = p;
+    }
+    g->gap[g->num].start = end - run;
+    g->gap[g->num].end = end;
+    g->num++;
+    return 0;
+}
+
+
+#ifdef __SSE2__
+/* Runs in one 16 byte chunk, MASK has a bit set for every gap char */
+static int scan_mask(struct gaps *g, size_t base, unsigned mask, size_t *run, size_t min_run)
+{
+    unsigned j = 0, n;
+
+    while (j < 16) {
+        if (mask & (1u << j)) {
+            n = __builtin_ctz(~(mask >> j));
+            *run += n;
+        } else {
+            if (*run && end_run(g, base + j, *run, min_run) < 0)
+                return -1;
+            *run = 0;
+            n = (mask >> j) ? __builtin_ctz(mask >> j) : 16 - j;
+        }
+        j += n;
+    }
+    return 0;
+}
+#endif
+
+
+/*
+ * Find all runs of at least MIN_RUN gap chars. Tape data is skipped 64
+ * bytes at a time, only chunks with gap chars are looked at closer.
+ */
+static int find_gaps(const unsigned char *p, size_t len, int c, size_t min_run, struct gaps *g)
+{
+    size_t i = 0, run = 0;
+
+#ifdef __SSE2__
+    const __m128i pattern = _mm_set1_epi8(c);
+
+    for (; i + 64 <= len; i += 64) {
+        __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), pattern);
+        __m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 16)), pattern);
+        __m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 32)), pattern);
+        __m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 48)), pattern);
+        unsigned any = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3)));
+        unsigned all = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3)));
+
+        if (any == 0 && run == 0)
+            continue;
+        if (all == 0xffff) {
+            run += 64;
+            continue;
+        }
+
+        if (scan_mask(g, i, _mm_movemask_epi8(m0), &run, min_run) < 0 ||
+            scan_mask(g, i + 16, _mm_movemask_epi8(m1), &run, min_run) < 0 ||
+            scan_mask(g, i + 32, _mm_movemask_epi8(m2), &run, min_run) < 0 ||
+            scan_mask(g, i + 48, _mm_movemask_epi8(m3), &run, min_run) < 0)
+            return -1;
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (p[i] == c) {
+            run++;
+        } else {
+            if (run && end_run(g, i, run, min_run) < 0)
+                return -1;
+            run = 0;
+        }
+    }
+    return run ? end_run(g, len, run, min_run) : 0;
+}
+
+
+static bool is_field(unsigned char c)
+{
+    return (c & CC_FIELD_MASK) == CC_FIELD;
+}
+
+
+/* Per char tables, filled in by init_tables() */
+static unsigned char printable[256];
+static unsigned char frame_value[256];
+static unsigned char frame_bad[256];
+
+static void init_tables(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        int c = i & 0x7f;
+
+        printable[i] = (c >= 0x20 && c < 0x7f) || c == '\r' || c == '\n' || c == '\t' || c == '\f';
+        frame_value[i] = is_field(i) ? 0 : i;
+        frame_bad[i] = (i & 0x80) && !is_field(i);
+    }
+}
+
+
+/* Every fourth frame starts an origin, as the RIM loader wants it */
+static bool is_rim(const unsigned char *p, size_t len)
+{
+    size_t i;
+
+    if (len < 4 || len % 4)
+        return false;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] & 0x80)
+            return false;
+        if (((i % 4) == 0) != ((p[i] & CC_ORIGIN) != 0))
+            return false;
+    }
+    return true;
+}
+
+
+/*
+ * Starts with an origin or field setting, only data and field frames.
+ * The checksum is the sum of all frames but field settings, the last
+ * word is the checksum itself. Returns false if it is not a bin tape.
+ */
+static bool check_bin(const unsigned char *p, size_t len, bool *ok, int *calc, int *recv)
+{
+    unsigned sum = 0, bad = 0;
+    int c1 = -1, c2 = -1;
+    size_t i;
+
+    if (len < 4 || !((p[0] & CC_CONTROL_MASK) == CC_ORIGIN || is_field(p[0])))
+        return false;
+
+    /* No branches in the loop, this is where the time goes */
+    for (i = 0; i < len; i++) {
+        sum += frame_value[p[i]];
+        bad |= frame_bad[p[i]];
+    }
+    if (bad)
+        return false;
+
+    for (i = len; i-- > 0 && c2 < 0; ) {
+        if (is_field(p[i]))
+            continue;
+        if (c1 < 0)
+            c1 = p[i];
+        else
+            c2 = p[i];
+    }
+    if (c2 < 0)
+        return false;
+
+    *recv = (c2 & 0x3f) << 6 | (c1 & 0x3f);
+    *calc = (sum - c1 - c2) & 07777;
+    *ok = *calc == *recv;
+    return true;
+}
+
+
+/* Mostly printable with parity stripped */
+
+static bool is_ascii(const unsigned char *p, size_t len)
+{
+    size_t i, count = 0;
+
+    for (i = 0; i < len; i++)
+        count += printable[p[i]];
+    return count >= len - len / 20;
+}
+
+
+/* Only blank tape and leader, e.g. the unpunched stretch between two tapes */
+static bool is_blank(const unsigned char *p, size_t len, int c)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (p[i] != 0x00 && p[i] != 0x80 && p[i] != c)
+            return false;
+    return true;
+}
+
+
+/* First load address, bin tapes may start with a field setting */
+static int first_origin(const unsigned char *p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i++)
+        if ((p[i] & CC_CONTROL_MASK) == CC_ORIGIN)
+            return (p[i] & 0x3f) << 6 | (p[i + 1] & 0x3f);
+    return -1;
+}
+
+
+static int write_tape(const char *path, const unsigned char *p, size_t len, int leader, int c)
+{
+    unsigned char lead[1000];
+    FILE *f;
+
+    memset(lead, c, leader);
+
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fwrite(lead, 1, leader, f) != leader || fwrite(p, 1, len, f) != len ||
+        fwrite(lead, 1, leader, f) != leader) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        fclose(f);
+        return -1;
+    }
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct gaps gaps = { NULL, 0, 0 };
+    const unsigned char *map;
+    char path[4096];
+    size_t start, i;
+    struct stat st;
+    FILE *index;
+    int num = 0, skipped = 0, failed = 0;
+    int fd;
+
+    args.file = NULL;
+    args.dir = ".";
+    args.prefix = "tape";
+    args.min_run = 8;
+    args.gap_char = 0x80;
+    args.leader = 16;
+    args.min_size = 4;
+    args.list = false;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    init_tables();
+
+    if ((fd = open(args.file, O_RDONLY)) < 0) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", args.file, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error from fstat: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: Empty file\n", args.file);
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error from mmap: %s\n", strerror(errno));
+        return -1;
+    }
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+    if (find_gaps(map, st.st_size, args.gap_char, args.min_run, &gaps) < 0) {
+        munmap((void *)map, st.st_size);
+        return -1;
+    }
+
+    if (args.list) {
+        index = stdout;
+    } else {
+        snprintf(path, sizeof(path), "%s/%s.tsv", args.dir, args.prefix);
+        if ((index = fopen(path, "w")) == NULL) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", path, strerror(errno));
+            munmap((void *)map, st.st_size);
+            return -1;
+        }
+    }
+    fprintf(index, "#tape\tfile\ttype\toffset\tlength\torigin\tchecksum\n");
+
+    /* The tapes are what is left between the gaps */
+    for (start = 0, i = 0; i <= gaps.num; i++) {
+        size_t end = i < gaps.num ? gaps.gap[i].start : (size_t)st.st_size;
+        const unsigned char *p = map + start;
+        size_t len = end - start;
+        enum tape_type type = TT_RAW;
+        char checksum[32] = "-";
+        char origin[8] = "-";
+        int calc = 0, recv = 0;
+        bool ok;
+
+        start = i < gaps.num ? gaps.gap[i].end : end;
+
+        if (len == 0)
+            continue;
+        if (len < args.min_size || is_blank(p, len, args.gap_char)) {
+            skipped++;
+            continue;
+        }
+
+        if (is_rim(p, len)) {
+            type = TT_RIM;
+        } else if (check_bin(p, len, &ok, &calc, &recv)) {
+            type = TT_BIN;
+            if (ok) {
+                snprintf(checksum, sizeof(checksum), "ok");
+            } else {
+                snprintf(checksum, sizeof(checksum), "fail %04o/%04o", calc, recv);
+                failed++;
+            }
+        } else if (is_ascii(p, len)) {
+            type = TT_ASCII;
+        }
+
+        if ((type == TT_BIN || type == TT_RIM) && first_origin(p, len) >= 0)
+            snprintf(origin, sizeof(origin), "%04o", first_origin(p, len));
+
+        snprintf(path, sizeof(path), "%s-%03d.%s", args.prefix, num, type_ext[type]);
+        fprintf(index, "%d\t%s\t%s\t%zu\t%zu\t%s\t%s\n", num, path, type_name[type], (size_t)(p - map),
+                len, origin, checksum);
+
+        if (!args.list) {
+            snprintf(path, sizeof(path), "%s/%s-%03d.%s", args.dir, args.prefix, num, type_ext[type]);
+            if (write_tape(path, p, len, args.leader, args.gap_char) < 0) {
+                fclose(index);
+                munmap((void *)map, st.st_size);
+                return -1;
+            }
+        }
+        num++;
+    }
+
+    if (!args.list)
+        fclose(index);
+
+    fprintf(stderr, "%d tapes, %d bin checksum failures, %d short or blank segments skipped\n", num, failed, skipped);
+
+    free(gaps.gap);
+    munmap((void *)map, st.st_size);
+    return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Program for converting OS/8 .SV core images to BIN tapes and boot ROMs
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintape.h"
+#include "bootrom.h"
+
+
+const char *argp_program_version =
+    "sv2bin 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for converting OS/8 .SV core images to a BIN (or RIM) papertape, or to the two boot ROM " \
+    "images of a M8317 board.\v" \
+    "The .SV file is read as one 12-bit word in two bytes, as os8-image get writes it in image mode. " \
+    "The core control block in block 0 gives the segments, which are converted in one pass. The " \
+    "start address is printed, a ROM gets it as its last command. A ROM only holds 120 commands " \
+    "after the autostart entries, so it is only for small programs, --skip-zero helps.";
+
+static char args_doc[] = "FILE.SV";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"output",          'o', "FILE",        0,                   "Output papertape, default stdout"},
+    {"format",          'F', "bin/rim",     0,                   "Papertape format, default bin"},
+    {"leader",          'L', "NUMBER",      0,                   "Leader and trailer length, default 16"},
+    {"skip-zero",       'z', 0,             0,                   "Leave out zero words, memory is not cleared"},
+    {"rom",             'R', "PREFIX",      OPTION_ARG_OPTIONAL, "Write PREFIX1.bin and PREFIX2.bin boot ROMs instead, default rom"},
+    { 0 }
+};
+
+
+/* OS/8 save image layout */
+#define OS8_BLOCK_WORDS     256
+#define CCB_SEGMENTS        4
+#define MAX_SEGMENTS        (OS8_BLOCK_WORDS - CCB_SEGMENTS)
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *file;
+    char *output;
+    bool rim;
+    int leader;
+    bool skip_zero;
+    char *rom;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'o':
+        arguments->output = arg;
+        break;
+    case 'F':
+        if (0 == strcmp(arg, "bin")) {
+            arguments->rim = false;
+        } else if (0 == strcmp(arg, "rim")) {
+            arguments->rim = true;
+        } else {
+            fprintf(stderr, "Invalid format: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'L':
+        arguments->leader = atoi(arg);
+        if (arguments->leader < 0) {
+            fprintf(stderr, "Invalid leader length: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'z':
+        arguments->skip_zero = true;
+        break;
+    case 'R':
+        arguments->rom = arg != NULL ? arg : "rom";
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num != 0) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->file = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num != 1) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+/* One 12-bit word, two bytes little endian */
+static int read_word(FILE *f)
+{
+    int lo, hi;
+
+    if ((lo = getc(f)) == EOF || (hi = getc(f)) == EOF)
+        return -1;
+    return (hi << 8 | lo) & 07777;
+}
+
+
+/* Front panel commands for a ROM, the same sequence create-bootrom makes */
+struct rom {
+    struct rom_entry entry[ROM_ENTRIES];
+    int num;
+    int field;
+    int addr;
+};
+
+
+static void rom_add(struct rom *r, int cmd, int data)
+{
+    if (r->num < ROM_ENTRIES) {
+        r->entry[r->num].cmd = cmd;
+        r->entry[r->num].data = data;
+    }
+    r->num++;
+}
+
+
+static void rom_word(struct rom *r, int field, int addr, int word)
+{
+    /* Deposit steps the address, extended address sets both IF and DF */
+    if (field != r->field || addr != r->addr) {
+        rom_add(r, ROM_LOADADDR, addr);
+        rom_add(r, ROM_LOADEX, field << 3 | field);
+        r->field = field;
+    }
+    rom_add(r, ROM_DEPOSIT, word);
+    r->addr = (addr + 1) & 07777;
+}
+
+
+static int write_rom(struct rom *r, const char *prefix, int start_field, int start)
+{
+    unsigned char rom1[ROM_BYTES], rom2[ROM_BYTES];
+    char file[4096];
+    int i;
+
+    if (start_field != r->field)
+        rom_add(r, ROM_LOADEX, start_field << 3 | start_field);
+    rom_add(r, ROM_LOADADDR | ROM_START, start);
+
+    if (r->num > ROM_ENTRIES) {
+        fprintf(stderr, "Needs %d ROM commands, there is only room for %d\n",
+                r->num - (int)ROM_AUTOSTART, ROM_ENTRIES - (int)ROM_AUTOSTART);
+        return -1;
+    }
+
+    memset(rom1, 0, sizeof(rom1));
+    memset(rom2, 0, sizeof(rom2));
+    for (i = 0; i < r->num; i++)
+        rom_encode(&r->entry[i], rom1, rom2, i);
+
+    snprintf(file, sizeof(file), "%s1.bin", prefix);
+    if (rom_write(file, rom1) < 0)
+        return -1;
+    snprintf(file, sizeof(file), "%s2.bin", prefix);
+    if (rom_write(file, rom2) < 0)
+        return -1;
+
+    fprintf(stderr, "%d of %d ROM commands used\n", r->num, ROM_ENTRIES);
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    int ccb[OS8_BLOCK_WORDS];
+    int num_segments, start_field, start, jsw;
+    int i, words = 0;
+    struct bintape tape = { 0 };
+    struct rom rom;
+    FILE *f, *out = NULL;
+
+    args.file = NULL;
+    args.output = NULL;
+    args.rim = false;
+    args.leader = 16;
+    args.skip_zero = false;
+    args.rom = NULL;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if ((f = fopen(args.file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", args.file, strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Core control block: -number of segments, CDF CIF of the start
+     * field, start address, job status word and the segments.
+     */
+    for (i = 0; i < OS8_BLOCK_WORDS; i++) {
+        if ((ccb[i] = read_word(f)) < 0) {
+            fprintf(stderr, "%s: Too short for a core image\n", args.file);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    num_segments = (010000 - ccb[0]) & 07777;
+    if (num_segments == 0 || num_segments > MAX_SEGMENTS || (ccb[1] & 07707) != 06203) {
+        fprintf(stderr, "%s: Not a core image, bad core control block %04o %04o\n", args.file, ccb[0], ccb[1]);
+        fclose(f);
+        return -1;
+    }
+
+    start_field = (ccb[1] >> 3) & 7;
+    start = ccb[2];
+    jsw = ccb[3];
+
+    if (args.rom == NULL) {
+        if (args.output != NULL) {
+            if ((out = fopen(args.output, "w")) == NULL) {
+                fprintf(stderr, "Could not write to file \"%s\": %s\n", args.output, strerror(errno));
+                fclose(f);
+                return -1;
+            }
+        } else {
+            out = stdout;
+        }
+        bintape_begin(&tape, out, args.rim, args.leader);
+    } else {
+        memcpy(rom.entry, rom_autostart, sizeof(rom_autostart));
+        rom.num = ROM_AUTOSTART;
+        rom.field = -1;
+        rom.addr = -1;
+    }
+
+    /* The segments follow each other from block 1, in the order of the control block */
+    for (i = 0; i < num_segments; i++) {
+        int seg = ccb[CCB_SEGMENTS + i];
+        int addr = seg & 07600;
+        int blocks = (seg >> 3) & 017;
+        int field = seg & 7;
+        int n;
+
+        if (blocks == 0)
+            blocks = 16;
+
+        if (addr + blocks * OS8_BLOCK_WORDS > 010000) {
+            fprintf(stderr, "%s: Segment %04o passes the end of field %o\n", args.file, seg, field);
+            goto error;
+        }
+
+        fprintf(stderr, "Segment %d: %o%04o-%o%04o\n", i, field, addr, field,
+                addr + blocks * OS8_BLOCK_WORDS - 1);
+
+        for (n = 0; n < blocks * OS8_BLOCK_WORDS; n++, addr++) {
+            int word = read_word(f);
+
+            if (word < 0) {
+                fprintf(stderr, "%s: Ends in segment %d\n", args.file, i);
+                goto error;
+            }
+
+            if (word == 0 && args.skip_zero)
+                continue;
+
+            if (args.rom != NULL)
+                rom_word(&rom, field, addr, word);
+            else if (bintape_word(&tape, field, addr, word) < 0)
+                goto error;
+            words++;
+        }
+    }
+    fclose(f);
+
+    fprintf(stderr, "%d words, start address %o%04o, JSW %04o\n", words, start_field, start, jsw);
+
+    if (args.rom != NULL)
+        return write_rom(&rom, args.rom, start_field, start);
+
+    bintape_end(&tape);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", args.output, strerror(errno));
+        return -1;
+    }
+    return 0;
+
+error:
+    fclose(f);
+    if (out != NULL && out != stdout)
+        fclose(out);
+    return -1;
+}
@@ -0,0 +1,888 @@
+/*
+ * Program for cataloging the text of ASCII papertapes in an archive
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <argp.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+const char *argp_program_version =
+    "tape-catalog 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for finding ASCII papertapes (FOCAL and BASIC programs, PAL source, listings) in an " \
+    "archive of raw captures by the words in them. " \
+    "Commands: build FILE|DIR..., search QUERY..., text FILE\v" \
+    "build reads every file, directories are walked, strips mark parity, leader and rubouts, and " \
+    "indexes the words of the tapes that are text. A word is a run of letters and digits, case " \
+    "is ignored. The index is one file with the words sorted, search maps it and finds each word " \
+    "by binary search. Every QUERY must match, a QUERY of more than one word is a phrase, e.g.\n\n" \
+    "  tape-catalog search focal \"lunar lander\"\n\n" \
+    "The tapes are listed with the most matches first. text prints the text of a tape as it is " \
+    "indexed.";
+
+static char args_doc[] = "COMMAND [ARG...]";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"index",       'i', "FILE",    0,  "Index file, default tapes.idx"},
+    {"context",     'c', 0,         0,  "Show the line of the first match of each tape"},
+    {"min-text",    'm', "PERCENT", 0,  "Part of a tape that must be printable to be text, default 90"},
+    {"max",         'n', "NUMBER",  0,  "Show at most NUMBER tapes, default all"},
+    { 0 }
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *index;
+    bool context;
+    int min_text;
+    int max;
+    char *command;
+    char **args;
+    int num_args;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case 'i':
+        arguments->index = arg;
+        break;
+    case 'c':
+        arguments->context = true;
+        break;
+    case 'm':
+        arguments->min_text = atoi(arg);
+        if (arguments->min_text < 0 || arguments->min_text > 100) {
+            fprintf(stderr, "Invalid percentage: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'n':
+        arguments->max = atoi(arg);
+        if (arguments->max < 1) {
+            fprintf(stderr, "Invalid number of tapes: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    case ARGP_KEY_ARG:
+        arguments->command = arg;
+        arguments->args = &state->argv[state->next];
+        arguments->num_args = state->argc - state->next;
+        state->next = state->argc;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 1){
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+/*
+ * Index file, all in host byte order:
+ *
+ *   header
+ *   tapes      struct idx_tape for each tape
+ *   terms      struct idx_term for each word, sorted by the word
+ *   pool       tape names and words, NUL terminated
+ *   postings   for each word and tape it is in: tape, count, positions
+ *
+ * A position is the number of the word in the tape, so a phrase is words
+ * at following positions.
+ */
+#define IDX_MAGIC       "TAPEIDX1"
+#define MAX_WORD        64
+
+struct idx_header {
+    char magic[8];
+    uint32_t tapes;
+    uint32_t terms;
+    uint64_t tape_off;
+    uint64_t term_off;
+    uint64_t pool_off;
+    uint64_t post_off;
+    uint64_t size;
+};
+
+struct idx_tape {
+    uint32_t name;          /* Offset in pool */
+    uint32_t words;
+};
+
+struct idx_term {
+    uint32_t str;           /* Offset in pool */
+    uint32_t tapes;         /* Number of tapes with the word */
+    uint64_t post;          /* First uint32_t of the postings */
+    uint64_t len;           /* Number of uint32_t in the postings */
+};
+
+
+static void *xrealloc(void *p, size_t size)
+{
+    if ((p = realloc(p, size)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    return p;
+}
+
+
+static char *read_file(const char *file, size_t *len)
+{
+    struct stat st;
+    char *buf;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fileno(f), &st) < 0) {
+        fclose(f);
+        return NULL;
+    }
+    buf = xrealloc(NULL, st.st_size + 1);
+    *len = fread(buf, 1, st.st_size, f);
+    fclose(f);
+    return buf;
+}
+
+
+/*
+ * The text of a tape in place: mark parity is stripped, leader, blank
+ * tape and rubouts dropped. Returns the new length, or -1 when less than
+ * MIN_TEXT percent of what is left is printable, which is a binary tape.
+ */
+static long extract_text(char *buf, size_t len, int min_text)
+{
+    size_t i, out = 0, printable = 0;
+
+    for (i = 0; i < len; i++) {
+        unsigned char c = buf[i] & 0x7f;
+
+        if (c == 0 || c == 0x7f)
+            continue;
+        if (isprint(c) || c == '\r' || c == '\n' || c == '\t' || c == '\f')
+            printable++;
+        else
+            c = ' ';
+        buf[out++] = c;
+    }
+    if (out == 0 || printable * 100 < out * min_text)
+        return -1;
+    return out;
+}
+
+
+/* Calls FN for every word of TEXT, lower case, with its offset */
+static void tokenize(const char *text, size_t len,
+                     void (*fn)(void *ctx, const char *word, size_t off), void *ctx)
+{
+    char word[MAX_WORD + 1];
+    size_t i = 0;
+
+    while (i < len) {
+        size_t start;
+        int n = 0;
+
+        while (i < len && !isalnum((unsigned char)text[i]))
+            i++;
+        if (i == len)
+            break;
+        start = i;
+        while (i < len && isalnum((unsigned char)text[i])) {
+            if (n < MAX_WORD)
+                word[n++] = tolower((unsigned char)text[i]);
+            i++;
+        }
+        word[n] = '\0';
+        fn(ctx, word, start);
+    }
+}
+
+
+/* Building, every word has its postings grown in memory as they will be written */
+struct term {
+    uint32_t str;
+    uint32_t tapes;
+    uint32_t *post;
+    uint64_t len;
+    uint64_t alloc;
+    uint64_t count;         /* Index of the count of the last tape */
+    int32_t last_tape;
+};
+
+struct builder {
+    char *pool;
+    size_t pool_len, pool_alloc;
+    struct term *terms;
+    uint32_t num_terms, alloc_terms;
+    int32_t *hash;          /* Term number or -1 */
+    uint32_t hash_size;
+    struct idx_tape *tapes;
+    uint32_t num_tapes, alloc_tapes;
+    uint32_t pos;           /* Word number in the current tape */
+    uint64_t words;
+};
+
+
+static uint32_t pool_add(struct builder *b, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    uint32_t off = b->pool_len;
+
+    if (b->pool_len + len > b->pool_alloc) {
+        b->pool_alloc = b->pool_alloc ? 2 * b->pool_alloc + len : 65536;
+        b->pool = xrealloc(b->pool, b->pool_alloc);
+    }
+    memcpy(b->pool + b->pool_len, s, len);
+    b->pool_len += len;
+    return off;
+}
+
+
+static uint32_t hash_word(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+
+static void hash_grow(struct builder *b)
+{
+    uint32_t i;
+
+    b->hash_size = b->hash_size ? 2 * b->hash_size : 65536;
+    b->hash = xrealloc(b->hash, b->hash_size * sizeof(int32_t));
+    memset(b->hash, 0xff, b->hash_size * sizeof(int32_t));
+    for (i = 0; i < b->num_terms; i++) {
+        uint32_t h = hash_word(b->pool + b->terms[i].str) & (b->hash_size - 1);
+
+        while (b->hash[h] >= 0)
+            h = (h + 1) & (b->hash_size - 1);
+        b->hash[h] = i;
+    }
+}
+
+
+static struct term *find_term(struct builder *b, const char *word)
+{
+    uint32_t h;
+    struct term *t;
+
+    if (2 * (b->num_terms + 1) > b->hash_size)
+        hash_grow(b);
+
+    h = hash_word(word) & (b->hash_size - 1);
+    while (b->hash[h] >= 0) {
+        t = &b->terms[b->hash[h]];
+        if (strcmp(b->pool + t->str, word) == 0)
+            return t;
+        h = (h + 1) & (b->hash_size - 1);
+    }
+
+    if (b->num_terms == b->alloc_terms) {
+        b->alloc_terms = b->alloc_terms ? 2 * b->alloc_terms : 4096;
+        b->terms = xrealloc(b->terms, b->alloc_terms * sizeof(struct term));
+    }
+    b->hash[h] = b->num_terms;
+    t = &b->terms[b->num_terms++];
+    memset(t, 0, sizeof(*t));
+    t->str = pool_add(b, word);
+    t->last_tape = -1;
+    return t;
+}
+
+
+static void post_add(struct term *t, uint32_t v)
+{
+    if (t->len == t->alloc) {
+        t->alloc = t->alloc ? 2 * t->alloc : 4;
+        t->post = xrealloc(t->post, t->alloc * sizeof(uint32_t));
+    }
+    t->post[t->len++] = v;
+}
+
+
+static void build_word(void *ctx, const char *word, size_t off)
+{
+    struct builder *b = ctx;
+    struct term *t = find_term(b, word);
+    int32_t tape = b->num_tapes - 1;
+
+    if (t->last_tape != tape) {
+        post_add(t, tape);
+        t->count = t->len;
+        post_add(t, 0);
+        t->last_tape = tape;
+        t->tapes++;
+    }
+    t->post[t->count]++;
+    post_add(t, b->pos++);
+    b->words++;
+}
+
+
+/* Files to index, collected by nftw() */
+static char **files;
+static int num_files;
+
+static int add_file(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if (type == FTW_F && S_ISREG(st->st_mode)) {
+        files = xrealloc(files, (num_files + 1) * sizeof(char *));
+        files[num_files++] = strdup(path);
+    }
+    return 0;
+}
+
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+static const char *sort_pool;
+
+static int compare_terms(const void *a, const void *b)
+{
+    const struct term *ta = a, *tb = b;
+
+    return strcmp(sort_pool + ta->str, sort_pool + tb->str);
+}
+
+
+static int write_all(FILE *f, const void *p, size_t len, const char *file)
+{
+    if (len > 0 && fwrite(p, len, 1, f) != 1) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int build(struct argp_arguments *args)
+{
+    struct builder b;
+    struct idx_header h;
+    struct idx_term it;
+    uint64_t post = 0;
+    char tmp[4096 + 4];
+    int i, skipped = 0;
+    uint32_t n;
+    FILE *f;
+
+    if (args->num_args < 1) {
+        fprintf(stderr, "build: Files or directories to index needed\n");
+        return -1;
+    }
+
+    for (i = 0; i < args->num_args; i++) {
+        if (nftw(args->args[i], add_file, 16, FTW_PHYS) != 0) {
+            fprintf(stderr, "Could not read \"%s\": %s\n", args->args[i], strerror(errno));
+            return -1;
+        }
+    }
+    qsort(files, num_files, sizeof(char *), compare_strings);
+
+    memset(&b, 0, sizeof(b));
+    for (i = 0; i < num_files; i++) {
+        size_t len;
+        long text;
+        char *buf;
+
+        if ((buf = read_file(files[i], &len)) == NULL)
+            continue;
+        if ((text = extract_text(buf, len, args->min_text)) < 0) {
+            skipped++;
+            free(buf);
+            continue;
+        }
+
+        if (b.num_tapes == b.alloc_tapes) {
+            b.alloc_tapes = b.alloc_tapes ? 2 * b.alloc_tapes : 256;
+            b.tapes = xrealloc(b.tapes, b.alloc_tapes * sizeof(struct idx_tape));
+        }
+        b.tapes[b.num_tapes].name = pool_add(&b, files[i]);
+        b.num_tapes++;
+        b.pos = 0;
+        tokenize(buf, text, build_word, &b);
+        b.tapes[b.num_tapes - 1].words = b.pos;
+        free(buf);
+    }
+
+    sort_pool = b.pool;
+    qsort(b.terms, b.num_terms, sizeof(struct term), compare_terms);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IDX_MAGIC, sizeof(h.magic));
+    h.tapes = b.num_tapes;
+    h.terms = b.num_terms;
+    h.tape_off = sizeof(h);
+    h.term_off = h.tape_off + (uint64_t)b.num_tapes * sizeof(struct idx_tape);
+    h.pool_off = h.term_off + (uint64_t)b.num_terms * sizeof(struct idx_term);
+    h.post_off = (h.pool_off + b.pool_len + 7) & ~7ULL;
+    for (n = 0; n < b.num_terms; n++)
+        post += b.terms[n].len;
+    h.size = h.post_off + post * sizeof(uint32_t);
+
+    /* Written next to it and renamed, a search never sees half an index */
+    snprintf(tmp, sizeof(tmp), "%s.new", args->index);
+    if ((f = fopen(tmp, "w")) == NULL) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    if (write_all(f, &h, sizeof(h), tmp) < 0 ||
+        write_all(f, b.tapes, b.num_tapes * sizeof(struct idx_tape), tmp) < 0)
+        goto error;
+    post = 0;
+    for (n = 0; n < b.num_terms; n++) {
+        it.str = b.terms[n].str;
+        it.tapes = b.terms[n].tapes;
+        it.post = post;
+        it.len = b.terms[n].len;
+        post += it.len;
+        if (write_all(f, &it, sizeof(it), tmp) < 0)
+            goto error;
+    }
+    if (write_all(f, b.pool, b.pool_len, tmp) < 0 ||
+        write_all(f, "\0\0\0\0\0\0\0", h.post_off - h.pool_off - b.pool_len, tmp) < 0)
+        goto error;
+    for (n = 0; n < b.num_terms; n++)
+        if (write_all(f, b.terms[n].post, b.terms[n].len * sizeof(uint32_t), tmp) < 0)
+            goto error;
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    if (rename(tmp, args->index) < 0) {
+        fprintf(stderr, "Could not rename \"%s\": %s\n", tmp, strerror(errno));
+        return -1;
+    }
+
+    printf("%u tapes, %d not text, %llu words, %u different, index %llu bytes\n",
+           b.num_tapes, skipped, (unsigned long long)b.words, b.num_terms, (unsigned long long)h.size);
+    return 0;
+
+error:
+    fclose(f);
+    unlink(tmp);
+    return -1;
+}
+
+
+/* Searching, all in the mapped index */
+struct index {
+    const struct idx_header *h;
+    const struct idx_tape *tapes;
+    const struct idx_term *terms;
+    const char *pool;
+    const uint32_t *post;
+    size_t size;
+};
+
+
+static int index_open(struct index *x, const char *file)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct idx_header)) {
+        fprintf(stderr, "%s: Not an index\n", file);
+        close(fd);
+        return -1;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Could not map \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    x->h = p;
+    x->size = st.st_size;
+    if (memcmp(x->h->magic, IDX_MAGIC, sizeof(x->h->magic)) != 0 || x->h->size != x->size) {
+        fprintf(stderr, "%s: Not an index, or from another version\n", file);
+        munmap(p, st.st_size);
+        return -1;
+    }
+    x->tapes = (const void *)((const char *)p + x->h->tape_off);
+    x->terms = (const void *)((const char *)p + x->h->term_off);
+    x->pool = (const char *)p + x->h->pool_off;
+    x->post = (const void *)((const char *)p + x->h->post_off);
+    return 0;
+}
+
+
+static const struct idx_term *index_find(const struct index *x, const char *word)
+{
+    uint32_t lo = 0, hi = x->h->terms;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(x->pool + x->terms[mid].str, word);
+
+        if (c == 0)
+            return &x->terms[mid];
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+
+/* A cursor over the postings of one word, a tape at a time */
+struct cursor {
+    const uint32_t *p;
+    const uint32_t *end;
+};
+
+
+static void cursor_init(struct cursor *c, const struct index *x, const struct idx_term *t)
+{
+    c->p = x->post + t->post;
+    c->end = c->p + t->len;
+}
+
+
+/* Step to the first tape >= TAPE, returns false at the end */
+static bool cursor_seek(struct cursor *c, uint32_t tape)
+{
+    while (c->p < c->end && c->p[0] < tape)
+        c->p += 2 + c->p[1];
+    return c->p < c->end;
+}
+
+
+static bool has_pos(const uint32_t *pos, uint32_t n, uint32_t want)
+{
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (pos[mid] == want)
+            return true;
+        if (pos[mid] < want)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+
+/* One QUERY argument, a word or a phrase */
+struct query {
+    char **words;
+    int num;
+    struct cursor *cur;
+};
+
+
+static void query_word(void *ctx, const char *word, size_t off)
+{
+    struct query *q = ctx;
+
+    q->words = xrealloc(q->words, (q->num + 1) * sizeof(char *));
+    q->words[q->num++] = strdup(word);
+}
+
+
+/*
+ * Matches of a query in TAPE, all cursors are on it. *FIRST gets the
+ * position of the first match.
+ */
+static uint32_t query_matches(struct query *q, uint32_t *first)
+{
+    const uint32_t *pos = q->cur[0].p + 2;
+    uint32_t n = q->cur[0].p[1];
+    uint32_t i, matches = 0;
+    int w;
+
+    for (i = 0; i < n; i++) {
+        for (w = 1; w < q->num; w++)
+            if (!has_pos(q->cur[w].p + 2, q->cur[w].p[1], pos[i] + w))
+                break;
+        if (w == q->num) {
+            if (matches == 0)
+                *first = pos[i];
+            matches++;
+        }
+    }
+    return matches;
+}
+
+
+struct result {
+    uint32_t tape;
+    uint32_t matches;
+    uint32_t first;
+};
+
+
+static int compare_results(const void *a, const void *b)
+{
+    const struct result *ra = a, *rb = b;
+
+    if (ra->matches != rb->matches)
+        return ra->matches < rb->matches ? 1 : -1;
+    return ra->tape < rb->tape ? -1 : ra->tape > rb->tape;
+}
+
+
+/* Finds the line of word number WANT for --context */
+struct context {
+    uint32_t want;
+    uint32_t n;
+    long off;
+};
+
+
+static void context_word(void *ctx, const char *word, size_t off)
+{
+    struct context *c = ctx;
+
+    if (c->n++ == c->want)
+        c->off = off;
+}
+
+
+static void show_context(const char *file, uint32_t pos, int min_text)
+{
+    struct context c = { pos, 0, -1 };
+    size_t len;
+    long text, start, end;
+    char *buf;
+
+    if ((buf = read_file(file, &len)) == NULL)
+        return;
+    if ((text = extract_text(buf, len, min_text)) >= 0)
+        tokenize(buf, text, context_word, &c);
+    if (c.off >= 0) {
+        for (start = c.off; start > 0 && buf[start - 1] != '\n' && buf[start - 1] != '\r'; start--)
+            ;
+        for (end = c.off; end < text && buf[end] != '\n' && buf[end] != '\r'; end++)
+            ;
+        if (end - start > 100)
+            end = start + 100;
+        printf("        %.*s\n", (int)(end - start), buf + start);
+    }
+    free(buf);
+}
+
+
+int search(struct argp_arguments *args)
+{
+    struct timespec t0, t1;
+    struct index x;
+    struct query *q;
+    struct result *res = NULL;
+    uint32_t num_res = 0, alloc_res = 0, i;
+    int a, w;
+
+    if (args->num_args < 1) {
+        fprintf(stderr, "search: Words to search for needed\n");
+        return -1;
+    }
+    if (index_open(&x, args->index) < 0)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    q = calloc(args->num_args, sizeof(struct query));
+    for (a = 0; a < args->num_args; a++) {
+        tokenize(args->args[a], strlen(args->args[a]), query_word, &q[a]);
+        if (q[a].num == 0) {
+            fprintf(stderr, "search: No word in \"%s\"\n", args->args[a]);
+            return -1;
+        }
+        q[a].cur = calloc(q[a].num, sizeof(struct cursor));
+        for (w = 0; w < q[a].num; w++) {
+            const struct idx_term *t = index_find(&x, q[a].words[w]);
+
+            /* A word that isn't there, nothing can match */
+            if (t == NULL)
+                goto done;
+            cursor_init(&q[a].cur[w], &x, t);
+        }
+    }
+
+    /* Walk the tapes of the first word, the others follow */
+    while (q[0].cur[0].p < q[0].cur[0].end) {
+        uint32_t tape = q[0].cur[0].p[0];
+        uint32_t next = tape;
+        struct result r = { tape, 0, 0 };
+
+        for (a = 0; a < args->num_args && next == tape; a++) {
+            for (w = 0; w < q[a].num && next == tape; w++) {
+                if (!cursor_seek(&q[a].cur[w], tape))
+                    goto done;
+                next = q[a].cur[w].p[0];
+            }
+        }
+        if (next != tape) {
+            cursor_seek(&q[0].cur[0], next);
+            continue;
+        }
+
+        for (a = 0; a < args->num_args; a++) {
+            uint32_t first = 0;
+            uint32_t m = query_matches(&q[a], &first);
+
+            if (m == 0) {
+                r.matches = 0;
+                break;
+            }
+            if (a == 0)
+                r.first = first;
+            r.matches += m;
+        }
+        if (r.matches > 0) {
+            if (num_res == alloc_res) {
+                alloc_res = alloc_res ? 2 * alloc_res : 64;
+                res = xrealloc(res, alloc_res * sizeof(struct result));
+            }
+            res[num_res++] = r;
+        }
+        cursor_seek(&q[0].cur[0], tape + 1);
+    }
+
+done:
+    qsort(res, num_res, sizeof(struct result), compare_results);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    for (i = 0; i < num_res && (args->max == 0 || i < (uint32_t)args->max); i++) {
+        const char *name = x.pool + x.tapes[res[i].tape].name;
+
+        printf("%6u  %s\n", res[i].matches, name);
+        if (args->context)
+            show_context(name, res[i].first, args->min_text);
+    }
+    fprintf(stderr, "%u of %u tapes in %.2f ms\n", num_res, x.h->tapes,
+            (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    for (a = 0; a < args->num_args; a++) {
+        for (w = 0; w < q[a].num; w++)
+            free(q[a].words[w]);
+        free(q[a].words);
+        free(q[a].cur);
+    }
+    free(q);
+    free(res);
+    munmap((void *)x.h, x.size);
+    return num_res > 0 ? 0 : 1;
+}
+
+
+int text(struct argp_arguments *args)
+{
+    size_t len;
+    long text;
+    char *buf;
+
+    if (args->num_args != 1) {
+        fprintf(stderr, "text: One tape file needed\n");
+        return -1;
+    }
+    if ((buf = read_file(args->args[0], &len)) == NULL)
+        return -1;
+    if ((text = extract_text(buf, len, args->min_text)) < 0) {
+        fprintf(stderr, "%s: Not a text tape\n", args->args[0]);
+        free(buf);
+        return -1;
+    }
+    fwrite(buf, 1, text, stdout);
+    free(buf);
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+
+    args.index = "tapes.idx";
+    args.context = false;
+    args.min_text = 90;
+    args.max = 0;
+    args.command = NULL;
+    args.args = NULL;
+    args.num_args = 0;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (strcmp(args.command, "build") == 0)
+        return build(&args);
+    if (strcmp(args.command, "search") == 0)
+        return search(&args);
+    if (strcmp(args.command, "text") == 0)
+        return text(&args);
+
+    fprintf(stderr, "Unknown command: %s\n", args.command);
+    return -1;
+}
@@ -0,0 +1,540 @@
+/*
+ * Program for patching PDP-8 BIN, RIM and core images
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bintape.h"
+
+
+const char *argp_program_version =
+    "tape-patch 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for patching PDP-8 programs: loads BIN, RIM and core images into a 32K word memory, " \
+    "applies patches from scripts or a prompt and writes a new tape with the right checksum.\v" \
+    "The files are loaded in order, a later one overwrites words of an earlier. A core image has " \
+    "one 12-bit word in two bytes, little endian, from field 0, as get-core and os8-image write " \
+    "them. Addresses are octal with the field first, 17600 is 7600 in field 1. Commands, one per " \
+    "line in a script, # starts a comment:\n\n" \
+    "  FADDR VALUE...        Deposit the values from FADDR on\n" \
+    "  FADDR                 Show the word at FADDR\n" \
+    "  check FADDR VALUE...  Stop unless the words from FADDR are these, before a patch\n" \
+    "  erase FADDR [FADDR]   Leave the words out of the tape\n" \
+    "  dump FADDR [FADDR]    Show the words, 8 on a line, on stderr\n" \
+    "  quit                  Write the tape and stop, also end of file\n" \
+    "  abort                 Stop without writing\n\n" \
+    "Only the words that were loaded or deposited are on the new tape, with an origin only where " \
+    "the addresses jump.";
+
+static char args_doc[] = "FILE...";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"output",          'o', "FILE",            0,  "Output, default stdout"},
+    {"format",          'F', "bin/rim/core",    0,  "Output format, default bin"},
+    {"input-format",    'I', "auto/bin/rim/core", 0, "Format of the input files, default auto"},
+    {"script",          's', "FILE",            0,  "Patch script, can be repeated"},
+    {"interactive",     'i', 0,                 0,  "Read commands from a prompt after the scripts"},
+    {"leader",          'L', "NUMBER",          0,  "Leader and trailer length, default 16"},
+    {"skip-zero",       'z', 0,                 0,  "Leave out zero words"},
+    {"force",           'f', 0,                 0,  "Load BIN tapes with a bad checksum"},
+    { 0 }
+};
+
+
+enum format {
+    FMT_AUTO,
+    FMT_BIN,
+    FMT_RIM,
+    FMT_CORE,
+};
+
+
+#define MAX_SCRIPTS     16
+#define MEM_WORDS       (8 * 010000)
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char **files;
+    int num_files;
+    char *output;
+    enum format format;
+    enum format input_format;
+    char *script[MAX_SCRIPTS];
+    int num_scripts;
+    bool interactive;
+    int leader;
+    bool skip_zero;
+    bool force;
+};
+
+
+static int parse_format(const char *arg, bool input)
+{
+    if (input && 0 == strcmp(arg, "auto"))
+        return FMT_AUTO;
+    if (0 == strcmp(arg, "bin"))
+        return FMT_BIN;
+    if (0 == strcmp(arg, "rim"))
+        return FMT_RIM;
+    if (0 == strcmp(arg, "core"))
+        return FMT_CORE;
+    return -1;
+}
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+    int format;
+
+    switch (key){
+    case 'o':
+        arguments->output = arg;
+        break;
+    case 'F':
+    case 'I':
+        if ((format = parse_format(arg, key == 'I')) < 0) {
+            fprintf(stderr, "Invalid format: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        if (key == 'F')
+            arguments->format = format;
+        else
+            arguments->input_format = format;
+        break;
+    case 's':
+        if (arguments->num_scripts == MAX_SCRIPTS) {
+            fprintf(stderr, "At most %d scripts\n", MAX_SCRIPTS);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->script[arguments->num_scripts++] = arg;
+        break;
+    case 'i':
+        arguments->interactive = true;
+        break;
+    case 'L':
+        arguments->leader = atoi(arg);
+        if (arguments->leader < 0) {
+            fprintf(stderr, "Invalid leader length: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'z':
+        arguments->skip_zero = true;
+        break;
+    case 'f':
+        arguments->force = true;
+        break;
+
+    case ARGP_KEY_ARG:
+        arguments->files = &state->argv[state->next - 1];
+        arguments->num_files = state->argc - state->next + 1;
+        state->next = state->argc;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 1) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+/* The memory, a word is only written out if it was loaded or deposited */
+static int mem[MEM_WORDS];
+static bool loaded[MEM_WORDS];
+static int patched;
+
+
+static unsigned char *read_file(const char *file, size_t *len)
+{
+    unsigned char *buf = NULL;
+    size_t size = 0;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return NULL;
+    }
+    *len = 0;
+    do {
+        size = size ? 2 * size : 65536;
+        if ((buf = realloc(buf, size)) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            fclose(f);
+            return NULL;
+        }
+        *len += fread(buf + *len, 1, size - *len, f);
+    } while (*len == size);
+    fclose(f);
+    return buf;
+}
+
+
+/* Two bytes a word with the high four bits free, and no more than 32K words */
+static bool is_core(const unsigned char *p, size_t len)
+{
+    size_t i;
+
+    if (len == 0 || len % 2 != 0 || len > 2 * MEM_WORDS)
+        return false;
+    for (i = 1; i < len; i += 2)
+        if (p[i] & 0xf0)
+            return false;
+    return true;
+}
+
+
+static int load_file(const char *file, enum format format, bool force)
+{
+    struct bintape_info info;
+    unsigned char *p;
+    size_t len, i;
+
+    if ((p = read_file(file, &len)) == NULL)
+        return -1;
+
+    if (format == FMT_CORE || (format == FMT_AUTO && is_core(p, len))) {
+        if (len > 2 * MEM_WORDS) {
+            fprintf(stderr, "%s: Larger than 32K words\n", file);
+            free(p);
+            return -1;
+        }
+        for (i = 0; i + 1 < len; i += 2) {
+            mem[i / 2] = (p[i + 1] << 8 | p[i]) & 07777;
+            loaded[i / 2] = true;
+        }
+        fprintf(stderr, "%s: Core image, %zu words\n", file, len / 2);
+        free(p);
+        return 0;
+    }
+
+    if (bintape_load(p, len, mem, loaded, &info) < 0) {
+        fprintf(stderr, "%s: No words on the tape\n", file);
+        free(p);
+        return -1;
+    }
+    free(p);
+
+    if ((format == FMT_RIM && !info.rim) || (format == FMT_BIN && info.rim)) {
+        fprintf(stderr, "%s: Is a %s tape\n", file, info.rim ? "RIM" : "BIN");
+        return -1;
+    }
+    if (info.rim) {
+        fprintf(stderr, "%s: RIM tape, %d words\n", file, info.words);
+    } else if (info.csum != info.csum_tape) {
+        fprintf(stderr, "%s: BIN tape, %d words, bad checksum %04o, should be %04o\n",
+                file, info.words, info.csum_tape, info.csum);
+        if (!force)
+            return -1;
+    } else {
+        fprintf(stderr, "%s: BIN tape, %d words, checksum %04o\n", file, info.words, info.csum);
+    }
+    return 0;
+}
+
+
+/* An octal field and address, or a 12-bit word */
+static bool parse_octal(const char *s, int max, int *v)
+{
+    char *end;
+    long n;
+
+    if (s == NULL || *s == '\0')
+        return false;
+    n = strtol(s, &end, 8);
+    if (*end != '\0' || n < 0 || n > max)
+        return false;
+    *v = n;
+    return true;
+}
+
+
+static void dump(int from, int to)
+{
+    int a;
+
+    for (a = from & ~7; a <= to; a++) {
+        if ((a & 7) == 0)
+            fprintf(stderr, "%05o:", a);
+        if (a < from || !loaded[a])
+            fprintf(stderr, "     ");
+        else
+            fprintf(stderr, " %04o", mem[a]);
+        if ((a & 7) == 7 || a == to)
+            fprintf(stderr, "\n");
+    }
+}
+
+
+enum command_result {
+    CMD_OK,
+    CMD_ERROR,
+    CMD_QUIT,
+    CMD_ABORT,
+};
+
+
+/*
+ * One line of a script or from the prompt. An error stops a script, at
+ * the prompt it is only reported.
+ */
+static enum command_result command(char *line, const char *where)
+{
+    char *tok[64];
+    int num = 0, addr, addr2, value, i;
+    char *p;
+
+    if ((p = strchr(line, '#')) != NULL)
+        *p = '\0';
+    for (p = strtok(line, " \t\r\n,"); p != NULL && num < 64; p = strtok(NULL, " \t\r\n,"))
+        tok[num++] = p;
+    if (num == 0)
+        return CMD_OK;
+
+    if (strcmp(tok[0], "quit") == 0 || strcmp(tok[0], "q") == 0)
+        return CMD_QUIT;
+    if (strcmp(tok[0], "abort") == 0)
+        return CMD_ABORT;
+
+    if (strcmp(tok[0], "check") == 0 || strcmp(tok[0], "erase") == 0 || strcmp(tok[0], "dump") == 0) {
+        if (num < 2 || !parse_octal(tok[1], MEM_WORDS - 1, &addr)) {
+            fprintf(stderr, "%s: %s needs an address\n", where, tok[0]);
+            return CMD_ERROR;
+        }
+        if (tok[0][0] == 'c') {
+            for (i = 2; i < num; i++, addr = (addr + 1) % MEM_WORDS) {
+                if (!parse_octal(tok[i], 07777, &value)) {
+                    fprintf(stderr, "%s: Bad value %s\n", where, tok[i]);
+                    return CMD_ERROR;
+                }
+                if (!loaded[addr] || mem[addr] != value) {
+                    fprintf(stderr, "%s: %05o is ", where, addr);
+                    if (loaded[addr])
+                        fprintf(stderr, "%04o", mem[addr]);
+                    else
+                        fprintf(stderr, "not loaded");
+                    fprintf(stderr, ", not %04o\n", value);
+                    return CMD_ERROR;
+                }
+            }
+            return CMD_OK;
+        }
+
+        addr2 = addr;
+        if (num > 2 && (!parse_octal(tok[2], MEM_WORDS - 1, &addr2) || addr2 < addr)) {
+            fprintf(stderr, "%s: Bad address range\n", where);
+            return CMD_ERROR;
+        }
+        if (tok[0][0] == 'd') {
+            dump(addr, addr2);
+        } else {
+            for (i = addr; i <= addr2; i++)
+                if (loaded[i]) {
+                    loaded[i] = false;
+                    patched++;
+                }
+        }
+        return CMD_OK;
+    }
+
+    if (!parse_octal(tok[0], MEM_WORDS - 1, &addr)) {
+        fprintf(stderr, "%s: Unknown command %s\n", where, tok[0]);
+        return CMD_ERROR;
+    }
+    if (num == 1) {
+        if (loaded[addr])
+            fprintf(stderr, "%05o/ %04o\n", addr, mem[addr]);
+        else
+            fprintf(stderr, "%05o/ not loaded\n", addr);
+        return CMD_OK;
+    }
+
+    /* All values are checked before the first is deposited */
+    for (i = 1; i < num; i++) {
+        if (!parse_octal(tok[i], 07777, &value)) {
+            fprintf(stderr, "%s: Bad value %s\n", where, tok[i]);
+            return CMD_ERROR;
+        }
+    }
+    for (i = 1; i < num; i++, addr = (addr & 070000) | ((addr + 1) & 07777)) {
+        parse_octal(tok[i], 07777, &value);
+        if (!loaded[addr] || mem[addr] != value)
+            patched++;
+        mem[addr] = value;
+        loaded[addr] = true;
+    }
+    return CMD_OK;
+}
+
+
+/* Returns CMD_OK at the end of a script, or how it stopped */
+static enum command_result run_script(FILE *f, const char *name, bool prompt)
+{
+    char *line = NULL;
+    size_t size = 0;
+    char where[4096 + 16];
+    int num = 0;
+    enum command_result ret = CMD_OK;
+
+    for (;;) {
+        if (prompt)
+            fprintf(stderr, "* ");
+        if (getline(&line, &size, f) < 0)
+            break;
+        num++;
+        snprintf(where, sizeof(where), "%s:%d", name, num);
+        ret = command(line, where);
+        if (ret == CMD_ERROR && prompt)
+            ret = CMD_OK;
+        if (ret != CMD_OK)
+            break;
+    }
+    if (prompt && ret == CMD_OK)
+        fprintf(stderr, "\n");
+    free(line);
+    return ret;
+}
+
+
+static int write_output(struct argp_arguments *args)
+{
+    struct bintape tape = { 0 };
+    int a, words = 0;
+    FILE *out;
+
+    if (args->output != NULL) {
+        if ((out = fopen(args->output, "w")) == NULL) {
+            fprintf(stderr, "Could not write to file \"%s\": %s\n", args->output, strerror(errno));
+            return -1;
+        }
+    } else {
+        out = stdout;
+    }
+
+    if (args->format == FMT_CORE) {
+        int end = 0;
+
+        /* Whole fields, up to the last one with a word */
+        for (a = 0; a < MEM_WORDS; a++)
+            if (loaded[a] && !(args->skip_zero && mem[a] == 0))
+                end = (a | 07777) + 1;
+        for (a = 0; a < end; a++) {
+            int w = loaded[a] && !(args->skip_zero && mem[a] == 0) ? mem[a] : 0;
+
+            fputc(w & 0377, out);
+            fputc(w >> 8, out);
+            words++;
+        }
+    } else {
+        bintape_begin(&tape, out, args->format == FMT_RIM, args->leader);
+        for (a = 0; a < MEM_WORDS; a++) {
+            if (!loaded[a] || (args->skip_zero && mem[a] == 0))
+                continue;
+            if (bintape_word(&tape, a >> 12, a & 07777, mem[a]) < 0)
+                goto error;
+            words++;
+        }
+        bintape_end(&tape);
+    }
+
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", args->output, strerror(errno));
+        return -1;
+    }
+    if (args->format == FMT_BIN)
+        fprintf(stderr, "%d words, %d patched, checksum %04o\n", words, patched, tape.csum & 07777);
+    else
+        fprintf(stderr, "%d words, %d patched\n", words, patched);
+    return 0;
+
+error:
+    if (out != stdout)
+        fclose(out);
+    return -1;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    enum command_result ret = CMD_OK;
+    int i;
+
+    args.files = NULL;
+    args.num_files = 0;
+    args.output = NULL;
+    args.format = FMT_BIN;
+    args.input_format = FMT_AUTO;
+    args.num_scripts = 0;
+    args.interactive = false;
+    args.leader = 16;
+    args.skip_zero = false;
+    args.force = false;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    for (i = 0; i < args.num_files; i++)
+        if (load_file(args.files[i], args.input_format, args.force) < 0)
+            return -1;
+
+    for (i = 0; i < args.num_scripts && ret == CMD_OK; i++) {
+        FILE *f;
+
+        if ((f = fopen(args.script[i], "r")) == NULL) {
+            fprintf(stderr, "Could not open file \"%s\": %s\n", args.script[i], strerror(errno));
+            return -1;
+        }
+        ret = run_script(f, args.script[i], false);
+        fclose(f);
+    }
+
+    /* The prompt and what the commands show go to stderr, stdout can have the tape */
+    if (args.interactive && ret == CMD_OK)
+        ret = run_script(stdin, "stdin", isatty(0));
+
+    if (ret == CMD_ERROR || ret == CMD_ABORT) {
+        fprintf(stderr, "Nothing written\n");
+        return -1;
+    }
+    return write_output(&args);
+}
@@ -0,0 +1,883 @@
+/*
+ * Program for building papertape pipelines from the command line
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#define _GNU_SOURCE
+#include <argp.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+
+
+const char *argp_program_version =
+    "tape-pipe 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for connecting a source, stages and a sink into a pipeline, every element runs in a thread " \
+    "of its own. An element is TYPE[:ARG][@CPU], @CPU pins its thread to a cpu.\v" \
+    "Sources:\n" \
+    "  serial:DEV[,BAUD[,8N1[,h]]]  Serial port, default 9600 8N1, h for RTS/CTS, ends when\n" \
+    "                               the line has been idle for 1 s after the first data\n" \
+    "  file:FILE                    File, - for stdin\n" \
+    "  mmap:FILE                    Memory mapped file\n" \
+    "  pty                          New pseudo terminal, the name is printed\n" \
+    "  socket:PATH                  Listen on a UNIX socket, read the first connection\n" \
+    "Stages:\n" \
+    "  noise[:N]                    Drop everything before the first N (8) leader codes\n" \
+    "  raw[:0xXX]                   Strip lead in chars, like capture-papertape -Fraw\n" \
+    "  rim, bin                     Validate rim and bin tapes, like capture-papertape, the\n" \
+    "                               pipeline ends at the end of the tape\n" \
+    "  hexdump                      Hexdump like serial-dump\n" \
+    "  stats                        Count bytes and frame types, report at end\n" \
+    "Sinks:\n" \
+    "  serial:DEV[,...], file:FILE (- for stdout), pty, socket:PATH (connect)\n\n" \
+    "Example: tape-pipe serial:/dev/ttyUSB0,9600 bin stats file:tape.bin";
+
+static char args_doc[] = "SOURCE [STAGE...] SINK";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    { 0 }
+};
+
+
+#define MAX_STAGES 32
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char *elements[MAX_STAGES];
+    int num;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+
+    switch (key){
+    case ARGP_KEY_ARG:
+        if (arguments->num == MAX_STAGES) {
+            fprintf(stderr, "Too many pipeline elements\n");
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        arguments->elements[arguments->num++] = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (arguments->num < 2){
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+speed_t map_baudrate(int baud){
+    speed_t speed;
+
+    switch (baud) {
+    case 110:
+        speed = B110;
+        break;
+    case 150:
+        speed = B150;
+        break;
+    case 200:
+        speed = B200;
+        break;
+    case 300:
+        speed = B300;
+        break;
+    case 600:
+        speed = B600;
+        break;
+    case 1200:
+        speed = B1200;
+        break;
+    case 1800:
+        speed = B1800;
+        break;
+    case 2400:
+        speed = B2400;
+        break;
+    case 4800:
+        speed = B4800;
+        break;
+    case 9600:
+        speed = B9600;
+        break;
+    case 19200:
+        speed = B19200;
+        break;
+    case 38400:
+        speed = B38400;
+        break;
+    case 57600:
+        speed = B57600;
+        break;
+    case 115200:
+        speed = B115200;
+        break;
+    case 230400:
+        speed = B230400;
+        break;
+    case 460800:
+        speed = B460800;
+        break;
+    case 500000:
+        speed = B500000;
+        break;
+    case 576000:
+        speed = B576000;
+        break;
+    case 921600:
+        speed = B921600;
+        break;
+    case 1000000:
+        speed = B1000000;
+        break;
+    default:
+        speed = -1;
+    }
+    return speed;
+}
+
+
+int set_interface_attribs(int fd, speed_t speed, char parity, int bits, int stop_bits, bool handshake)
+{
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) < 0) {
+        fprintf(stderr, "Error from tcgetattr: %s\n", strerror(errno));
+        return -1;
+    }
+
+    cfsetspeed(&tty, speed);
+    tty.c_cflag |= (CLOCAL | CREAD);    /* ignore modem controls */
+    tty.c_cflag &= ~CSIZE;
+
+    if (bits == 5)
+        tty.c_cflag |= CS5;         /* 5-bit characters */
+    else if (bits == 6)
+        tty.c_cflag |= CS6;         /* 6-bit characters */
+    else if (bits == 7)
+        tty.c_cflag |= CS7;         /* 7-bit characters */
+    else if (bits == 8)
+        tty.c_cflag |= CS8;         /* 8-bit characters */
+    else
+        return -1;
+
+    if (parity == 'N') {
+        tty.c_cflag &= ~PARENB;     /* no parity */
+    } else if (parity == 'E') {
+        tty.c_cflag |= PARENB;      /* parity */
+        tty.c_cflag &= ~PARODD;     /* even parity */
+    } else if (parity == 'O') {
+        tty.c_cflag |= PARENB;      /* parity */
+        tty.c_cflag |= PARODD;      /* odd parity */
+    } else return -1;
+
+    if (stop_bits == 1)
+        tty.c_cflag &= ~CSTOPB;     /* 1 stop bit */
+    else
+        tty.c_cflag |= CSTOPB;      /* 2 stop bits */
+
+    if (handshake) {
+        tty.c_cflag |= CRTSCTS;     /* hardware flowcontrol */
+    } else {
+        tty.c_cflag &= ~CRTSCTS;    /* no hardware flowcontrol */
+    }
+
+    /* setup for non-canonical mode */
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_oflag &= ~OPOST;
+
+    /* Read with timeout, 1 s, like capture-papertape */
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 10;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        fprintf(stderr, "Error from tcsetattr: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Private data of the fd based sources and sinks */
+struct fd_priv {
+    int fd;
+    unsigned char *map;
+    size_t size;
+    size_t pos;                 /* Read so far, mmap and serial */
+};
+
+
+struct fd_priv *new_fd_priv(struct pl_stage *st)
+{
+    struct fd_priv *p = calloc(1, sizeof(struct fd_priv));
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    p->fd = -1;
+    st->priv = p;
+    return p;
+}
+
+
+int open_serial(struct pl_stage *st)
+{
+    struct fd_priv *p = new_fd_priv(st);
+    char *dev, *baud, *frame, *hs;
+    speed_t speed = B9600;
+    char *arg = st->arg ? strdup(st->arg) : NULL;
+
+    if (arg == NULL || (dev = strtok(arg, ",")) == NULL) {
+        fprintf(stderr, "serial: No device given\n");
+        free(arg);
+        return -1;
+    }
+    baud = strtok(NULL, ",");
+    frame = strtok(NULL, ",");
+    hs = strtok(NULL, ",");
+
+    if (baud && (speed = map_baudrate(atoi(baud))) == (speed_t)-1) {
+        fprintf(stderr, "Invalid baudrate: %s\n", baud);
+        free(arg);
+        return -1;
+    }
+    if (frame && (strlen(frame) != 3 || frame[0] < '5' || frame[0] > '8')) {
+        fprintf(stderr, "Invalid frame format, e.g. 8N1: %s\n", frame);
+        free(arg);
+        return -1;
+    }
+
+    p->fd = open(dev, O_RDWR | O_NOCTTY);
+    if (p->fd < 0) {
+        fprintf(stderr, "Error opening device %s: %s\n", dev, strerror(errno));
+        free(arg);
+        return -1;
+    }
+
+    if (set_interface_attribs(p->fd, speed, frame ? frame[1] : 'N', frame ? frame[0] - '0' : 8,
+                              frame ? frame[2] - '0' : 1, hs && hs[0] == 'h') < 0) {
+        close(p->fd);
+        free(arg);
+        return -1;
+    }
+
+    free(arg);
+    return 0;
+}
+
+
+int open_file_source(struct pl_stage *st)
+{
+    struct fd_priv *p = new_fd_priv(st);
+
+    if (st->arg == NULL || 0 == strcmp(st->arg, "-")) {
+        p->fd = 0;
+    } else if ((p->fd = open(st->arg, O_RDONLY)) < 0) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", st->arg, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int open_file_sink(struct pl_stage *st)
+{
+    struct fd_priv *p = new_fd_priv(st);
+
+    if (st->arg == NULL || 0 == strcmp(st->arg, "-")) {
+        p->fd = 1;
+    } else if ((p->fd = open(st->arg, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "Could not write to file \"%s\": %s\n", st->arg, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int open_mmap(struct pl_stage *st)
+{
+    struct fd_priv *p = new_fd_priv(st);
+    struct stat sb;
+    int fd;
+
+    if (st->arg == NULL || (fd = open(st->arg, O_RDONLY)) < 0) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", st->arg ? st->arg : "", strerror(errno));
+        return -1;
+    }
+
+    fstat(fd, &sb);
+    p->size = sb.st_size;
+    if (p->size) {
+        p->map = mmap(NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p->map == MAP_FAILED) {
+            fprintf(stderr, "Error from mmap: %s\n", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        madvise(p->map, p->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return 0;
+}
+
+
+int open_pty(struct pl_stage *st)
+{
+    struct fd_priv *p = new_fd_priv(st);
+    struct termios tty;
+
+    p->fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (p->fd < 0 || grantpt(p->fd) < 0 || unlockpt(p->fd) < 0) {
+        fprintf(stderr, "Could not create pty: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Raw, the data is binary */
+    tcgetattr(p->fd, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(p->fd, TCSANOW, &tty);
+
+    fprintf(stderr, "%s: %s\n", st->name, ptsname(p->fd));
+    return 0;
+}
+
+
+int open_socket(struct pl_stage *st, bool listening)
+{
+    struct fd_priv *p = new_fd_priv(st);
+    struct sockaddr_un addr;
+    int fd;
+
+    if (st->arg == NULL) {
+        fprintf(stderr, "socket: No path given\n");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", st->arg);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "Error from socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (!listening) {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "Error connecting to %s: %s\n", st->arg, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        p->fd = fd;
+        return 0;
+    }
+
+    unlink(st->arg);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        fprintf(stderr, "Error listening on %s: %s\n", st->arg, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "%s: waiting for connection on %s\n", st->name, st->arg);
+    p->fd = accept(fd, NULL, NULL);
+    close(fd);
+    if (p->fd < 0) {
+        fprintf(stderr, "Error from accept: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int open_socket_source(struct pl_stage *st)
+{
+    return open_socket(st, true);
+}
+
+
+int open_socket_sink(struct pl_stage *st)
+{
+    return open_socket(st, false);
+}
+
+
+/* One read, a pty without a slave gives EIO, that is end of data too */
+static ssize_t read_once(struct pl_stage *st, unsigned char *buff, size_t size)
+{
+    struct fd_priv *p = st->priv;
+    ssize_t n;
+
+    do {
+        n = read(p->fd, buff, size);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno != EIO)
+        fprintf(stderr, "%s: Error from read: %s\n", st->name, strerror(errno));
+    return n;
+}
+
+
+/* Waits with a timeout, so a pty or socket source ends on pl_stop() too */
+ssize_t read_fd(struct pl_stage *st, unsigned char *buff, size_t size)
+{
+    struct fd_priv *p = st->priv;
+    struct pollfd pfd = { p->fd, POLLIN, 0 };
+    int ret;
+
+    while (!atomic_load(st->stop)) {
+        ret = poll(&pfd, 1, 1000);
+        if (ret > 0)
+            return read_once(st, buff, size);
+        if (ret < 0 && errno != EINTR) {
+            fprintf(stderr, "%s: Error from poll: %s\n", st->name, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/* Waits for the tape to start, then a read that times out is the end of it */
+ssize_t read_serial(struct pl_stage *st, unsigned char *buff, size_t size)
+{
+    struct fd_priv *p = st->priv;
+    ssize_t n;
+
+    while ((n = read_once(st, buff, size)) == 0 && p->pos == 0 && !atomic_load(st->stop))
+        ;
+    if (n > 0)
+        p->pos += n;
+    return n;
+}
+
+
+ssize_t read_mmap(struct pl_stage *st, unsigned char *buff, size_t size)
+{
+    struct fd_priv *p = st->priv;
+    size_t n = p->size - p->pos < size ? p->size - p->pos : size;
+
+    memcpy(buff, p->map + p->pos, n);
+    p->pos += n;
+    return n;
+}
+
+
+void write_fd(struct pl_stage *st, const unsigned char *data, size_t len)
+{
+    struct fd_priv *p = st->priv;
+
+    while (len > 0) {
+        ssize_t n = write(p->fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: Error from write: %s\n", st->name, strerror(errno));
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+
+void close_fd(struct pl_stage *st)
+{
+    struct fd_priv *p = st->priv;
+
+    if (p->map)
+        munmap(p->map, p->size);
+    if (p->fd > 2)
+        close(p->fd);
+}
+
+
+/* Decoder stages */
+struct decode_priv {
+    struct tape_decoder d;
+    void (*decode)(struct tape_decoder *d, struct pl_out *out, unsigned char c);
+};
+
+
+int open_decoder(struct pl_stage *st)
+{
+    struct decode_priv *p = calloc(1, sizeof(struct decode_priv));
+    int strip = -1;
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    if (0 == strcmp(st->name, "raw")) {
+        if (st->arg && (sscanf(st->arg, "0x%x", &strip) != 1 || strip < 0 || strip > 0xff)) {
+            fprintf(stderr, "Invalid lead in, must be 0x00 - 0xff: %s\n", st->arg);
+            return -1;
+        }
+        p->decode = tape_raw;
+    } else if (0 == strcmp(st->name, "rim")) {
+        p->decode = tape_rim;
+    } else {
+        p->decode = tape_bin;
+    }
+
+    tape_decoder_init(&p->d, strip);
+    st->priv = p;
+    return 0;
+}
+
+
+void process_decoder(struct pl_stage *st, const unsigned char *data, size_t len)
+{
+    struct decode_priv *p = st->priv;
+
+    while (len--) {
+        p->decode(&p->d, &st->out, *data++);
+
+        if (p->d.verdict) {
+            if (p->d.verdict > 0)
+                fprintf(stderr, "Checksum OK!: %4o\n", p->d.recv);
+            else
+                fprintf(stderr, "Checksum FAIL!: calc %4o <-> recv %4o\n", p->d.calc, p->d.recv);
+            p->d.verdict = 0;
+        }
+
+        /* Past the trailer, nothing more of the tape will come */
+        if (p->d.state == TS_DONE) {
+            pl_stop(st);
+            break;
+        }
+    }
+}
+
+
+/* Noise filter, passes everything from the first run of leader codes */
+struct noise_priv {
+    int needed;
+    int run;
+    bool open;
+};
+
+
+int open_noise(struct pl_stage *st)
+{
+    struct noise_priv *p = calloc(1, sizeof(struct noise_priv));
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    p->needed = st->arg ? atoi(st->arg) : 8;
+    if (p->needed < 1) {
+        fprintf(stderr, "Invalid leader length: %s\n", st->arg);
+        return -1;
+    }
+    st->priv = p;
+    return 0;
+}
+
+
+void process_noise(struct pl_stage *st, const unsigned char *data, size_t len)
+{
+    struct noise_priv *p = st->priv;
+    size_t i;
+
+    if (p->open) {
+        pl_write(&st->out, data, len);
+        return;
+    }
+
+    for (i = 0; i < len; i++) {
+        p->run = data[i] == TAPE_LEAD ? p->run + 1 : 0;
+        if (p->run == p->needed) {
+            while (p->run--)
+                pl_put(&st->out, TAPE_LEAD);
+            p->open = true;
+            pl_write(&st->out, data + i + 1, len - i - 1);
+            return;
+        }
+    }
+}
+
+
+/* Hexdump in the serial-dump format */
+struct hexdump_priv {
+    unsigned long offset;
+    char ascii[17];
+};
+
+
+int open_hexdump(struct pl_stage *st)
+{
+    if ((st->priv = calloc(1, sizeof(struct hexdump_priv))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+void process_hexdump(struct pl_stage *st, const unsigned char *data, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    struct hexdump_priv *p = st->priv;
+    char line[24];
+
+    while (len--) {
+        int i = p->offset & 0xf;
+        unsigned char c = *data++;
+
+        if (i == 0) {
+            snprintf(line, sizeof(line), "%8.8lx  ", p->offset);
+            pl_write(&st->out, line, 10);
+        }
+
+        pl_put(&st->out, hex[c >> 4]);
+        pl_put(&st->out, hex[c & 0xf]);
+        pl_put(&st->out, ' ');
+        p->ascii[i] = isprint(c) ? c : '.';
+
+        if (i == 7)
+            pl_put(&st->out, ' ');
+        if (i == 15) {
+            pl_write(&st->out, " |", 2);
+            pl_write(&st->out, p->ascii, 16);
+            pl_write(&st->out, "|\n", 2);
+        }
+        p->offset++;
+    }
+}
+
+
+void close_hexdump(struct pl_stage *st)
+{
+    struct hexdump_priv *p = st->priv;
+
+    if (p->offset & 0xf)
+        pl_put(&st->out, '\n');
+}
+
+
+/* Statistics, everything is passed through */
+struct stats_priv {
+    unsigned long long bytes;
+    unsigned long long batches;
+    unsigned long long leader;
+    unsigned long long origin;
+    unsigned long long field;
+    unsigned long long data;
+    struct timespec start;
+};
+
+
+int open_stats(struct pl_stage *st)
+{
+    struct stats_priv *p = calloc(1, sizeof(struct stats_priv));
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    st->priv = p;
+    return 0;
+}
+
+
+void process_stats(struct pl_stage *st, const unsigned char *data, size_t len)
+{
+    struct stats_priv *p = st->priv;
+    unsigned long long count[4] = { 0 };
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        count[data[i] >> 6]++;
+
+    p->data += count[0];
+    p->origin += count[1];
+    p->leader += count[2];
+    p->field += count[3];
+    p->bytes += len;
+    p->batches++;
+
+    if (st->next)
+        pl_write(&st->out, data, len);
+}
+
+
+void close_stats(struct pl_stage *st)
+{
+    struct stats_priv *p = st->priv;
+    struct timespec now;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    secs = (now.tv_sec - p->start.tv_sec) + (now.tv_nsec - p->start.tv_nsec) / 1e9;
+
+    /* Frames by the two top bits, 00 data, 01 origin, 10 leader/trailer, 11 field */
+    fprintf(stderr, "%llu bytes in %llu batches, %.3f s, %.1f kB/s\n",
+            p->bytes, p->batches, secs, secs > 0 ? p->bytes / secs / 1000 : 0.0);
+    fprintf(stderr, "data %llu, origin %llu, leader/trailer %llu, field %llu\n",
+            p->data, p->origin, p->leader, p->field);
+}
+
+
+/* Known elements, where they can be used and how they are set up */
+#define PL_AS_SOURCE    1
+#define PL_AS_STAGE     2
+#define PL_AS_SINK      4
+
+struct element {
+    const char *name;
+    int use;
+    int (*open_source)(struct pl_stage *st);
+    int (*open)(struct pl_stage *st);
+    ssize_t (*read)(struct pl_stage *st, unsigned char *buff, size_t size);
+    void (*process)(struct pl_stage *st, const unsigned char *data, size_t len);
+    void (*close)(struct pl_stage *st);
+};
+
+
+static struct element elements[] = {
+    {"serial",  PL_AS_SOURCE | PL_AS_SINK,  open_serial,        open_serial,        read_serial, write_fd,           close_fd},
+    {"file",    PL_AS_SOURCE | PL_AS_SINK,  open_file_source,   open_file_sink,     read_fd,     write_fd,           close_fd},
+    {"mmap",    PL_AS_SOURCE,               open_mmap,          NULL,               read_mmap,   NULL,               close_fd},
+    {"pty",     PL_AS_SOURCE | PL_AS_SINK,  open_pty,           open_pty,           read_fd,     write_fd,           close_fd},
+    {"socket",  PL_AS_SOURCE | PL_AS_SINK,  open_socket_source, open_socket_sink,   read_fd,     write_fd,           close_fd},
+    {"noise",   PL_AS_STAGE,                NULL,               open_noise,         NULL,        process_noise,      NULL},
+    {"raw",     PL_AS_STAGE,                NULL,               open_decoder,       NULL,        process_decoder,    NULL},
+    {"rim",     PL_AS_STAGE,                NULL,               open_decoder,       NULL,        process_decoder,    NULL},
+    {"bin",     PL_AS_STAGE,                NULL,               open_decoder,       NULL,        process_decoder,    NULL},
+    {"hexdump", PL_AS_STAGE,                NULL,               open_hexdump,       NULL,        process_hexdump,    close_hexdump},
+    {"stats",   PL_AS_STAGE | PL_AS_SINK,   NULL,               open_stats,         NULL,        process_stats,      close_stats},
+    { 0 }
+};
+
+
+int setup_stage(struct pl_stage *st, char *spec, int use)
+{
+    struct element *e;
+    char *p;
+
+    st->cpu = -1;
+    if ((p = strrchr(spec, '@')) != NULL) {
+        *p = '\0';
+        st->cpu = atoi(p + 1);
+    }
+
+    st->arg = NULL;
+    if ((p = strchr(spec, ':')) != NULL) {
+        *p = '\0';
+        st->arg = p + 1;
+    }
+    st->name = spec;
+
+    for (e = elements; e->name != NULL; e++) {
+        if (0 == strcmp(e->name, spec))
+            break;
+    }
+
+    if (e->name == NULL) {
+        fprintf(stderr, "Unknown pipeline element: %s\n", spec);
+        return -1;
+    }
+
+    if (!(e->use & use)) {
+        fprintf(stderr, "%s can't be used as a %s\n", spec,
+                use == PL_AS_SOURCE ? "source" : use == PL_AS_SINK ? "sink" : "stage");
+        return -1;
+    }
+
+    if (use == PL_AS_SOURCE) {
+        st->open = e->open_source;
+        st->read = e->read;
+    } else {
+        st->open = e->open;
+        st->process = e->process;
+    }
+    st->close = e->close;
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    struct pl_stage *stages;
+    int i;
+
+    args.num = 0;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if ((stages = calloc(args.num, sizeof(struct pl_stage))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < args.num; i++) {
+        int use = i == 0 ? PL_AS_SOURCE : i == args.num - 1 ? PL_AS_SINK : PL_AS_STAGE;
+
+        if (setup_stage(&stages[i], args.elements[i], use) < 0) {
+            free(stages);
+            return -1;
+        }
+    }
+
+    if (pl_run(stages, args.num) < 0) {
+        free(stages);
+        return -1;
+    }
+
+    free(stages);
+    return 0;
+}
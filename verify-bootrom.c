@@ -0,0 +1,438 @@
+/*
+ * Program for verifying read back M8317 boot PROMs against their images
+ *
+ * Licence GPL 2.0
+ *
+ * By Anders Sandahl 2024
+ *
+ */
+
+#include <argp.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bootrom.h"
+
+
+const char *argp_program_version =
+    "verify-bootrom 0.99";
+
+const char *argp_program_bug_address =
+    "<anders@abc80.net>";
+
+
+/* Program documentation. */
+static char doc[] =
+    "Program for verifying M8317 boot PROMs read back by a programmer against the rom1.bin and " \
+    "rom2.bin images create-bootrom (or sv2bin) wrote.\v" \
+    "Every pair of dumps is compared with the expected pair. A dump can be binary or Intel HEX, " \
+    "which is told by its first char. Only the 4 bits the PROMs have are compared, --mask and " \
+    "--nibble handle programmers that read the other bits floating or put the data in the high " \
+    "nibble, --offset skips bytes before the PROM in a binary dump or is subtracted from the " \
+    "addresses of a HEX dump. A bad entry is shown as the front panel command it should be and " \
+    "the one the dump gives, with the address it deposits to. Dumps of the two PROMs given in " \
+    "the wrong order are recognised. With --batch every line of FILE is four files: " \
+    "EXPECTED1 EXPECTED2 DUMP1 DUMP2. The exit status is 0 only if all dumps are good.";
+
+static char args_doc[] = "EXPECTED1 EXPECTED2 [DUMP1 DUMP2]...";
+
+
+/* Options to be parsed. */
+static struct argp_option options[] = {
+    {"mask",        'm', "HEX",         0,  "Bits of a byte that are compared, default 0f"},
+    {"nibble",      'n', "low/high",    0,  "Nibble of the dump bytes that has the data, default low"},
+    {"offset",      'o', "NUMBER",      0,  "Bytes before the PROM in a dump, or HEX address of it"},
+    {"batch",       'b', "FILE",        0,  "Sets of four files to verify, one per line"},
+    {"max",         'M', "NUMBER",      0,  "Show at most NUMBER bad entries for each pair, default 16"},
+    { 0 }
+};
+
+
+/* Used by main to communicate with parse_opt. */
+struct argp_arguments
+{
+    char **files;
+    int num_files;
+    int mask;
+    bool high;
+    long offset;
+    char *batch;
+    int max;
+};
+
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+    /* Get the input argument from argp_parse, which we
+    know is a pointer to our arguments structure. */
+    struct argp_arguments *arguments = state->input;
+    char *end;
+
+    switch (key){
+    case 'm':
+        arguments->mask = strtol(arg, &end, 16);
+        if (*end != '\0' || arguments->mask <= 0 || arguments->mask > 0x0f) {
+            fprintf(stderr, "Invalid mask, 1-f: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'n':
+        if (0 == strcmp(arg, "low")) {
+            arguments->high = false;
+        } else if (0 == strcmp(arg, "high")) {
+            arguments->high = true;
+        } else {
+            fprintf(stderr, "Invalid nibble: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'o':
+        arguments->offset = strtol(arg, &end, 0);
+        if (*end != '\0' || arguments->offset < 0) {
+            fprintf(stderr, "Invalid offset: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+    case 'b':
+        arguments->batch = arg;
+        break;
+    case 'M':
+        arguments->max = atoi(arg);
+        if (arguments->max < 0) {
+            fprintf(stderr, "Invalid number of entries: %s\n", arg);
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    case ARGP_KEY_ARG:
+        arguments->files = &state->argv[state->next - 1];
+        arguments->num_files = state->argc - state->next + 1;
+        state->next = state->argc;
+        break;
+
+    case ARGP_KEY_END:
+        if (arguments->batch == NULL && (state->arg_num < 1 || arguments->num_files < 4 ||
+                                         arguments->num_files % 2 != 0)) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        if (arguments->batch != NULL && state->arg_num != 0) {
+            argp_usage (state);
+            return ARGP_ERR_UNKNOWN;
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+
+/* A PROM as read, bytes the dump doesn't have are -1 */
+struct prom {
+    int byte[ROM_BYTES];
+};
+
+
+static int hex_byte(const char *s)
+{
+    int hi, lo;
+
+    if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]))
+        return -1;
+    hi = isdigit((unsigned char)s[0]) ? s[0] - '0' : (s[0] | 0x20) - 'a' + 10;
+    lo = isdigit((unsigned char)s[1]) ? s[1] - '0' : (s[1] | 0x20) - 'a' + 10;
+    return hi << 4 | lo;
+}
+
+
+/* Intel HEX, data records with extended segment and linear addresses */
+static int read_hex(FILE *f, const char *file, struct prom *p, long offset)
+{
+    char line[600];
+    long base = 0;
+    int num = 0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int len, addr, type, sum = 0, i;
+        int data[256];
+
+        num++;
+        if (line[0] != ':') {
+            if (line[0] == '\r' || line[0] == '\n' || line[0] == '\0')
+                continue;
+            fprintf(stderr, "%s:%d: Not Intel HEX\n", file, num);
+            return -1;
+        }
+        if ((len = hex_byte(line + 1)) < 0 || (int)strlen(line) < 11 + 2 * len) {
+            fprintf(stderr, "%s:%d: Short record\n", file, num);
+            return -1;
+        }
+        for (i = 0; i < len + 5; i++) {
+            int b = hex_byte(line + 1 + 2 * i);
+
+            if (b < 0) {
+                fprintf(stderr, "%s:%d: Bad hex digit\n", file, num);
+                return -1;
+            }
+            sum += b;
+            if (i >= 4 && i < len + 4)
+                data[i - 4] = b;
+        }
+        if ((sum & 0xff) != 0) {
+            fprintf(stderr, "%s:%d: Bad record checksum\n", file, num);
+            return -1;
+        }
+        addr = hex_byte(line + 3) << 8 | hex_byte(line + 5);
+        type = hex_byte(line + 7);
+
+        switch (type) {
+        case 0:
+            for (i = 0; i < len; i++) {
+                long a = base + addr + i - offset;
+
+                if (a >= 0 && a < ROM_BYTES)
+                    p->byte[a] = data[i];
+            }
+            break;
+        case 1:
+            return 0;
+        case 2:
+            base = (long)(data[0] << 8 | data[1]) << 4;
+            break;
+        case 4:
+            base = (long)(data[0] << 8 | data[1]) << 16;
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Binary or Intel HEX. The offset and nibble are only for a dump, an
+ * expected image is as create-bootrom wrote it.
+ */
+static int read_prom(const char *file, struct prom *p, struct argp_arguments *args, bool dump)
+{
+    long offset = dump ? args->offset : 0;
+    bool high = dump && args->high;
+    int i, c, ret = 0;
+    FILE *f;
+
+    for (i = 0; i < ROM_BYTES; i++)
+        p->byte[i] = -1;
+
+    if ((f = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\": %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    if ((c = getc(f)) == ':') {
+        ungetc(c, f);
+        ret = read_hex(f, file, p, offset);
+    } else {
+        long n;
+
+        ungetc(c, f);
+        for (n = 0; n < offset && getc(f) != EOF; n++)
+            ;
+        for (i = 0; i < ROM_BYTES && (c = getc(f)) != EOF; i++)
+            p->byte[i] = c;
+    }
+    fclose(f);
+
+    for (i = 0; i < ROM_BYTES; i++)
+        if (p->byte[i] >= 0)
+            p->byte[i] = (high ? p->byte[i] >> 4 : p->byte[i]) & args->mask;
+    return ret;
+}
+
+
+static bool prom_equal(const struct prom *a, const struct prom *b)
+{
+    return memcmp(a->byte, b->byte, sizeof(a->byte)) == 0;
+}
+
+
+/* Like parse-bootrom, the command letters and the data */
+static void show_entry(const struct rom_entry *e, int field, int addr)
+{
+    printf("%c%c%c%c %04o", e->cmd & ROM_LOADADDR ? 'A' : ' ', e->cmd & ROM_LOADEX ? 'E' : ' ',
+           e->cmd & ROM_DEPOSIT ? 'D' : ' ', e->cmd & ROM_START ? 'S' : ' ', e->data);
+    if (e->cmd & ROM_DEPOSIT)
+        printf(" at %o%04o", field, addr);
+}
+
+
+/*
+ * The entries of a dump against the expected ones. The address is
+ * followed in the expected command stream, so a bad entry is shown with
+ * what it should deposit to.
+ */
+static int verify(const char *names[4], struct argp_arguments *args)
+{
+    struct prom exp1, exp2, dump1, dump2;
+    int n, bad = 0, missing = 0;
+    int diff1 = 0, diff2 = 0;
+    int addr = 0, field = 0;
+
+    if (read_prom(names[0], &exp1, args, false) < 0 || read_prom(names[1], &exp2, args, false) < 0 ||
+        read_prom(names[2], &dump1, args, true) < 0 || read_prom(names[3], &dump2, args, true) < 0)
+        return -1;
+
+    if (!prom_equal(&exp1, &exp2) && prom_equal(&dump1, &exp2) && prom_equal(&dump2, &exp1)) {
+        printf("FAIL %s %s: The PROMs are swapped\n", names[2], names[3]);
+        return 1;
+    }
+
+    for (n = 0; n < ROM_ENTRIES; n++) {
+        unsigned char e1[ROM_BYTES], e2[ROM_BYTES], d1[ROM_BYTES], d2[ROM_BYTES];
+        struct rom_entry want, got;
+        int i, wfield = field, waddr = addr;
+        bool gone = false;
+
+        for (i = 2 * n; i < 2 * n + 2; i++) {
+            e1[i] = exp1.byte[i] < 0 ? 0 : exp1.byte[i];
+            e2[i] = exp2.byte[i] < 0 ? 0 : exp2.byte[i];
+            d1[i] = dump1.byte[i] < 0 ? 0 : dump1.byte[i];
+            d2[i] = dump2.byte[i] < 0 ? 0 : dump2.byte[i];
+            gone |= dump1.byte[i] < 0 || dump2.byte[i] < 0;
+            if (dump1.byte[i] >= 0)
+                diff1 |= e1[i] ^ d1[i];
+            if (dump2.byte[i] >= 0)
+                diff2 |= e2[i] ^ d2[i];
+        }
+        rom_decode(&want, e1, e2, n);
+        rom_decode(&got, d1, d2, n);
+
+        /* The address the front panel has when the entry runs */
+        if (want.cmd & ROM_LOADADDR)
+            waddr = addr = want.data;
+        if (want.cmd & ROM_LOADEX)
+            wfield = field = want.data & 7;
+        if (want.cmd & ROM_DEPOSIT)
+            addr = (addr + 1) & 07777;
+
+        if (!gone && want.cmd == got.cmd && want.data == got.data)
+            continue;
+        if (gone)
+            missing++;
+        bad++;
+        if (bad > args->max)
+            continue;
+
+        printf("  entry %3d: ", n);
+        show_entry(&want, wfield, waddr);
+        printf(", dump has ");
+        if (gone) {
+            printf("no data\n");
+        } else {
+            show_entry(&got, wfield, (got.cmd & ROM_LOADADDR) ? got.data : waddr);
+            printf("\n");
+        }
+    }
+
+    if (bad == 0) {
+        printf("OK   %s %s\n", names[2], names[3]);
+        return 0;
+    }
+    if (bad > args->max)
+        printf("  ... %d more\n", bad - args->max);
+    printf("FAIL %s %s: %d bad entries", names[2], names[3], bad);
+    if (missing > 0)
+        printf(", %d not in the dump", missing);
+    if (diff1)
+        printf(", bits %x differ in ROM 1", diff1);
+    if (diff2)
+        printf(", bits %x differ in ROM 2", diff2);
+    printf("\n");
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct argp_arguments args;
+    int pairs = 0, good = 0, failed = 0;
+    int ret, i;
+
+    args.files = NULL;
+    args.num_files = 0;
+    args.mask = 0x0f;
+    args.high = false;
+    args.offset = 0;
+    args.batch = NULL;
+    args.max = 16;
+
+    if (0 > argp_parse (&argp, argc, argv, 0, 0, &args))
+        return -1;
+
+    if (args.batch != NULL) {
+        char line[4 * 4096];
+        int num = 0;
+        FILE *f;
+
+        if ((f = fopen(args.batch, "r")) == NULL) {
+            fprintf(stderr, "Could not open file \"%s\": %s\n", args.batch, strerror(errno));
+            return -1;
+        }
+        while (fgets(line, sizeof(line), f) != NULL) {
+            const char *names[4];
+            char *p;
+            int n = 0;
+
+            num++;
+            if ((p = strchr(line, '#')) != NULL)
+                *p = '\0';
+            for (p = strtok(line, " \t\r\n"); p != NULL && n < 4; p = strtok(NULL, " \t\r\n"))
+                names[n++] = p;
+            if (n == 0)
+                continue;
+            if (n != 4 || p != NULL) {
+                fprintf(stderr, "%s:%d: Four files needed\n", args.batch, num);
+                failed++;
+                continue;
+            }
+            pairs++;
+            if ((ret = verify(names, &args)) == 0)
+                good++;
+            else if (ret < 0)
+                failed++;
+        }
+        fclose(f);
+    } else {
+        for (i = 2; i < args.num_files; i += 2) {
+            const char *names[4] = { args.files[0], args.files[1], args.files[i], args.files[i + 1] };
+
+            pairs++;
+            if ((ret = verify(names, &args)) == 0)
+                good++;
+            else if (ret < 0)
+                failed++;
+        }
+    }
+
+    if (pairs > 1)
+        printf("%d of %d PROM pairs good\n", good, pairs);
+    if (failed > 0)
+        fprintf(stderr, "%d could not be read\n", failed);
+    return good == pairs && failed == 0 ? 0 : 1;
+}